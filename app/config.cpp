@@ -31,9 +31,32 @@
 #include <cstring>
 #include <iostream>
 #include <cstdio>
+#include <sched.h>
 
 #include "config.h"
 
+//////////////////////////////////////////////////////////////////////////
+/// Compiles the regular expression for a simple 'name = value' option
+///
+/// The value is always captured by the sixth subexpression.
+///
+/// @param regex the regular expression to compile
+/// @param name the name of the option
+/// @param value a regular expression that matches the option's value
+//////////////////////////////////////////////////////////////////////////
+static void compileOptionRegex(regex_t *regex, const char *name,
+                               const char *value) {
+    std::string re = std::string("(^[ \t]*)"
+                                 "(") + name + ")"
+                     "([ \t]*)"
+                     "(=)"
+                     "([ \t]*)"
+                     "(" + value + ")"
+                     "([ \t]*(#.*){0,1}$)";
+
+    regcomp(regex, re.c_str(), REG_NEWLINE | REG_EXTENDED);
+}
+
 //////////////////////////////////////////////////////////////////////////
 /// Compiles the regular expressions
 /// @param regex a set of (not yet) compiled regular expressions
@@ -83,6 +106,41 @@ static void initRegex(config_regex_t *regex) {
             "([^ \t#]*)"
             "([ \t]*(#.*){0,1}$)",
             REG_NEWLINE | REG_EXTENDED);
+    compileOptionRegex(&regex->broadcast_interval_min,
+                       "broadcast_interval_min", "[0-9]{1,5}");
+    compileOptionRegex(&regex->control_cpus, "control_cpus",
+                       "[0-9,-]+");
+    compileOptionRegex(&regex->control_priority, "control_priority",
+                       "[0-9]{1,2}");
+    compileOptionRegex(&regex->control_sched, "control_sched",
+                       "fifo|rr|other");
+    compileOptionRegex(&regex->device_cache, "device_cache",
+                       "[^ \t#]*");
+    compileOptionRegex(&regex->diseqc_delay, "diseqc_delay",
+                       "[0-9]{1,4}");
+    compileOptionRegex(&regex->discovery_early_exit,
+                       "discovery_early_exit", "yes|no");
+    compileOptionRegex(&regex->fast_removal, "fast_removal", "yes|no");
+    compileOptionRegex(&regex->flight_recorder_dir, "flight_recorder_dir",
+                       "[^ \t#]*");
+    compileOptionRegex(&regex->linger_time, "linger_time", "[0-9]{1,4}");
+    compileOptionRegex(&regex->liveness_probes, "liveness_probes",
+                       "[0-9]{1,2}");
+    compileOptionRegex(&regex->metrics_address, "metrics_address",
+                       "[0-9]{1,3}\\.[0-9]{1,3}\\.[0-9]{1,3}\\.[0-9]{1,3}");
+    compileOptionRegex(&regex->metrics_port, "metrics_port",
+                       "[0-9]{1,5}");
+    compileOptionRegex(&regex->reactor_cpus, "reactor_cpus",
+                       "[0-9,-]+");
+    compileOptionRegex(&regex->reactor_threads, "reactor_threads",
+                       "[0-9]{1,2}");
+    compileOptionRegex(&regex->receiver_cpus, "receiver_cpus",
+                       "[0-9,-]+");
+    compileOptionRegex(&regex->receiver_priority, "receiver_priority",
+                       "[0-9]{1,2}");
+    compileOptionRegex(&regex->receiver_sched, "receiver_sched",
+                       "fifo|rr|other");
+    compileOptionRegex(&regex->ts_stats, "ts_stats", "yes|no");
 }
 
 //////////////////////////////////////////////////////////////////////////
@@ -91,9 +149,28 @@ static void initRegex(config_regex_t *regex) {
 //////////////////////////////////////////////////////////////////////////
 static void freeRegex(config_regex_t *regex) {
     regfree(&regex->broadcast_interval);
+    regfree(&regex->broadcast_interval_min);
+    regfree(&regex->control_cpus);
+    regfree(&regex->control_priority);
+    regfree(&regex->control_sched);
+    regfree(&regex->device_cache);
     regfree(&regex->device_map_ip);
     regfree(&regex->device_map_mac);
+    regfree(&regex->diseqc_delay);
+    regfree(&regex->discovery_early_exit);
+    regfree(&regex->fast_removal);
+    regfree(&regex->flight_recorder_dir);
     regfree(&regex->interface);
+    regfree(&regex->linger_time);
+    regfree(&regex->liveness_probes);
+    regfree(&regex->metrics_address);
+    regfree(&regex->metrics_port);
+    regfree(&regex->reactor_cpus);
+    regfree(&regex->reactor_threads);
+    regfree(&regex->receiver_cpus);
+    regfree(&regex->receiver_priority);
+    regfree(&regex->receiver_sched);
+    regfree(&regex->ts_stats);
 }
 
 //////////////////////////////////////////////////////////////////////////
@@ -116,6 +193,48 @@ static bool copyFromMatch(const char *in_buf, const regmatch_t *match,
     return true;
 }
 
+//////////////////////////////////////////////////////////////////////////
+/// Parses the scheduling options of a thread
+/// @param sched the scheduling options of the thread
+/// @param cpus_re compiled regular expression of the CPU list option
+/// @param priority_re compiled regular expression of the priority option
+/// @param sched_re compiled regular expression of the policy option
+/// @param line line from a config file
+//////////////////////////////////////////////////////////////////////////
+static void parseSchedLine(sched_config_t *sched, const regex_t *cpus_re,
+                           const regex_t *priority_re,
+                           const regex_t *sched_re, const char *line) {
+    const int buf_len = 1024;
+    regmatch_t match[20];
+    char buf[buf_len];
+
+    if (regexec(cpus_re, line, 20, match, 0) == 0)
+        if (copyFromMatch(line, &match[6], buf, buf_len)) {
+            std::vector<int> cpus;
+
+            if (parseCPUList(cpus, buf) == 0)
+                sched->cpus = cpus;
+        }
+
+    if (regexec(priority_re, line, 20, match, 0) == 0)
+        if (copyFromMatch(line, &match[6], buf, buf_len)) {
+            int priority = atoi(buf);
+
+            if ((priority >= 1) && (priority <= 99))
+                sched->priority = priority;
+        }
+
+    if (regexec(sched_re, line, 20, match, 0) == 0)
+        if (copyFromMatch(line, &match[6], buf, buf_len)) {
+            if (strcmp(buf, "fifo") == 0)
+                sched->policy = SCHED_FIFO;
+            else if (strcmp(buf, "rr") == 0)
+                sched->policy = SCHED_RR;
+            else
+                sched->policy = SCHED_OTHER;
+        }
+}
+
 //////////////////////////////////////////////////////////////////////////
 /// Parses one configuration entry
 /// @param config a set of config options
@@ -137,6 +256,14 @@ static void parseConfigLine(config_t *config, config_regex_t *regex,
                 config->broadcast_interval = bcast_int;
         }
 
+    if (regexec(&regex->broadcast_interval_min, line, 20, match, 0) == 0)
+        if (copyFromMatch(line, &match[6], buf, buf_len)) {
+            int bcast_int = atoi(buf);
+
+            if ((bcast_int >= 100) && (bcast_int <= 60000))
+                config->broadcast_interval_min = bcast_int;
+        }
+
     if ((regexec(&regex->device_map_ip, line, 20, match, 0) == 0) ||
         (regexec(&regex->device_map_mac, line, 20, match,
                  0) == 0))
@@ -154,9 +281,86 @@ static void parseConfigLine(config_t *config, config_regex_t *regex,
             }
         }
 
+    if (regexec(&regex->device_cache, line, 20, match, 0) == 0)
+        if (copyFromMatch(line, &match[6], buf, buf_len))
+            config->device_cache = buf;
+
+    if (regexec(&regex->diseqc_delay, line, 20, match, 0) == 0)
+        if (copyFromMatch(line, &match[6], buf, buf_len)) {
+            int delay = atoi(buf);
+
+            if ((delay >= 15) && (delay <= 1000))
+                config->diseqc_delay = delay;
+        }
+
+    if (regexec(&regex->discovery_early_exit, line, 20, match, 0) == 0)
+        if (copyFromMatch(line, &match[6], buf, buf_len))
+            config->discovery_early_exit = (strcmp(buf, "yes") == 0);
+
+    if (regexec(&regex->fast_removal, line, 20, match, 0) == 0)
+        if (copyFromMatch(line, &match[6], buf, buf_len))
+            config->fast_removal = (strcmp(buf, "yes") == 0);
+
+    if (regexec(&regex->flight_recorder_dir, line, 20, match, 0) == 0)
+        if (copyFromMatch(line, &match[6], buf, buf_len))
+            config->flight_recorder_dir = buf;
+
     if (regexec(&regex->interface, line, 20, match, 0) == 0)
         if (copyFromMatch(line, &match[6], buf, buf_len))
             config->interface = buf;
+
+    if (regexec(&regex->linger_time, line, 20, match, 0) == 0)
+        if (copyFromMatch(line, &match[6], buf, buf_len)) {
+            int linger = atoi(buf);
+
+            if ((linger >= 0) && (linger <= 3600))
+                config->linger_time = linger;
+        }
+
+    if (regexec(&regex->liveness_probes, line, 20, match, 0) == 0)
+        if (copyFromMatch(line, &match[6], buf, buf_len)) {
+            int probes = atoi(buf);
+
+            if ((probes >= 1) && (probes <= 10))
+                config->liveness_probes = probes;
+        }
+
+    if (regexec(&regex->metrics_address, line, 20, match, 0) == 0)
+        if (copyFromMatch(line, &match[6], buf, buf_len))
+            config->metrics_address = buf;
+
+    if (regexec(&regex->metrics_port, line, 20, match, 0) == 0)
+        if (copyFromMatch(line, &match[6], buf, buf_len)) {
+            int port = atoi(buf);
+
+            if ((port >= 0) && (port <= 65535))
+                config->metrics_port = port;
+        }
+
+    parseSchedLine(&config->control_sched, &regex->control_cpus,
+                   &regex->control_priority, &regex->control_sched, line);
+    parseSchedLine(&config->receiver_sched, &regex->receiver_cpus,
+                   &regex->receiver_priority, &regex->receiver_sched, line);
+
+    if (regexec(&regex->reactor_cpus, line, 20, match, 0) == 0)
+        if (copyFromMatch(line, &match[6], buf, buf_len)) {
+            std::vector<int> cpus;
+
+            if (parseCPUList(cpus, buf) == 0)
+                config->reactor_cpus = cpus;
+        }
+
+    if (regexec(&regex->reactor_threads, line, 20, match, 0) == 0)
+        if (copyFromMatch(line, &match[6], buf, buf_len)) {
+            int threads = atoi(buf);
+
+            if ((threads >= 0) && (threads <= 64))
+                config->reactor_threads = threads;
+        }
+
+    if (regexec(&regex->ts_stats, line, 20, match, 0) == 0)
+        if (copyFromMatch(line, &match[6], buf, buf_len))
+            config->ts_stats = (strcmp(buf, "yes") == 0);
 }
 
 //////////////////////////////////////////////////////////////////////////
@@ -190,6 +394,70 @@ void loadConfig(config_t *config, const char *filename) {
 //////////////////////////////////////////////////////////////////////////
 void defaultConfig(config_t *config) {
     config->broadcast_interval = 10;
+    config->broadcast_interval_min = 500;
+    config->device_cache = "/var/lib/tvsatd/devices";
     config->device_map.clear();
+    config->diseqc_delay = 100;
+    config->discovery_early_exit = false;
+    config->fast_removal = false;
+    config->flight_recorder_dir = "/var/lib/tvsatd";
+    config->linger_time = 0;
+    config->liveness_probes = 3;
+    config->metrics_address = "127.0.0.1";
+    config->metrics_port = 0;
+    config->reactor_cpus.clear();
+    config->reactor_threads = 0;
+    config->ts_stats = true;
+
+    config->control_sched.cpus.clear();
+    config->control_sched.policy = SCHED_OTHER;
+    config->control_sched.priority = 0;
+    config->receiver_sched = config->control_sched;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Parses a list of CPU numbers
+///
+/// @param[out] cpus the CPU numbers in the order they were specified
+/// @param in string containing a list of CPU numbers and ranges, e.g.
+///	'0,2-3'
+/// @return 0, if the list could be parsed
+/// @return -1, otherwise
+//////////////////////////////////////////////////////////////////////////
+int parseCPUList(std::vector<int> &cpus, const char *in) {
+    const char *ptr = in;
+
+    cpus.clear();
+
+    while (*ptr) {
+        char *end;
+        long first = strtol(ptr, &end, 10);
+
+        if ((end == ptr) || (first < 0) || (first >= CPU_SETSIZE))
+            return -1;
+
+        long last = first;
+        ptr = end;
+
+        if (*ptr == '-') {
+            last = strtol(ptr + 1, &end, 10);
+
+            if ((end == ptr + 1) || (last < first) ||
+                (last >= CPU_SETSIZE))
+                return -1;
+
+            ptr = end;
+        }
+
+        for (long cpu = first; cpu <= last; ++cpu)
+            cpus.push_back(cpu);
+
+        if (*ptr == ',')
+            ++ptr;
+        else if (*ptr)
+            return -1;
+    }
+
+    return cpus.empty() ? -1 : 0;
 }
 
@@ -34,14 +34,39 @@
 #include <regex.h>
 #include <string>
 #include <stdint.h>
+#include <vector>
+
+//////////////////////////////////////////////////////////////////////////
+/// Scheduling options of a thread
+//////////////////////////////////////////////////////////////////////////
+struct sched_config_t {
+    std::vector<int> cpus;
+    int policy;
+    int priority;
+};
 
 //////////////////////////////////////////////////////////////////////////
 /// Configuration options
 //////////////////////////////////////////////////////////////////////////
 struct config_t {
     uint16_t broadcast_interval;
+    int broadcast_interval_min;
+    sched_config_t control_sched;
+    std::string device_cache;
     std::map<std::string, uint8_t> device_map;
+    int diseqc_delay;
+    bool discovery_early_exit;
+    bool fast_removal;
+    std::string flight_recorder_dir;
     std::string interface;
+    int linger_time;
+    uint8_t liveness_probes;
+    std::string metrics_address;
+    uint16_t metrics_port;
+    std::vector<int> reactor_cpus;
+    uint8_t reactor_threads;
+    sched_config_t receiver_sched;
+    bool ts_stats;
 };
 
 //////////////////////////////////////////////////////////////////////////
@@ -49,13 +74,34 @@ struct config_t {
 //////////////////////////////////////////////////////////////////////////
 struct config_regex_t {
     regex_t broadcast_interval;
+    regex_t broadcast_interval_min;
+    regex_t control_cpus;
+    regex_t control_priority;
+    regex_t control_sched;
+    regex_t device_cache;
     regex_t device_map_ip;
     regex_t device_map_mac;
+    regex_t diseqc_delay;
+    regex_t discovery_early_exit;
+    regex_t fast_removal;
+    regex_t flight_recorder_dir;
     regex_t interface;
+    regex_t linger_time;
+    regex_t liveness_probes;
+    regex_t metrics_address;
+    regex_t metrics_port;
+    regex_t reactor_cpus;
+    regex_t reactor_threads;
+    regex_t receiver_cpus;
+    regex_t receiver_priority;
+    regex_t receiver_sched;
+    regex_t ts_stats;
 };
 
 void defaultConfig(config_t *config);
 
 void loadConfig(config_t *config, const char *filename);
 
+int parseCPUList(std::vector<int> &cpus, const char *in);
+
 #endif
@@ -0,0 +1,134 @@
+//////////////////////////////////////////////////////////////////////////
+// devolo dLAN TV Sat control application
+// Copyright (C) 2008 devolo AG. All rights reserved.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//
+// Contact information:
+//    devolo AG
+//    Sonnenweg 11
+//    D-52070 Aachen, Germany
+//    gpl@devolo.de
+//////////////////////////////////////////////////////////////////////////
+/// @file devcache.cpp
+/// @brief "dLAN TV Sat Device Cache" - implementation
+//////////////////////////////////////////////////////////////////////////
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <net/if.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "devcache.h"
+#include "log.h"
+
+//////////////////////////////////////////////////////////////////////////
+/// Loads the devices that were known when the daemon last ran
+///
+/// Every line of the cache file describes one device:
+/// <MAC> <device IP> <interface> <interface IP> <broadcast IP> <adapter>
+///
+/// @param[out] devs the cached devices
+/// @param filename the cache file
+/// @return true, if the file could be read
+/// @return false, otherwise
+//////////////////////////////////////////////////////////////////////////
+bool loadDeviceCache(std::list<SCachedDev> &devs, const std::string &filename) {
+    FILE *file = fopen(filename.c_str(), "r");
+
+    if (!file)
+        return false;
+
+    char line[256];
+
+    while (fgets(line, sizeof(line), file)) {
+        char mac[18], dev_ip[16], if_name[IFNAMSIZ], if_ip[16], if_bcast[16];
+        int adapter_num;
+
+        if (sscanf(line, "%17s %15s %15s %15s %15s %i", mac, dev_ip, if_name,
+                   if_ip, if_bcast, &adapter_num) != 6)
+            continue;
+
+        SCachedDev cdev;
+
+        if ((parseMAC(cdev.dev.dev_mac, mac) != 0) || (adapter_num < 0) || (adapter_num > 7))
+            continue;
+
+        cdev.adapter_num = adapter_num;
+        cdev.dev.dev_ip = dev_ip;
+        cdev.dev.net_if.if_bcast = if_bcast;
+        cdev.dev.net_if.if_index = if_nametoindex(if_name);
+        cdev.dev.net_if.if_ip = if_ip;
+        cdev.dev.net_if.if_name = if_name;
+
+        devs.insert(devs.end(), cdev);
+    }
+
+    fclose(file);
+
+    return true;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Stores the currently known devices
+///
+/// The new cache is written to a temporary file first, which then
+/// replaces the old one, so the cache is never left half written.
+///
+/// @param devs the devices to store
+/// @param filename the cache file
+/// @return true, if successful
+/// @return false, otherwise
+//////////////////////////////////////////////////////////////////////////
+bool saveDeviceCache(const std::list<SCachedDev> &devs, const std::string &filename) {
+    // create the directory of the cache file, if necessary
+    std::string::size_type slash = filename.rfind('/');
+
+    if ((slash != std::string::npos) && (slash > 0))
+        mkdir(filename.substr(0, slash).c_str(), 0755);
+
+    std::string tmp_filename = filename + ".tmp";
+    FILE *file = fopen(tmp_filename.c_str(), "w");
+
+    if (!file) {
+        logErr("Failed to write device cache %s: %s", tmp_filename.c_str(), strerror(errno));
+        return false;
+    }
+
+    for (std::list<SCachedDev>::const_iterator it = devs.begin(); it != devs.end(); ++it) {
+        const uint8_t *mac = it->dev.dev_mac;
+
+        fprintf(file, "%02x:%02x:%02x:%02x:%02x:%02x %s %s %s %s %i\n",
+                mac[0], mac[1], mac[2], mac[3], mac[4], mac[5],
+                it->dev.dev_ip.c_str(), it->dev.net_if.if_name.c_str(),
+                it->dev.net_if.if_ip.c_str(), it->dev.net_if.if_bcast.c_str(),
+                it->adapter_num);
+    }
+
+    bool ok = (fflush(file) == 0) && (fsync(fileno(file)) == 0);
+
+    if (fclose(file) != 0)
+        ok = false;
+
+    if (!ok || (rename(tmp_filename.c_str(), filename.c_str()) != 0)) {
+        logErr("Failed to write device cache %s: %s", filename.c_str(), strerror(errno));
+        unlink(tmp_filename.c_str());
+        return false;
+    }
+
+    return true;
+}
@@ -30,7 +30,7 @@
 #include <cerrno>
 #include <cstring>
 #include <cstdio>
-#include <iostream>
+#include <map>
 #include <net/if.h>
 #include <netinet/ether.h>
 #include <netinet/ip.h>
@@ -39,8 +39,10 @@
 #include <sys/time.h>
 #include <utility>
 #include <unistd.h>
+#include <vector>
 
 #include "discover.h"
+#include "log.h"
 
 bool operator<(const STVSatDev &tvs1, const STVSatDev &tvs2) {
     return (memcmp(tvs1.dev_mac, tvs2.dev_mac, 6) < 0);
@@ -50,6 +52,22 @@ bool operator==(const STVSatDev &tvs1, const STVSatDev &tvs2) {
     return (memcmp(tvs1.dev_mac, tvs2.dev_mac, 6) == 0);
 }
 
+//////////////////////////////////////////////////////////////////////////
+/// Copies the MAC and IP address from a GetInfo response to a device
+//////////////////////////////////////////////////////////////////////////
+static void setDeviceInfo(STVSatDev &dev, const ResponseGetInfo *rgi) {
+    memcpy(dev.dev_mac, rgi->mMacAddress, sizeof(dev.dev_mac));
+
+    char ip[16];
+    snprintf(ip, 16, "%u.%u.%u.%u",
+             rgi->mIpAddress[0],
+             rgi->mIpAddress[1],
+             rgi->mIpAddress[2],
+             rgi->mIpAddress[3]);
+
+    dev.dev_ip = ip;
+}
+
 //////////////////////////////////////////////////////////////////////////
 /// Checks if a timestamp is older than a given amount of seconds
 //////////////////////////////////////////////////////////////////////////
@@ -72,23 +90,32 @@ int expired(const timeval &stv, int sec) {
 /// @param bind_if the network interface to bind to
 //////////////////////////////////////////////////////////////////////////
 void getIfInfo(std::list<SNetIf> &ifs, const std::string &bind_if) {
-    uint8_t buf[2048];
-
     ifconf ifc;
-    ifc.ifc_len = 2048;
-    ifc.ifc_buf = (char *) buf;
+    ifc.ifc_len = 0;
+    ifc.ifc_buf = 0;
 
     int s = socket(AF_INET, SOCK_DGRAM, 0);
 
     if (s < 0) {
-        std::cerr << "Error: failed to create IP socket"
-                  << std::endl;
+        logErr("Failed to create IP socket");
         return;
     }
 
-    // get configuration information on all network interfaces
+    // ask for the size of the configuration information first, so it
+    // isn't truncated on hosts with many interfaces
     if (ioctl(s, SIOCGIFCONF, &ifc)) {
-        std::cerr << "Error: failed to get ifconfig" << std::endl;
+        logErr("Failed to get ifconfig");
+        close(s);
+        return;
+    }
+
+    std::vector<uint8_t> buf(ifc.ifc_len);
+    ifc.ifc_buf = (char *) &buf[0];
+
+    // get configuration information on all network interfaces
+    if (buf.empty() || ioctl(s, SIOCGIFCONF, &ifc)) {
+        logErr("Failed to get ifconfig");
+        close(s);
         return;
     }
 
@@ -108,8 +135,8 @@ void getIfInfo(std::list<SNetIf> &ifs, const std::string &bind_if) {
                   INET_ADDRSTRLEN);
 
         if (ioctl(s, SIOCGIFBRDADDR, ifr)) {
-            std::cerr << "Error: failed to get broadcast ip "
-                         "address" << std::endl;
+            logErr("Failed to get broadcast IP address");
+            close(s);
             return;
         }
 
@@ -122,6 +149,7 @@ void getIfInfo(std::list<SNetIf> &ifs, const std::string &bind_if) {
         if (strcmp(bip, "0.0.0.0")) {
             SNetIf net_if;
             net_if.if_bcast = bip;
+            net_if.if_index = if_nametoindex(ifr->ifr_name);
             net_if.if_ip = ip;
             net_if.if_name = ifr->ifr_name;
             ifs.insert(ifs.end(), net_if);
@@ -134,19 +162,50 @@ void getIfInfo(std::list<SNetIf> &ifs, const std::string &bind_if) {
 //////////////////////////////////////////////////////////////////////////
 /// Broadcasts info requests on all network interfaces to find devices
 ///
+/// The requests are sent on all interfaces at once and the replies are
+/// collected in a single listen window, so a discovery round takes the
+/// same time no matter how many interfaces there are. The interface a
+/// reply arrived on tells which interface the device belongs to.
+///
 /// @param[out]	found_devs a list of ip addresses of the discovered
 ///		devices together with the ip address of the respective
 ///		network interface
 /// @param bind_if network interface to bind to
 /// @param raw if true, use a raw socket to receive replies
+/// @param known_macs if not empty, stop listening as soon as all of these
+///		devices have replied (see macToKey())
+/// @param listen_time the time to wait for replies in milliseconds
 //////////////////////////////////////////////////////////////////////////
 void findDevices(std::list<STVSatDev> &found_devs,
-                 const std::string &bind_if, bool raw) {
+                 const std::string &bind_if, bool raw,
+                 const std::set<uint64_t> *known_macs, int listen_time) {
+    std::list<SNetIf> ifs;
+    getIfInfo(ifs, bind_if);
+
+    findDevices(found_devs, ifs, raw, known_macs, listen_time);
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Broadcasts info requests on the given network interfaces to find
+/// devices
+///
+/// @param[out]	found_devs a list of ip addresses of the discovered
+///		devices together with the ip address of the respective
+///		network interface
+/// @param ifs the network interfaces to search
+/// @param raw if true, use a raw socket to receive replies
+/// @param known_macs if not empty, stop listening as soon as all of these
+///		devices have replied (see macToKey())
+/// @param listen_time the time to wait for replies in milliseconds
+//////////////////////////////////////////////////////////////////////////
+void findDevices(std::list<STVSatDev> &found_devs,
+                 const std::list<SNetIf> &ifs, bool raw,
+                 const std::set<uint64_t> *known_macs, int listen_time) {
     uint8_t buf[IP_MAXPACKET];
     ResponseHeader *rh;
 
-    std::list<SNetIf> ifs;
-    getIfInfo(ifs, bind_if);
+    if (ifs.empty())
+        return;
 
     // construct a GetInfo request
     RequestGetInfo rgi;
@@ -157,59 +216,157 @@ void findDevices(std::list<STVSatDev> &found_devs,
     CUDPSocket sock;
     sock.open(0);
 
+    // let the socket report the interface a reply was received on
+    int pktinfo = 1;
+    setsockopt(sock.getFD(), IPPROTO_IP, IP_PKTINFO, &pktinfo,
+               sizeof(int));
+
+    // a single raw socket that isn't bound to an interface sees the
+    // replies on all interfaces
+    CRawSocket rsock = CRawSocket(AF_INET, ETH_P_IP, IPPROTO_UDP);
+
+    if (raw)
+        rsock.open(sock.getPort());
+
     // send GetInfo requests to all broadcast addresses
-    for (std::list<SNetIf>::iterator it = ifs.begin();
-         it != ifs.end(); ++it) {
+    for (std::list<SNetIf>::const_iterator it = ifs.begin();
+         it != ifs.end(); ++it)
         sock.send((const uint8_t *) &rgi,
                   sizeof(RequestGetInfo), it->if_bcast,
                   11111);
 
-        CRawSocket rsock = CRawSocket(AF_INET, ETH_P_IP,
-                                      IPPROTO_UDP);
+    std::set<uint64_t> seen;
+    size_t known_seen = 0;
+
+    timeval now, listen_end, listen_tv;
+    listen_tv.tv_sec = listen_time / 1000;
+    listen_tv.tv_usec = (listen_time % 1000) * 1000;
+    gettimeofday(&now, 0);
+    timeradd(&now, &listen_tv, &listen_end);
+
+    // wait for the responses
+    for (; timercmp(&now, &listen_end, <); gettimeofday(&now, 0)) {
+        int if_index = 0;
+
         if (raw)
-            rsock.open(sock.getPort(), it->if_name.c_str());
+            rh = receiveRaw(rsock, buf, ETHER_MAX_LEN,
+                            sizeof(ResponseGetInfo), cCmdGetInfo,
+                            &if_index, 10000);
+        else
+            rh = receiveUDP(sock, buf, IP_MAXPACKET,
+                            sizeof(ResponseGetInfo), cCmdGetInfo,
+                            &if_index, 10000);
+
+        if (!rh)
+            continue;
 
-        timeval stv;
-        gettimeofday(&stv, 0);
+        // replies on interfaces we didn't ask aren't ours
+        std::list<SNetIf>::const_iterator it;
 
-        // wait for a correct response
-        while (1) {
-            if (expired(stv))
+        for (it = ifs.begin(); it != ifs.end(); ++it)
+            if (it->if_index == if_index)
                 break;
 
-            if (raw)
-                rh = receiveRaw(rsock, buf,
-                                ETHER_MAX_LEN,
-                                sizeof(ResponseGetInfo),
-                                cCmdGetInfo);
-            else
-                rh = receiveUDP(sock, buf,
-                                IP_MAXPACKET,
-                                sizeof(ResponseGetInfo),
-                                cCmdGetInfo);
-
-            if (!rh)
-                continue;
-
-            ResponseGetInfo *rgi = (ResponseGetInfo *) rh;
-
-            // add a device to the list
-            STVSatDev tsdev;
-            memcpy(tsdev.dev_mac, rgi->mMacAddress,
-                   sizeof(tsdev.dev_mac));
-
-            char ip[16];
-            snprintf(ip, 16, "%u.%u.%u.%u",
-                     rgi->mIpAddress[0],
-                     rgi->mIpAddress[1],
-                     rgi->mIpAddress[2],
-                     rgi->mIpAddress[3]);
-
-            tsdev.dev_ip = ip;
-            tsdev.net_if = *it;
-            found_devs.insert(found_devs.end(), tsdev);
-        }
+        if (it == ifs.end())
+            continue;
+
+        ResponseGetInfo *rgi = (ResponseGetInfo *) rh;
 
+        // a device may reply more than once, e.g. if it can be
+        // reached through more than one interface
+        uint64_t key = macToKey(rgi->mMacAddress);
+
+        if (!seen.insert(key).second)
+            continue;
+
+        // add a device to the list
+        STVSatDev tsdev;
+        setDeviceInfo(tsdev, rgi);
+        tsdev.net_if = *it;
+        found_devs.insert(found_devs.end(), tsdev);
+
+        if (known_macs && !known_macs->empty() &&
+            (known_macs->find(key) != known_macs->end()) &&
+            (++known_seen == known_macs->size()))
+            break;
+    }
+
+    sock.close();
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Packs a MAC address into an integer
+///
+/// @param mac MAC address in raw 6-byte format
+/// @return the MAC address in the lower 48 bits
+//////////////////////////////////////////////////////////////////////////
+uint64_t macToKey(const uint8_t *mac) {
+    uint64_t key = 0;
+
+    for (int i = 0; i < 6; ++i)
+        key = (key << 8) | mac[i];
+
+    return key;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Sends unicast info requests to check if known devices are reachable
+///
+/// @param[out] found_devs the devices that replied, with the IP address
+///		from the reply
+/// @param devs the devices to check
+//////////////////////////////////////////////////////////////////////////
+void probeDevices(std::list<STVSatDev> &found_devs,
+                  const std::list<STVSatDev> &devs) {
+    uint8_t buf[IP_MAXPACKET];
+    std::map<uint64_t, const STVSatDev *> pending;
+
+    for (std::list<STVSatDev>::const_iterator it = devs.begin();
+         it != devs.end(); ++it)
+        pending[macToKey(it->dev_mac)] = &*it;
+
+    if (pending.empty())
+        return;
+
+    // construct a GetInfo request
+    RequestGetInfo rgi;
+    memset(&rgi, 0, sizeof(RequestGetInfo));
+    rgi.mHeader.mCommand = htons(cCmdGetInfo);
+    rgi.mHeader.mSize = htons(sizeof(RequestGetInfo));
+
+    CUDPSocket sock;
+    sock.open(0);
+
+    for (std::list<STVSatDev>::const_iterator it = devs.begin();
+         it != devs.end(); ++it)
+        sock.send((const uint8_t *) &rgi,
+                  sizeof(RequestGetInfo), it->dev_ip, 11111);
+
+    timeval stv;
+    gettimeofday(&stv, 0);
+
+    // wait until all devices have replied
+    while (!pending.empty() && !expired(stv)) {
+        ResponseHeader *rh = receiveUDP(sock, buf, IP_MAXPACKET,
+                                        sizeof(ResponseGetInfo),
+                                        cCmdGetInfo, 0, 10000);
+
+        if (!rh)
+            continue;
+
+        ResponseGetInfo *rgi = (ResponseGetInfo *) rh;
+
+        std::map<uint64_t, const STVSatDev *>::iterator p_it =
+                pending.find(macToKey(rgi->mMacAddress));
+
+        if (p_it == pending.end())
+            continue;
+
+        STVSatDev tsdev = *p_it->second;
+        setDeviceInfo(tsdev, rgi);
+        found_devs.insert(found_devs.end(), tsdev);
+
+        pending.erase(p_it);
     }
 
     sock.close();
@@ -272,15 +429,18 @@ int parseMAC(uint8_t *out, const char *in) {
 /// @param buf_len length of the buffer
 /// @param exp_size minimum expected size of the packet
 /// @param exp_cmd expected command
+/// @param[out] if_index index of the receiving interface (optional)
+/// @param timeout the time to wait for a packet in microseconds
 /// @return a pointer to the response, if one was received
 /// @return 0, otherwise
 //////////////////////////////////////////////////////////////////////////
 ResponseHeader *receiveRaw(const CRawSocket &rsock, uint8_t *buf,
-                           int buf_len, size_t exp_size, uint16_t exp_cmd) {
+                           int buf_len, size_t exp_size, uint16_t exp_cmd,
+                           int *if_index, int timeout) {
     const size_t hdr_size = sizeof(ether_header) + sizeof(iphdr) +
                             sizeof(udphdr);
 
-    int rbytes = rsock.receive(buf, buf_len, false, 1);
+    int rbytes = rsock.receive(buf, buf_len, false, timeout, if_index);
 
     if (rbytes == 0)
         return 0;
@@ -305,15 +465,21 @@ ResponseHeader *receiveRaw(const CRawSocket &rsock, uint8_t *buf,
 /// @param buf_len length of the buffer
 /// @param exp_size minimum expected size of the packet
 /// @param exp_cmd expected command
+/// @param[out] if_index index of the receiving interface (optional, needs
+///	IP_PKTINFO to be enabled on the socket)
+/// @param timeout the time to wait for a packet in microseconds
 /// @return a pointer to the response, if one was received
 /// @return 0, otherwise
 //////////////////////////////////////////////////////////////////////////
 ResponseHeader *receiveUDP(const CUDPSocket &sock, uint8_t *buf,
-                           int buf_len, size_t exp_size, uint16_t exp_cmd) {
-    timeval stv;
-    gettimeofday(&stv, 0);
-
-    int rbytes = sock.receive(buf, buf_len, false, 1);
+                           int buf_len, size_t exp_size, uint16_t exp_cmd,
+                           int *if_index, int timeout) {
+    int rbytes;
+
+    if (if_index)
+        rbytes = sock.receiveIf(buf, buf_len, *if_index, timeout);
+    else
+        rbytes = sock.receive(buf, buf_len, false, timeout);
 
     if (rbytes == 0)
         return 0;
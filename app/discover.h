@@ -31,6 +31,7 @@
 #define __TVSAT_DISCOVER_H
 
 #include <list>
+#include <set>
 #include <stdint.h>
 #include <string>
 
@@ -40,6 +41,7 @@
 
 struct SNetIf {
     std::string if_bcast;
+    int if_index;
     std::string if_ip;
     std::string if_name;
 };
@@ -59,16 +61,30 @@ int expired(const timeval &stv, int sec = 1);
 void getIfInfo(std::list<SNetIf> &ifs, const std::string &bind_if);
 
 void findDevices(std::list<STVSatDev> &found_devs,
-                 const std::string &bind_if = "", bool raw = false);
+                 const std::string &bind_if = "", bool raw = false,
+                 const std::set<uint64_t> *known_macs = 0,
+                 int listen_time = 1000);
+
+void findDevices(std::list<STVSatDev> &found_devs,
+                 const std::list<SNetIf> &ifs, bool raw = false,
+                 const std::set<uint64_t> *known_macs = 0,
+                 int listen_time = 1000);
+
+uint64_t macToKey(const uint8_t *mac);
 
 int parseIP(uint8_t *out, const char *in);
 
+void probeDevices(std::list<STVSatDev> &found_devs,
+                  const std::list<STVSatDev> &devs);
+
 int parseMAC(uint8_t *out, const char *in);
 
 ResponseHeader *receiveRaw(const CRawSocket &rsock, uint8_t *buf,
-                           int buf_len, size_t exp_size, uint16_t exp_cmd);
+                           int buf_len, size_t exp_size, uint16_t exp_cmd,
+                           int *if_index = 0, int timeout = 1);
 
 ResponseHeader *receiveUDP(const CUDPSocket &sock, uint8_t *buf,
-                           int buf_len, size_t exp_size, uint16_t exp_cmd);
+                           int buf_len, size_t exp_size, uint16_t exp_cmd,
+                           int *if_index = 0, int timeout = 1);
 
 #endif
@@ -0,0 +1,69 @@
+//////////////////////////////////////////////////////////////////////////
+// devolo dLAN TV Sat control application
+// Copyright (C) 2008 devolo AG. All rights reserved.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//
+// Contact information:
+//    devolo AG
+//    Sonnenweg 11
+//    D-52070 Aachen, Germany
+//    gpl@devolo.de
+//////////////////////////////////////////////////////////////////////////
+/// @file flightrec.cpp
+/// @brief "dLAN TV Sat Flight Recorder" - implementation
+//////////////////////////////////////////////////////////////////////////
+
+#include <time.h>
+
+#include "flightrec.h"
+
+//////////////////////////////////////////////////////////////////////////
+/// Constructor
+//////////////////////////////////////////////////////////////////////////
+CFlightRecorder::CFlightRecorder() {
+    m_next = 0;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Gets an event
+/// @param index the index of the event, 0 is the oldest one in the ring
+//////////////////////////////////////////////////////////////////////////
+const SFlightEvent &CFlightRecorder::getEvent(unsigned int index) const {
+    return m_events[(m_next - getCount() + index) % TVSAT_FLIGHT_EVENTS];
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Records an event, overwriting the oldest one if the ring is full
+/// @param type an SFlightEvent::type_t
+/// @param state the current state of the state machine
+/// @param cmd the command code of the request or response
+/// @param result the result field of the response
+/// @param arg see SFlightEvent::arg
+//////////////////////////////////////////////////////////////////////////
+void CFlightRecorder::record(uint8_t type, int state, uint16_t cmd, uint16_t result, uint32_t arg) {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    SFlightEvent &event = m_events[m_next % TVSAT_FLIGHT_EVENTS];
+    event.arg = arg;
+    event.cmd = cmd;
+    event.result = result;
+    event.state = state;
+    event.time = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    event.type = type;
+
+    ++m_next;
+}
@@ -0,0 +1,94 @@
+//////////////////////////////////////////////////////////////////////////
+// devolo dLAN TV Sat control application
+// Copyright (C) 2008 devolo AG. All rights reserved.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//
+// Contact information:
+//    devolo AG
+//    Sonnenweg 11
+//    D-52070 Aachen, Germany
+//    gpl@devolo.de
+//////////////////////////////////////////////////////////////////////////
+/// @file flightrec.h
+/// @brief "dLAN TV Sat Flight Recorder" - header
+//////////////////////////////////////////////////////////////////////////
+
+#ifndef __TVSAT_FLIGHTREC_H
+#define __TVSAT_FLIGHTREC_H
+
+#include <stdint.h>
+
+//////////////////////////////////////////////////////////////////////////
+// DEFINITIONS
+//////////////////////////////////////////////////////////////////////////
+#define TVSAT_FLIGHT_EVENTS         4096
+
+//////////////////////////////////////////////////////////////////////////
+/// An event of the device control
+//////////////////////////////////////////////////////////////////////////
+struct SFlightEvent {
+    enum type_t {
+        eAddPID,
+        eDelPID,
+        eFilter,
+        eReceived,
+        eReset,
+        eRetry,
+        eSent,
+        eStale,
+        eState,
+        eTune
+    };
+
+    /// Monotonic time in ns
+    uint64_t time;
+    /// Depends on the type: PID, number of PIDs, status, previous state
+    /// or frequency
+    uint32_t arg;
+    uint16_t cmd;
+    uint16_t result;
+    /// State of the state machine when the event was recorded
+    uint8_t state;
+    uint8_t type;
+};
+
+//////////////////////////////////////////////////////////////////////////
+/// Ring of the last TVSAT_FLIGHT_EVENTS events of a device
+///
+/// Recording never allocates memory or makes a system call other than
+/// reading the (vDSO) clock, so it can stay on all the time. The ring
+/// has a single writer and is only read by the same thread.
+//////////////////////////////////////////////////////////////////////////
+class CFlightRecorder {
+public:
+    CFlightRecorder();
+
+    /// Gets the number of events in the ring
+    unsigned int getCount() const { return (m_next < TVSAT_FLIGHT_EVENTS) ? m_next : TVSAT_FLIGHT_EVENTS; }
+
+    const SFlightEvent &getEvent(unsigned int index) const;
+
+    /// Gets the number of events that have been overwritten
+    uint64_t getLost() const { return m_next - getCount(); }
+
+    void record(uint8_t type, int state, uint16_t cmd = 0, uint16_t result = 0, uint32_t arg = 0);
+
+private:
+    SFlightEvent m_events[TVSAT_FLIGHT_EVENTS];
+    uint64_t m_next;
+};
+
+#endif
@@ -0,0 +1,327 @@
+//////////////////////////////////////////////////////////////////////////
+// devolo dLAN TV Sat control application
+// Copyright (C) 2008 devolo AG. All rights reserved.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//
+// Contact information:
+//    devolo AG
+//    Sonnenweg 11
+//    D-52070 Aachen, Germany
+//    gpl@devolo.de
+//////////////////////////////////////////////////////////////////////////
+/// @file handoff.cpp
+/// @brief "dLAN TV Sat Daemon Handoff" - implementation
+//////////////////////////////////////////////////////////////////////////
+
+#include <cerrno>
+#include <cstring>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "handoff.h"
+#include "log.h"
+
+//////////////////////////////////////////////////////////////////////////
+/// Waits until a socket is readable
+/// @return true, if the socket is readable
+/// @return false, if the timeout expired or an error occurred
+//////////////////////////////////////////////////////////////////////////
+static bool waitReadable(int sock) {
+    pollfd pfd;
+    pfd.fd = sock;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+
+    int ret;
+
+    do
+        ret = poll(&pfd, 1, TVSAT_HANDOFF_TIMEOUT);
+    while ((ret < 0) && (errno == EINTR));
+
+    return ret > 0;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Fills in the address of the handoff socket
+//////////////////////////////////////////////////////////////////////////
+static void getHandoffAddr(sockaddr_un &addr) {
+    memset(&addr, 0, sizeof(sockaddr_un));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, TVSAT_HANDOFF_SOCKET, sizeof(addr.sun_path) - 1);
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Accepts a connection from a process that wants to take over
+///
+/// Only processes of the same user are accepted.
+///
+/// @return the connected socket or -1
+//////////////////////////////////////////////////////////////////////////
+int acceptHandoff(int listen_fd) {
+    int sock = accept4(listen_fd, 0, 0, SOCK_CLOEXEC);
+
+    if (sock < 0)
+        return -1;
+
+    ucred cred;
+    socklen_t cred_len = sizeof(ucred);
+
+    if ((getsockopt(sock, SOL_SOCKET, SO_PEERCRED, &cred, &cred_len) < 0) ||
+        (cred.uid != geteuid())) {
+        logErr("Rejected handoff request from another user");
+        close(sock);
+        return -1;
+    }
+
+    return sock;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Closes the file descriptors of a device that are still open
+//////////////////////////////////////////////////////////////////////////
+void closeHandoffFDs(SHandoffEntry &entry) {
+    int *fds[3] = { &entry.sock_fd, &entry.stream_fd, &entry.input_fd };
+
+    for (int i = 0; i < 3; ++i) {
+        if (*fds[i] >= 0)
+            close(*fds[i]);
+
+        *fds[i] = -1;
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Connects to the running daemon
+/// @return the connected socket or -1, if no daemon is listening
+//////////////////////////////////////////////////////////////////////////
+int connectHandoff() {
+    int sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+
+    if (sock < 0)
+        return -1;
+
+    sockaddr_un addr;
+    getHandoffAddr(addr);
+
+    if (connect(sock, (sockaddr *) &addr, sizeof(sockaddr_un)) < 0) {
+        close(sock);
+        return -1;
+    }
+
+    return sock;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Opens the socket on which the daemon waits for its successor
+///
+/// A socket file that is left over, e.g. by the process we took over
+/// from, is replaced.
+///
+/// @return the listening socket or -1
+//////////////////////////////////////////////////////////////////////////
+int openHandoffListener() {
+    int sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+
+    if (sock < 0)
+        return -1;
+
+    sockaddr_un addr;
+    getHandoffAddr(addr);
+    unlink(TVSAT_HANDOFF_SOCKET);
+
+    // nobody but the owner may take the devices over
+    mode_t mask = umask(0077);
+    int ret = bind(sock, (sockaddr *) &addr, sizeof(sockaddr_un));
+    umask(mask);
+
+    if ((ret < 0) || (listen(sock, 1) < 0)) {
+        close(sock);
+        return -1;
+    }
+
+    return sock;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Waits for the new process to confirm that it took all devices over
+/// @return true, if all devices have been taken over
+/// @return false, otherwise
+//////////////////////////////////////////////////////////////////////////
+bool receiveHandoffAck(int sock, uint32_t num_devs) {
+    SHandoffAck ack;
+
+    if (!waitReadable(sock) ||
+        (recv(sock, &ack, sizeof(SHandoffAck), 0) != sizeof(SHandoffAck)))
+        return false;
+
+    return (ack.magic == TVSAT_HANDOFF_ACK_MAGIC) && (ack.num_devs == num_devs);
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Receives a device and the file descriptors that come with it
+///
+/// File descriptors that are not part of the message are set to -1.
+///
+/// @return true, if successful
+/// @return false, otherwise
+//////////////////////////////////////////////////////////////////////////
+bool receiveHandoffDev(int sock, SHandoffDev &dev, int &sock_fd, int &stream_fd, int &input_fd) {
+    sock_fd = stream_fd = input_fd = -1;
+
+    if (!waitReadable(sock))
+        return false;
+
+    iovec iov;
+    iov.iov_base = &dev;
+    iov.iov_len = sizeof(SHandoffDev);
+
+    char cbuf[CMSG_SPACE(3 * sizeof(int))];
+    memset(cbuf, 0, sizeof(cbuf));
+
+    msghdr msg;
+    memset(&msg, 0, sizeof(msghdr));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = cbuf;
+    msg.msg_controllen = sizeof(cbuf);
+
+    if (recvmsg(sock, &msg, MSG_CMSG_CLOEXEC) != sizeof(SHandoffDev))
+        return false;
+
+    int fds[3];
+    int num_fds = 0;
+    cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+
+    if (cmsg && (cmsg->cmsg_level == SOL_SOCKET) && (cmsg->cmsg_type == SCM_RIGHTS)) {
+        num_fds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        memcpy(fds, CMSG_DATA(cmsg), num_fds * sizeof(int));
+    }
+
+    int *targets[3] = { &sock_fd, &stream_fd, &input_fd };
+    int n = 0;
+
+    for (int i = 0; i < 3; ++i)
+        if ((dev.fd_mask & (1 << i)) && (n < num_fds))
+            *targets[i] = fds[n++];
+
+    // don't leak descriptors that don't match the mask
+    for (; n < num_fds; ++n)
+        close(fds[n]);
+
+    return !(msg.msg_flags & MSG_CTRUNC);
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Receives the header of the other process
+/// @return true, if the header was received and it is compatible
+/// @return false, otherwise
+//////////////////////////////////////////////////////////////////////////
+bool receiveHandoffHeader(int sock, SHandoffHeader &hdr) {
+    if (!waitReadable(sock) ||
+        (recv(sock, &hdr, sizeof(SHandoffHeader), 0) != sizeof(SHandoffHeader)))
+        return false;
+
+    if ((hdr.magic != TVSAT_HANDOFF_MAGIC) ||
+        (hdr.version != TVSAT_HANDOFF_VERSION) ||
+        (hdr.dev_size != sizeof(SHandoffDev))) {
+        logErr("Incompatible handoff version %u (expected %u)",
+               hdr.version, TVSAT_HANDOFF_VERSION);
+        return false;
+    }
+
+    return true;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Confirms that all devices have been received
+/// @return true, if successful
+/// @return false, otherwise
+//////////////////////////////////////////////////////////////////////////
+bool sendHandoffAck(int sock, uint32_t num_devs) {
+    SHandoffAck ack;
+    ack.magic = TVSAT_HANDOFF_ACK_MAGIC;
+    ack.num_devs = num_devs;
+
+    return send(sock, &ack, sizeof(SHandoffAck), MSG_NOSIGNAL) == sizeof(SHandoffAck);
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Sends a device and its file descriptors
+///
+/// Only the file descriptors that are valid are sent; fd_mask is set
+/// accordingly.
+///
+/// @return true, if successful
+/// @return false, otherwise
+//////////////////////////////////////////////////////////////////////////
+bool sendHandoffDev(int sock, const SHandoffDev &dev, int sock_fd, int stream_fd, int input_fd) {
+    SHandoffDev msg_dev = dev;
+    msg_dev.fd_mask = 0;
+
+    int fds[3] = { sock_fd, stream_fd, input_fd };
+    int num_fds = 0;
+
+    for (int i = 0; i < 3; ++i) {
+        if (fds[i] < 0)
+            continue;
+
+        msg_dev.fd_mask |= 1 << i;
+        fds[num_fds++] = fds[i];
+    }
+
+    iovec iov;
+    iov.iov_base = &msg_dev;
+    iov.iov_len = sizeof(SHandoffDev);
+
+    char cbuf[CMSG_SPACE(3 * sizeof(int))];
+    memset(cbuf, 0, sizeof(cbuf));
+
+    msghdr msg;
+    memset(&msg, 0, sizeof(msghdr));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+
+    if (num_fds) {
+        msg.msg_control = cbuf;
+        msg.msg_controllen = CMSG_SPACE(num_fds * sizeof(int));
+
+        cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(num_fds * sizeof(int));
+        memcpy(CMSG_DATA(cmsg), fds, num_fds * sizeof(int));
+    }
+
+    return sendmsg(sock, &msg, MSG_NOSIGNAL) == sizeof(SHandoffDev);
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Sends the header with the number of devices that follow
+/// @return true, if successful
+/// @return false, otherwise
+//////////////////////////////////////////////////////////////////////////
+bool sendHandoffHeader(int sock, uint32_t num_devs) {
+    SHandoffHeader hdr;
+    hdr.dev_size = sizeof(SHandoffDev);
+    hdr.magic = TVSAT_HANDOFF_MAGIC;
+    hdr.num_devs = num_devs;
+    hdr.version = TVSAT_HANDOFF_VERSION;
+
+    return send(sock, &hdr, sizeof(SHandoffHeader), MSG_NOSIGNAL) == sizeof(SHandoffHeader);
+}
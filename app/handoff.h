@@ -0,0 +1,123 @@
+//////////////////////////////////////////////////////////////////////////
+// devolo dLAN TV Sat control application
+// Copyright (C) 2008 devolo AG. All rights reserved.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//
+// Contact information:
+//    devolo AG
+//    Sonnenweg 11
+//    D-52070 Aachen, Germany
+//    gpl@devolo.de
+//////////////////////////////////////////////////////////////////////////
+/// @file handoff.h
+/// @brief "dLAN TV Sat Daemon Handoff" - header
+//////////////////////////////////////////////////////////////////////////
+
+#ifndef __TVSAT_HANDOFF_H
+#define __TVSAT_HANDOFF_H
+
+#include <net/if.h>
+#include <stdint.h>
+
+#include "tvsatctl.h"
+
+//////////////////////////////////////////////////////////////////////////
+// DEFINITIONS
+//////////////////////////////////////////////////////////////////////////
+#define TVSAT_HANDOFF_SOCKET           "/var/run/tvsatd.sock"
+#define TVSAT_HANDOFF_MAGIC            0x54565348 // "TVSH"
+#define TVSAT_HANDOFF_ACK_MAGIC        0x54565341 // "TVSA"
+#define TVSAT_HANDOFF_VERSION          2
+#define TVSAT_HANDOFF_TIMEOUT          5000 // ms
+
+/// Bits of SHandoffDev::fd_mask
+#define TVSAT_HANDOFF_SOCK_FD          0x01
+#define TVSAT_HANDOFF_STREAM_FD        0x02
+#define TVSAT_HANDOFF_INPUT_FD         0x04
+
+//////////////////////////////////////////////////////////////////////////
+/// First message in both directions
+///
+/// Both processes must agree on the version and the size of the device
+/// messages, since the state is passed on as it is in memory.
+//////////////////////////////////////////////////////////////////////////
+struct SHandoffHeader {
+    uint32_t dev_size;
+    uint32_t magic;
+    uint32_t num_devs;
+    uint32_t version;
+};
+
+//////////////////////////////////////////////////////////////////////////
+/// Last message, sent by the new process once it has received all devices
+///
+/// Until then, the old process keeps the devices, so it can go on serving
+/// them if the handoff fails.
+//////////////////////////////////////////////////////////////////////////
+struct SHandoffAck {
+    uint32_t magic;
+    uint32_t num_devs;
+};
+
+//////////////////////////////////////////////////////////////////////////
+/// A device that is handed over
+///
+/// The file descriptors the device uses are attached to the message in
+/// the order of the bits in fd_mask.
+//////////////////////////////////////////////////////////////////////////
+struct SHandoffDev {
+    int32_t adapter_num;
+    STVSatCtlState ctl;
+    char dev_ip[16];
+    uint8_t dev_mac[6];
+    uint32_t fd_mask;
+    char if_bcast[16];
+    int32_t if_index;
+    char if_ip[16];
+    char if_name[IFNAMSIZ];
+};
+
+//////////////////////////////////////////////////////////////////////////
+/// A device and its file descriptors while it is handed over
+//////////////////////////////////////////////////////////////////////////
+struct SHandoffEntry {
+    SHandoffDev dev;
+    int input_fd;
+    int sock_fd;
+    int stream_fd;
+};
+
+int acceptHandoff(int listen_fd);
+
+void closeHandoffFDs(SHandoffEntry &entry);
+
+int connectHandoff();
+
+int openHandoffListener();
+
+bool receiveHandoffAck(int sock, uint32_t num_devs);
+
+bool receiveHandoffDev(int sock, SHandoffDev &dev, int &sock_fd, int &stream_fd, int &input_fd);
+
+bool receiveHandoffHeader(int sock, SHandoffHeader &hdr);
+
+bool sendHandoffAck(int sock, uint32_t num_devs);
+
+bool sendHandoffDev(int sock, const SHandoffDev &dev, int sock_fd, int stream_fd, int input_fd);
+
+bool sendHandoffHeader(int sock, uint32_t num_devs);
+
+#endif
@@ -0,0 +1,360 @@
+//////////////////////////////////////////////////////////////////////////
+// devolo dLAN TV Sat control application
+// Copyright (C) 2008 devolo AG. All rights reserved.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//
+// Contact information:
+//    devolo AG
+//    Sonnenweg 11
+//    D-52070 Aachen, Germany
+//    gpl@devolo.de
+//////////////////////////////////////////////////////////////////////////
+/// @file ifmonitor.cpp
+/// @brief "dLAN TV Sat Network Interface Monitor" - implementation
+//////////////////////////////////////////////////////////////////////////
+
+#include <arpa/inet.h>
+#include <cerrno>
+#include <cstring>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <net/if.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "ifmonitor.h"
+#include "log.h"
+
+//////////////////////////////////////////////////////////////////////////
+/// Constructor
+//////////////////////////////////////////////////////////////////////////
+CIfMonitor::CIfMonitor() {
+    m_fd = -1;
+    m_seq = 0;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Destructor
+//////////////////////////////////////////////////////////////////////////
+CIfMonitor::~CIfMonitor() {
+    close();
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Closes the netlink socket and clears the interface table
+//////////////////////////////////////////////////////////////////////////
+void CIfMonitor::close() {
+    if (m_fd >= 0)
+        ::close(m_fd);
+
+    m_fd = -1;
+    m_addrs.clear();
+    m_links.clear();
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Reads the complete table of the given type from the kernel
+/// @param type RTM_GETLINK or RTM_GETADDR
+/// @return true, if successful
+/// @return false, otherwise
+//////////////////////////////////////////////////////////////////////////
+bool CIfMonitor::dump(int type) {
+    if (!requestDump(type))
+        return false;
+
+    bool done = false;
+
+    while (!done) {
+        pollfd pfd;
+        pfd.fd = m_fd;
+        pfd.events = POLLIN;
+
+        int ret = poll(&pfd, 1, 1000);
+
+        if ((ret < 0) && (errno == EINTR))
+            continue;
+
+        if (ret <= 0)
+            return false;
+
+        if (!readMessages(&done))
+            return false;
+    }
+
+    return true;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Gets all interfaces that are up and have an IPv4 broadcast address
+///
+/// @param[out] ifs a list of interface information structs
+/// @param bind_if the network interface to bind to (empty for all)
+//////////////////////////////////////////////////////////////////////////
+void CIfMonitor::getInterfaces(std::list<SNetIf> &ifs, const std::string &bind_if) const {
+    std::map<std::pair<int, uint32_t>, SIfAddr>::const_iterator it;
+
+    for (it = m_addrs.begin(); it != m_addrs.end(); ++it) {
+        if (!bind_if.empty() && (bind_if != it->second.label))
+            continue;
+
+        if (it->second.bcast == 0)
+            continue;
+
+        std::map<int, unsigned int>::const_iterator l_it = m_links.find(it->first.first);
+
+        if ((l_it == m_links.end()) || !(l_it->second & IFF_UP))
+            continue;
+
+        char ip[INET_ADDRSTRLEN];
+        char bip[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &it->second.ip, ip, INET_ADDRSTRLEN);
+        inet_ntop(AF_INET, &it->second.bcast, bip, INET_ADDRSTRLEN);
+
+        SNetIf net_if;
+        net_if.if_bcast = bip;
+        net_if.if_index = it->first.first;
+        net_if.if_ip = ip;
+        net_if.if_name = it->second.label;
+        ifs.insert(ifs.end(), net_if);
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Updates the interface table from a single netlink message
+///
+/// @param nlh the message
+/// @return true, if an interface has come up, got its carrier back or got
+///         a new address
+/// @return false, otherwise
+//////////////////////////////////////////////////////////////////////////
+bool CIfMonitor::handleMessage(const nlmsghdr *nlh) {
+    if ((nlh->nlmsg_type == RTM_NEWLINK) || (nlh->nlmsg_type == RTM_DELLINK)) {
+        const ifinfomsg *ifi = (const ifinfomsg *) NLMSG_DATA(nlh);
+
+        if (nlh->nlmsg_type == RTM_DELLINK) {
+            m_links.erase(ifi->ifi_index);
+
+            std::map<std::pair<int, uint32_t>, SIfAddr>::iterator it = m_addrs.begin();
+
+            while (it != m_addrs.end()) {
+                if (it->first.first == ifi->ifi_index)
+                    m_addrs.erase(it++);
+                else
+                    ++it;
+            }
+
+            return false;
+        }
+
+        // a link flap (cable or powerline adapter replugged) only toggles
+        // the carrier, while the interface stays up and keeps its address
+        const unsigned int running = IFF_UP | IFF_RUNNING;
+        std::map<int, unsigned int>::iterator l_it = m_links.find(ifi->ifi_index);
+        bool was_running = (l_it != m_links.end()) && ((l_it->second & running) == running);
+
+        m_links[ifi->ifi_index] = ifi->ifi_flags;
+
+        return !was_running && ((ifi->ifi_flags & running) == running);
+    }
+
+    if ((nlh->nlmsg_type != RTM_NEWADDR) && (nlh->nlmsg_type != RTM_DELADDR))
+        return false;
+
+    const ifaddrmsg *ifa = (const ifaddrmsg *) NLMSG_DATA(nlh);
+
+    if (ifa->ifa_family != AF_INET)
+        return false;
+
+    SIfAddr addr;
+    addr.bcast = 0;
+    addr.ip = 0;
+
+    char label[IFNAMSIZ];
+
+    if (if_indextoname(ifa->ifa_index, label))
+        addr.label = label;
+
+    int len = IFA_PAYLOAD(nlh);
+
+    for (const rtattr *rta = IFA_RTA(ifa); RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+        switch (rta->rta_type) {
+            case IFA_ADDRESS:
+                // the peer address on point-to-point links, so IFA_LOCAL
+                // takes precedence
+                if (addr.ip == 0)
+                    memcpy(&addr.ip, RTA_DATA(rta), 4);
+                break;
+            case IFA_LOCAL:
+                memcpy(&addr.ip, RTA_DATA(rta), 4);
+                break;
+            case IFA_BROADCAST:
+                memcpy(&addr.bcast, RTA_DATA(rta), 4);
+                break;
+            case IFA_LABEL:
+                addr.label = (const char *) RTA_DATA(rta);
+                break;
+            default:
+                break;
+        }
+    }
+
+    std::pair<int, uint32_t> key(ifa->ifa_index, addr.ip);
+
+    if (nlh->nlmsg_type == RTM_DELADDR) {
+        m_addrs.erase(key);
+        return false;
+    }
+
+    bool is_new = (m_addrs.find(key) == m_addrs.end());
+    m_addrs[key] = addr;
+
+    return is_new && (addr.bcast != 0);
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Opens the netlink socket and reads the current interface table
+/// @return true, if successful
+/// @return false, otherwise
+//////////////////////////////////////////////////////////////////////////
+bool CIfMonitor::open() {
+    close();
+
+    m_fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC | SOCK_NONBLOCK, NETLINK_ROUTE);
+
+    if (m_fd < 0) {
+        logErr("Failed to create netlink socket: %s", strerror(errno));
+        return false;
+    }
+
+    sockaddr_nl sa;
+    memset(&sa, 0, sizeof(sockaddr_nl));
+    sa.nl_family = AF_NETLINK;
+    sa.nl_groups = RTMGRP_LINK | RTMGRP_IPV4_IFADDR;
+
+    if (bind(m_fd, (sockaddr *) &sa, sizeof(sockaddr_nl)) < 0) {
+        logErr("Failed to bind netlink socket: %s", strerror(errno));
+        close();
+        return false;
+    }
+
+    // the links have to be known before the addresses can be used
+    if (!dump(RTM_GETLINK) || !dump(RTM_GETADDR)) {
+        logErr("Failed to read network interfaces");
+        close();
+        return false;
+    }
+
+    return true;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Processes all pending notifications
+///
+/// @return true, if an interface has come up, got its carrier back or got
+///	a new address, i.e. a device discovery is worth a try
+/// @return false, otherwise
+//////////////////////////////////////////////////////////////////////////
+bool CIfMonitor::processMessages() {
+    if (m_fd < 0)
+        return false;
+
+    bool changed = false;
+    uint8_t buf[8192];
+
+    while (1) {
+        int rbytes = recv(m_fd, buf, sizeof(buf), 0);
+
+        if (rbytes < 0) {
+            // the kernel dropped notifications, so resynchronize the
+            // whole table
+            if (errno == ENOBUFS) {
+                logInf("Lost network interface notifications, rereading interfaces");
+                m_addrs.clear();
+                m_links.clear();
+                return dump(RTM_GETLINK) && dump(RTM_GETADDR);
+            }
+
+            break;
+        }
+
+        int len = rbytes;
+
+        for (const nlmsghdr *nlh = (const nlmsghdr *) buf; NLMSG_OK(nlh, len); nlh = NLMSG_NEXT(nlh, len))
+            if (handleMessage(nlh))
+                changed = true;
+    }
+
+    return changed;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Reads the messages of a pending dump reply
+///
+/// @param[out] done set to true, when the end of the dump was reached
+/// @return true, if successful
+/// @return false, if the kernel reported an error
+//////////////////////////////////////////////////////////////////////////
+bool CIfMonitor::readMessages(bool *done) {
+    uint8_t buf[8192];
+
+    int rbytes = recv(m_fd, buf, sizeof(buf), 0);
+
+    if (rbytes < 0)
+        return (errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR);
+
+    int len = rbytes;
+
+    for (const nlmsghdr *nlh = (const nlmsghdr *) buf; NLMSG_OK(nlh, len); nlh = NLMSG_NEXT(nlh, len)) {
+        if (nlh->nlmsg_type == NLMSG_DONE) {
+            *done = true;
+            continue;
+        }
+
+        if (nlh->nlmsg_type == NLMSG_ERROR)
+            return false;
+
+        handleMessage(nlh);
+    }
+
+    return true;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Asks the kernel for the complete table of the given type
+/// @param type RTM_GETLINK or RTM_GETADDR
+/// @return true, if successful
+/// @return false, otherwise
+//////////////////////////////////////////////////////////////////////////
+bool CIfMonitor::requestDump(int type) {
+    struct {
+        nlmsghdr nlh;
+        rtgenmsg gen;
+    } req;
+
+    memset(&req, 0, sizeof(req));
+    req.nlh.nlmsg_len = NLMSG_LENGTH(sizeof(rtgenmsg));
+    req.nlh.nlmsg_type = type;
+    req.nlh.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+    req.nlh.nlmsg_seq = ++m_seq;
+    req.gen.rtgen_family = (type == RTM_GETADDR) ? AF_INET : AF_UNSPEC;
+
+    sockaddr_nl sa;
+    memset(&sa, 0, sizeof(sockaddr_nl));
+    sa.nl_family = AF_NETLINK;
+
+    return sendto(m_fd, &req, req.nlh.nlmsg_len, 0, (sockaddr *) &sa, sizeof(sockaddr_nl)) >= 0;
+}
@@ -0,0 +1,90 @@
+//////////////////////////////////////////////////////////////////////////
+// devolo dLAN TV Sat control application
+// Copyright (C) 2008 devolo AG. All rights reserved.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//
+// Contact information:
+//    devolo AG
+//    Sonnenweg 11
+//    D-52070 Aachen, Germany
+//    gpl@devolo.de
+//////////////////////////////////////////////////////////////////////////
+/// @file ifmonitor.h
+/// @brief "dLAN TV Sat Network Interface Monitor" - header
+//////////////////////////////////////////////////////////////////////////
+
+#ifndef __TVSAT_IFMONITOR_H
+#define __TVSAT_IFMONITOR_H
+
+#include <list>
+#include <map>
+#include <stdint.h>
+#include <string>
+#include <utility>
+
+#include "discover.h"
+
+struct nlmsghdr;
+
+//////////////////////////////////////////////////////////////////////////
+/// rtnetlink based tracking of the network interfaces
+///
+/// The monitor reads the interfaces and their IPv4 addresses once when it
+/// is opened and then keeps its table up to date from the kernel's link
+/// and address notifications, so the interface list doesn't have to be
+/// queried for every discovery round.
+//////////////////////////////////////////////////////////////////////////
+class CIfMonitor {
+public:
+    CIfMonitor();
+
+    ~CIfMonitor();
+
+    void close();
+
+    /// Gets the netlink socket (readable when processMessages() has work)
+    int getFD() const { return m_fd; }
+
+    void getInterfaces(std::list<SNetIf> &ifs, const std::string &bind_if) const;
+
+    bool open();
+
+    bool processMessages();
+
+private:
+    struct SIfAddr {
+        uint32_t bcast;
+        uint32_t ip;
+        std::string label;
+    };
+
+    bool dump(int type);
+
+    bool handleMessage(const nlmsghdr *nlh);
+
+    bool readMessages(bool *done);
+
+    bool requestDump(int type);
+
+    // IPv4 addresses by interface index and address
+    std::map<std::pair<int, uint32_t>, SIfAddr> m_addrs;
+    int m_fd;
+    // interface flags by interface index
+    std::map<int, unsigned int> m_links;
+    uint32_t m_seq;
+};
+
+#endif
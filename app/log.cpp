@@ -27,10 +27,329 @@
 /// @author Michael Beckers
 //////////////////////////////////////////////////////////////////////////
 
+#include <atomic>
+#include <pthread.h>
 #include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
 
 #include "log.h"
 
+//////////////////////////////////////////////////////////////////////////
+// DEFINITIONS
+//////////////////////////////////////////////////////////////////////////
+#define TVSAT_LOG_FLUSH_INTERVAL      50 // ms
+#define TVSAT_LOG_MSG_LEN            248 // bytes
+#define TVSAT_LOG_RATE_BURST          10 // messages per call site and window
+#define TVSAT_LOG_RATE_PROBES          8
+#define TVSAT_LOG_RATE_SLOTS        1024
+#define TVSAT_LOG_RATE_WINDOW          1 // s
+#define TVSAT_LOG_RING_SIZE          256 // messages per thread
+
+//////////////////////////////////////////////////////////////////////////
+/// A formatted message waiting for the writer thread
+//////////////////////////////////////////////////////////////////////////
+struct SLogEntry {
+    int prio;
+    char msg[TVSAT_LOG_MSG_LEN];
+};
+
+//////////////////////////////////////////////////////////////////////////
+/// Single producer, single consumer queue of a logging thread
+///
+/// Rings are never freed. When their thread ends, they are handed on to
+/// the next thread that logs, so there are never more rings than threads
+/// that logged at the same time.
+//////////////////////////////////////////////////////////////////////////
+struct SLogRing {
+    /// Messages the producer had to drop, because the ring was full
+    std::atomic<uint64_t> dropped;
+    /// Dropped messages the writer has already reported
+    uint64_t dropped_reported;
+    SLogEntry entries[TVSAT_LOG_RING_SIZE];
+    /// Next entry the producer writes
+    std::atomic<uint32_t> head;
+    SLogRing *next;
+    std::atomic<int> owned;
+    /// Next entry the writer reads
+    std::atomic<uint32_t> tail;
+};
+
+//////////////////////////////////////////////////////////////////////////
+/// Rate limit of the messages of one call site (i.e. format string)
+//////////////////////////////////////////////////////////////////////////
+struct SLogRate {
+    std::atomic<uint32_t> count;
+    std::atomic<const char *> fmt;
+    std::atomic<uint32_t> suppressed;
+    /// Start of the current window in s
+    std::atomic<int64_t> window;
+};
+
+//////////////////////////////////////////////////////////////////////////
+/// Gives the ring of a thread back when the thread ends
+//////////////////////////////////////////////////////////////////////////
+class CLogRingOwner {
+public:
+    CLogRingOwner() { m_ring = 0; }
+
+    ~CLogRingOwner() {
+        if (m_ring)
+            m_ring->owned.store(0, std::memory_order_release);
+    }
+
+    SLogRing *getRing();
+
+private:
+    SLogRing *m_ring;
+};
+
+//////////////////////////////////////////////////////////////////////////
+// GLOBAL VARIABLES
+//////////////////////////////////////////////////////////////////////////
+static SLogRate log_rates[TVSAT_LOG_RATE_SLOTS];
+static std::atomic<SLogRing *> log_rings(0);
+static std::atomic<int> log_stop(0);
+static pthread_t log_thread;
+static std::atomic<int> log_writer_running(0);
+static thread_local CLogRingOwner log_ring_owner;
+
+//////////////////////////////////////////////////////////////////////////
+/// Gets the ring of the calling thread
+///
+/// Takes over a ring whose thread has ended or allocates a new one on the
+/// first call of a thread.
+//////////////////////////////////////////////////////////////////////////
+SLogRing *CLogRingOwner::getRing() {
+    if (m_ring)
+        return m_ring;
+
+    for (SLogRing *ring = log_rings.load(std::memory_order_acquire); ring; ring = ring->next) {
+        int unowned = 0;
+
+        if (ring->owned.compare_exchange_strong(unowned, 1, std::memory_order_acquire)) {
+            m_ring = ring;
+            return m_ring;
+        }
+    }
+
+    SLogRing *ring = new SLogRing;
+    ring->dropped = 0;
+    ring->dropped_reported = 0;
+    ring->head = 0;
+    ring->owned = 1;
+    ring->tail = 0;
+    ring->next = log_rings.load(std::memory_order_relaxed);
+
+    while (!log_rings.compare_exchange_weak(ring->next, ring, std::memory_order_release, std::memory_order_relaxed));
+
+    m_ring = ring;
+    return m_ring;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Gets a coarse monotonic time in s
+//////////////////////////////////////////////////////////////////////////
+static int64_t getLogTime() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return ts.tv_sec;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Checks if a call site may log another message
+///
+/// Every call site may log TVSAT_LOG_RATE_BURST messages per window, the
+/// others are counted and reported when the window ends. Call sites are
+/// told apart by their format string. If the table is full, the message
+/// is let through.
+///
+/// @param fmt the format string of the message
+/// @param[out] suppressed receives the number of messages that have been
+///             suppressed in the window that just ended (0: none)
+/// @return true, if the message may be logged
+//////////////////////////////////////////////////////////////////////////
+static bool allowMessage(const char *fmt, uint32_t &suppressed) {
+    suppressed = 0;
+
+    uintptr_t hash = ((uintptr_t) fmt >> 3) * 2654435761u;
+    SLogRate *rate = 0;
+
+    for (int i = 0; (i < TVSAT_LOG_RATE_PROBES) && !rate; ++i) {
+        SLogRate *slot = &log_rates[(hash + i) % TVSAT_LOG_RATE_SLOTS];
+        const char *key = slot->fmt.load(std::memory_order_relaxed);
+
+        if (!key && slot->fmt.compare_exchange_strong(key, fmt, std::memory_order_relaxed))
+            key = fmt;
+
+        if (key == fmt)
+            rate = slot;
+    }
+
+    if (!rate)
+        return true;
+
+    int64_t now = getLogTime();
+    int64_t window = rate->window.load(std::memory_order_relaxed);
+
+    // only one thread starts the new window, concurrent messages may
+    // still be counted against the old one
+    if ((now - window >= TVSAT_LOG_RATE_WINDOW) &&
+        rate->window.compare_exchange_strong(window, now, std::memory_order_relaxed)) {
+        rate->count.store(0, std::memory_order_relaxed);
+        suppressed = rate->suppressed.exchange(0, std::memory_order_relaxed);
+    }
+
+    if (rate->count.fetch_add(1, std::memory_order_relaxed) < TVSAT_LOG_RATE_BURST)
+        return true;
+
+    rate->suppressed.fetch_add(1, std::memory_order_relaxed);
+    return false;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Puts a message into the ring of the calling thread
+///
+/// Never waits: if the ring is full, the message is dropped and counted,
+/// unless the caller takes care of it.
+///
+/// @param drop true, if a message that doesn't fit is dropped
+/// @return true, if the message has been queued
+//////////////////////////////////////////////////////////////////////////
+static bool queueMessage(int prio, const char *fmt, va_list va, bool drop = true) {
+    SLogRing *ring = log_ring_owner.getRing();
+
+    uint32_t head = ring->head.load(std::memory_order_relaxed);
+
+    if (head - ring->tail.load(std::memory_order_acquire) >= TVSAT_LOG_RING_SIZE) {
+        if (drop)
+            ring->dropped.store(ring->dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+
+        return false;
+    }
+
+    SLogEntry &entry = ring->entries[head % TVSAT_LOG_RING_SIZE];
+    entry.prio = prio;
+    vsnprintf(entry.msg, TVSAT_LOG_MSG_LEN, fmt, va);
+
+    ring->head.store(head + 1, std::memory_order_release);
+
+    return true;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Logs a message without rate limiting
+//////////////////////////////////////////////////////////////////////////
+static void writeMessage(int prio, const char *fmt, ...) {
+    va_list va;
+
+    va_start(va, fmt);
+
+    if (log_writer_running.load(std::memory_order_acquire))
+        queueMessage(prio, fmt, va);
+    else
+        vsyslog(prio, fmt, va);
+
+    va_end(va);
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Logs a message with rate limiting
+///
+/// The message goes to the writer thread if it runs, otherwise it is
+/// written to the syslog right away.
+//////////////////////////////////////////////////////////////////////////
+static void logMessage(int prio, const char *fmt, va_list va) {
+    uint32_t suppressed;
+    bool allowed = allowMessage(fmt, suppressed);
+
+    if (suppressed)
+        writeMessage(LOG_MAKEPRI(LOG_DAEMON, LOG_WARNING), "Suppressed %u messages like \"%s\"", suppressed, fmt);
+
+    if (!allowed)
+        return;
+
+    if (log_writer_running.load(std::memory_order_acquire))
+        queueMessage(prio, fmt, va);
+    else
+        vsyslog(prio, fmt, va);
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Writes the queued messages of all threads to the syslog
+//////////////////////////////////////////////////////////////////////////
+static void flushRings() {
+    for (SLogRing *ring = log_rings.load(std::memory_order_acquire); ring; ring = ring->next) {
+        uint32_t tail = ring->tail.load(std::memory_order_relaxed);
+        uint32_t head = ring->head.load(std::memory_order_acquire);
+
+        for (; tail != head; ++tail) {
+            const SLogEntry &entry = ring->entries[tail % TVSAT_LOG_RING_SIZE];
+            syslog(entry.prio, "%s", entry.msg);
+        }
+
+        ring->tail.store(tail, std::memory_order_release);
+
+        uint64_t dropped = ring->dropped.load(std::memory_order_relaxed);
+
+        if (dropped != ring->dropped_reported) {
+            syslog(LOG_MAKEPRI(LOG_DAEMON, LOG_WARNING), "Dropped %llu log messages, because the log ring was full",
+                   (unsigned long long) (dropped - ring->dropped_reported));
+            ring->dropped_reported = dropped;
+        }
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Reports the messages of call sites that have been suppressed and
+/// haven't logged anything since their window ended
+//////////////////////////////////////////////////////////////////////////
+static void flushSuppressed() {
+    int64_t now = getLogTime();
+
+    for (int i = 0; i < TVSAT_LOG_RATE_SLOTS; ++i) {
+        SLogRate &rate = log_rates[i];
+        const char *fmt = rate.fmt.load(std::memory_order_relaxed);
+
+        if (!fmt || !rate.suppressed.load(std::memory_order_relaxed))
+            continue;
+
+        int64_t window = rate.window.load(std::memory_order_relaxed);
+
+        if (now - window < TVSAT_LOG_RATE_WINDOW)
+            continue;
+
+        uint32_t suppressed = rate.suppressed.exchange(0, std::memory_order_relaxed);
+
+        if (suppressed)
+            syslog(LOG_MAKEPRI(LOG_DAEMON, LOG_WARNING), "Suppressed %u messages like \"%s\"", suppressed, fmt);
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Main loop of the writer thread
+//////////////////////////////////////////////////////////////////////////
+static void *writerLoop(void *) {
+    timespec interval;
+    interval.tv_sec = 0;
+    interval.tv_nsec = TVSAT_LOG_FLUSH_INTERVAL * 1000000;
+
+    int64_t last_sweep = getLogTime();
+
+    while (!log_stop.load(std::memory_order_acquire)) {
+        nanosleep(&interval, 0);
+        flushRings();
+
+        if (getLogTime() - last_sweep >= TVSAT_LOG_RATE_WINDOW) {
+            flushSuppressed();
+            last_sweep = getLogTime();
+        }
+    }
+
+    pthread_exit(0);
+}
+
 //////////////////////////////////////////////////////////////////////////
 /// Send a debug message to the syslog
 //////////////////////////////////////////////////////////////////////////
@@ -38,7 +357,27 @@ void logDbg(const char *fmt, ...) {
     va_list va;
 
     va_start(va, fmt);
-    vsyslog(LOG_MAKEPRI(LOG_DAEMON, LOG_DEBUG), fmt, va);
+    logMessage(LOG_MAKEPRI(LOG_DAEMON, LOG_DEBUG), fmt, va);
+    va_end(va);
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Send an info message that is part of a dump the user asked for, e.g.
+/// with SIGUSR1, to the syslog
+///
+/// A dump may have many more lines than the rate limit allows, so they
+/// aren't limited. If the ring is full, the message is written to the
+/// syslog right away instead of being dropped.
+//////////////////////////////////////////////////////////////////////////
+void logDump(const char *fmt, ...) {
+    va_list va;
+
+    va_start(va, fmt);
+
+    if (!log_writer_running.load(std::memory_order_acquire) ||
+        !queueMessage(LOG_MAKEPRI(LOG_DAEMON, LOG_INFO), fmt, va, false))
+        vsyslog(LOG_MAKEPRI(LOG_DAEMON, LOG_INFO), fmt, va);
+
     va_end(va);
 }
 
@@ -49,7 +388,7 @@ void logErr(const char *fmt, ...) {
     va_list va;
 
     va_start(va, fmt);
-    vsyslog(LOG_MAKEPRI(LOG_DAEMON, LOG_ERR), fmt, va);
+    logMessage(LOG_MAKEPRI(LOG_DAEMON, LOG_ERR), fmt, va);
     va_end(va);
 }
 
@@ -60,6 +399,50 @@ void logInf(const char *fmt, ...) {
     va_list va;
 
     va_start(va, fmt);
-    vsyslog(LOG_MAKEPRI(LOG_DAEMON, LOG_INFO), fmt, va);
+    logMessage(LOG_MAKEPRI(LOG_DAEMON, LOG_INFO), fmt, va);
     va_end(va);
 }
+
+//////////////////////////////////////////////////////////////////////////
+/// Starts the writer thread
+///
+/// From then on, the logging functions only format the message into a
+/// ring of the calling thread and the writer thread passes it on to the
+/// syslog, so a slow syslog can't hold up the caller. Without the writer
+/// thread, messages are written right away.
+///
+/// Must be called after forking, because threads don't survive a fork.
+//////////////////////////////////////////////////////////////////////////
+bool startLogWriter() {
+    if (log_writer_running.load(std::memory_order_relaxed))
+        return true;
+
+    log_stop.store(0, std::memory_order_relaxed);
+
+    if (pthread_create(&log_thread, 0, writerLoop, 0) != 0) {
+        logErr("Failed to start log writer thread");
+        return false;
+    }
+
+    log_writer_running.store(1, std::memory_order_release);
+
+    return true;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Stops the writer thread and writes the messages that are still queued
+///
+/// Messages that are logged afterwards are written right away again.
+//////////////////////////////////////////////////////////////////////////
+void stopLogWriter() {
+    if (!log_writer_running.load(std::memory_order_relaxed))
+        return;
+
+    log_writer_running.store(0, std::memory_order_release);
+    log_stop.store(1, std::memory_order_release);
+    pthread_join(log_thread, 0);
+
+    // a thread may have queued a message just before the switch
+    flushRings();
+    flushSuppressed();
+}
@@ -42,8 +42,14 @@
 //////////////////////////////////////////////////////////////////////////
 void logDbg(const char *fmt, ...) __attribute__(( format( printf, 1, 2 )));
 
+void logDump(const char *fmt, ...) __attribute__(( format( printf, 1, 2 )));
+
 void logErr(const char *fmt, ...) __attribute__(( format( printf, 1, 2 )));
 
 void logInf(const char *fmt, ...) __attribute__(( format( printf, 1, 2 )));
 
+bool startLogWriter();
+
+void stopLogWriter();
+
 #endif
@@ -0,0 +1,415 @@
+//////////////////////////////////////////////////////////////////////////
+// devolo dLAN TV Sat control application
+// Copyright (C) 2008 devolo AG. All rights reserved.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//
+// Contact information:
+//    devolo AG
+//    Sonnenweg 11
+//    D-52070 Aachen, Germany
+//    gpl@devolo.de
+//////////////////////////////////////////////////////////////////////////
+/// @file metrics.cpp
+/// @brief "dLAN TV Sat Metrics Endpoint" - implementation
+//////////////////////////////////////////////////////////////////////////
+
+#include <arpa/inet.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "metrics.h"
+
+//////////////////////////////////////////////////////////////////////////
+// DEFINITIONS
+//////////////////////////////////////////////////////////////////////////
+#define TVSAT_METRICS_MAX_CLIENTS      8
+#define TVSAT_METRICS_MAX_REQUEST   4096 // bytes
+#define TVSAT_METRICS_TIMEOUT       2000 // ms of main loop service, from connecting to the end of the response
+
+//////////////////////////////////////////////////////////////////////////
+/// Starts a new metric
+/// @param name the name of the metric
+/// @param type counter, gauge or histogram
+/// @param help a one-line description
+//////////////////////////////////////////////////////////////////////////
+void CMetricsPage::addFamily(const char *name, const char *type, const char *help) {
+    m_text += "# HELP ";
+    m_text += name;
+    m_text += ' ';
+    m_text += help;
+    m_text += "\n# TYPE ";
+    m_text += name;
+    m_text += ' ';
+    m_text += type;
+    m_text += '\n';
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Adds a sample to the current metric
+/// @param name the name of the sample (the metric or one of its
+///             _bucket, _sum or _count series)
+/// @param labels comma separated label pairs, e.g. device="1.2.3.4"
+/// @param value the value of the sample
+//////////////////////////////////////////////////////////////////////////
+void CMetricsPage::addSample(const char *name, const std::string &labels, double value) {
+    char buf[64];
+    snprintf(buf, sizeof(buf), " %.15g\n", value);
+
+    m_text += name;
+
+    if (!labels.empty()) {
+        m_text += '{';
+        m_text += labels;
+        m_text += '}';
+    }
+
+    m_text += buf;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Constructor
+//////////////////////////////////////////////////////////////////////////
+CMetricsServer::CMetricsServer() {
+    m_fd = -1;
+    m_suspended = false;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Destructor
+//////////////////////////////////////////////////////////////////////////
+CMetricsServer::~CMetricsServer() {
+    close();
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Closes the listening socket and drops all clients
+//////////////////////////////////////////////////////////////////////////
+void CMetricsServer::close() {
+    if (m_fd >= 0)
+        ::close(m_fd);
+
+    m_fd = -1;
+
+    for (std::list<SMetricsConn>::iterator c_it = m_conns.begin();
+         c_it != m_conns.end(); ++c_it)
+        ::close(c_it->fd);
+
+    m_conns.clear();
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Adds the sockets that have to be polled
+///
+/// Clients that wait for the page are left out until it is sent.
+//////////////////////////////////////////////////////////////////////////
+void CMetricsServer::getPollFDs(std::vector<pollfd> &pfds) const {
+    pollfd pfd;
+    pfd.revents = 0;
+
+    if (m_fd >= 0) {
+        pfd.fd = m_fd;
+        pfd.events = POLLIN;
+        pfds.push_back(pfd);
+    }
+
+    for (std::list<SMetricsConn>::const_iterator c_it = m_conns.begin();
+         c_it != m_conns.end(); ++c_it) {
+        if (c_it->waiting)
+            continue;
+
+        pfd.fd = c_it->fd;
+        pfd.events = c_it->response.empty() ? POLLIN : POLLOUT;
+        pfds.push_back(pfd);
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Gets the time until the next client has to be dropped
+/// @return the time in ms or -1, if there are no clients
+//////////////////////////////////////////////////////////////////////////
+int CMetricsServer::getTimeout() const {
+    if (m_conns.empty())
+        return -1;
+
+    timeval now, rm;
+    gettimeofday(&now, 0);
+
+    int timeout = TVSAT_METRICS_TIMEOUT;
+
+    for (std::list<SMetricsConn>::const_iterator c_it = m_conns.begin();
+         c_it != m_conns.end(); ++c_it) {
+        if (!timercmp(&now, &c_it->deadline, <))
+            return 0;
+
+        timersub(&c_it->deadline, &now, &rm);
+
+        int ms = rm.tv_sec * 1000 + rm.tv_usec / 1000 + 1;
+
+        if (ms < timeout)
+            timeout = ms;
+    }
+
+    return timeout;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Accepts new clients, reads their requests and sends the responses
+/// as far as the sockets allow
+///
+/// Every client has TVSAT_METRICS_TIMEOUT from its connection to the end
+/// of the response, no matter how slowly it sends or receives, so it
+/// never holds up the main loop. The time the main loop is busy elsewhere
+/// doesn't count (see suspend()). Requests for anything but the metrics
+/// page are answered right away.
+///
+/// @return true, if clients wait for the page (see sendResponse())
+/// @return false, otherwise
+//////////////////////////////////////////////////////////////////////////
+bool CMetricsServer::handleEvents() {
+    timeval now, timeout;
+    gettimeofday(&now, 0);
+    timeout.tv_sec = TVSAT_METRICS_TIMEOUT / 1000;
+    timeout.tv_usec = (TVSAT_METRICS_TIMEOUT % 1000) * 1000;
+
+    while (m_fd >= 0) {
+        int fd = accept4(m_fd, 0, 0, SOCK_CLOEXEC | SOCK_NONBLOCK);
+
+        if (fd < 0)
+            break;
+
+        if (m_conns.size() >= TVSAT_METRICS_MAX_CLIENTS) {
+            ::close(fd);
+            continue;
+        }
+
+        SMetricsConn conn;
+        timeradd(&now, &timeout, &conn.deadline);
+        conn.fd = fd;
+        conn.sent = 0;
+        conn.waiting = false;
+        m_conns.push_back(conn);
+    }
+
+    bool waiting = false;
+    std::list<SMetricsConn>::iterator c_it = m_conns.begin();
+
+    while (c_it != m_conns.end()) {
+        bool done;
+
+        if (!timercmp(&now, &c_it->deadline, <))
+            done = true;
+        else if (c_it->waiting)
+            done = false;
+        else if (c_it->response.empty())
+            done = readRequest(*c_it);
+        else
+            done = writeResponse(*c_it);
+
+        if (done) {
+            ::close(c_it->fd);
+            c_it = m_conns.erase(c_it);
+            continue;
+        }
+
+        waiting = waiting || c_it->waiting;
+        ++c_it;
+    }
+
+    return waiting;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Opens the listening socket
+/// @param address the local IPv4 address to listen on
+/// @param port the TCP port to listen on
+/// @return true, if successful
+/// @return false, otherwise
+//////////////////////////////////////////////////////////////////////////
+bool CMetricsServer::open(const std::string &address, uint16_t port) {
+    close();
+
+    sockaddr_in sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sin_family = AF_INET;
+    sa.sin_port = htons(port);
+
+    if (inet_pton(AF_INET, address.c_str(), &sa.sin_addr) != 1) {
+        logErr("Invalid metrics address %s", address.c_str());
+        return false;
+    }
+
+    m_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+    if (m_fd < 0) {
+        logErr("Failed to create metrics socket");
+        return false;
+    }
+
+    int reuse = 1;
+    setsockopt(m_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    if ((bind(m_fd, (sockaddr *) &sa, sizeof(sa)) != 0) || (listen(m_fd, 8) != 0)) {
+        logErr("Failed to listen for metrics requests on %s:%u", address.c_str(), port);
+        close();
+        return false;
+    }
+
+    logInf("Serving metrics on http://%s:%u/metrics", address.c_str(), port);
+
+    return true;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Reads as much of a request as there is
+///
+/// We only look at the request line, but read the whole header so the
+/// client doesn't get a reset for unread data when we close the socket.
+///
+/// @return true, if the connection is done
+/// @return false, otherwise
+//////////////////////////////////////////////////////////////////////////
+bool CMetricsServer::readRequest(SMetricsConn &conn) {
+    char buf[TVSAT_METRICS_MAX_REQUEST];
+
+    while (true) {
+        int rbytes = recv(conn.fd, buf, sizeof(buf), 0);
+
+        if (rbytes < 0)
+            return (errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR);
+
+        if (rbytes == 0)
+            return true;
+
+        conn.request.append(buf, rbytes);
+
+        if ((conn.request.find("\r\n\r\n") != std::string::npos) ||
+            (conn.request.find("\n\n") != std::string::npos))
+            break;
+
+        if (conn.request.size() >= TVSAT_METRICS_MAX_REQUEST)
+            break;
+    }
+
+    const char *req = conn.request.c_str();
+
+    if (strncmp(req, "GET ", 4) != 0)
+        conn.response = "HTTP/1.0 405 Method Not Allowed\r\nAllow: GET\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+    else if ((strncmp(req + 4, "/metrics ", 9) != 0) && (strncmp(req + 4, "/ ", 2) != 0))
+        conn.response = "HTTP/1.0 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+    else {
+        conn.waiting = true;
+        return false;
+    }
+
+    return writeResponse(conn);
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Lets the deadlines of the clients run again after suspend()
+///
+/// The deadlines are moved by the time the clients were suspended.
+//////////////////////////////////////////////////////////////////////////
+void CMetricsServer::resume() {
+    if (!m_suspended)
+        return;
+
+    m_suspended = false;
+
+    timeval now, gap;
+    gettimeofday(&now, 0);
+
+    if (!timercmp(&now, &m_suspend_time, >))
+        return;
+
+    timersub(&now, &m_suspend_time, &gap);
+
+    for (std::list<SMetricsConn>::iterator c_it = m_conns.begin();
+         c_it != m_conns.end(); ++c_it)
+        timeradd(&c_it->deadline, &gap, &c_it->deadline);
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Passes the metrics page on to all clients that wait for it
+/// @param body the text of the page
+//////////////////////////////////////////////////////////////////////////
+void CMetricsServer::sendResponse(const std::string &body) {
+    char header[256];
+    snprintf(header, sizeof(header),
+             "HTTP/1.0 200 OK\r\n"
+             "Content-Type: text/plain; version=0.0.4\r\n"
+             "Content-Length: %zu\r\n"
+             "Connection: close\r\n\r\n", body.size());
+
+    std::list<SMetricsConn>::iterator c_it = m_conns.begin();
+
+    while (c_it != m_conns.end()) {
+        if (!c_it->waiting) {
+            ++c_it;
+            continue;
+        }
+
+        c_it->response = header;
+        c_it->response += body;
+        c_it->waiting = false;
+
+        if (writeResponse(*c_it)) {
+            ::close(c_it->fd);
+            c_it = m_conns.erase(c_it);
+        } else
+            ++c_it;
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Stops the deadlines of the clients until resume()
+///
+/// The main loop calls this before it blocks in a discovery round or a
+/// liveness check, so a scrape that is under way is finished when the
+/// main loop gets back to it instead of being dropped. New clients wait
+/// in the listen backlog meanwhile.
+//////////////////////////////////////////////////////////////////////////
+void CMetricsServer::suspend() {
+    if (m_suspended)
+        return;
+
+    m_suspended = true;
+    gettimeofday(&m_suspend_time, 0);
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Sends as much of a response as the socket takes
+/// @return true, if the connection is done
+/// @return false, otherwise
+//////////////////////////////////////////////////////////////////////////
+bool CMetricsServer::writeResponse(SMetricsConn &conn) {
+    while (conn.sent < conn.response.size()) {
+        ssize_t n = send(conn.fd, conn.response.data() + conn.sent,
+                         conn.response.size() - conn.sent, MSG_NOSIGNAL);
+
+        if (n < 0)
+            return (errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR);
+
+        conn.sent += n;
+    }
+
+    return true;
+}
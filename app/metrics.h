@@ -0,0 +1,116 @@
+//////////////////////////////////////////////////////////////////////////
+// devolo dLAN TV Sat control application
+// Copyright (C) 2008 devolo AG. All rights reserved.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//
+// Contact information:
+//    devolo AG
+//    Sonnenweg 11
+//    D-52070 Aachen, Germany
+//    gpl@devolo.de
+//////////////////////////////////////////////////////////////////////////
+/// @file metrics.h
+/// @brief "dLAN TV Sat Metrics Endpoint" - header
+//////////////////////////////////////////////////////////////////////////
+
+#ifndef __TVSAT_METRICS_H
+#define __TVSAT_METRICS_H
+
+#include <list>
+#include <poll.h>
+#include <stdint.h>
+#include <string>
+#include <sys/time.h>
+#include <vector>
+
+//////////////////////////////////////////////////////////////////////////
+/// A page in the Prometheus text exposition format
+///
+/// The samples of a metric have to follow its family header without any
+/// other metric in between, so callers add one family at a time.
+//////////////////////////////////////////////////////////////////////////
+class CMetricsPage {
+public:
+    void addFamily(const char *name, const char *type, const char *help);
+
+    void addSample(const char *name, const std::string &labels, double value);
+
+    /// Gets the text of the page
+    const std::string &getText() const { return m_text; }
+
+private:
+    std::string m_text;
+};
+
+//////////////////////////////////////////////////////////////////////////
+/// A connection of a metrics client
+//////////////////////////////////////////////////////////////////////////
+struct SMetricsConn {
+    /// The connection is dropped at this time, whatever its state
+    timeval deadline;
+    int fd;
+    std::string request;
+    std::string response;
+    size_t sent;
+    /// The request is complete and waits for the page
+    bool waiting;
+};
+
+//////////////////////////////////////////////////////////////////////////
+/// Minimal HTTP listener that serves a metrics page
+///
+/// All sockets are non-blocking and meant to be polled by the main loop
+/// (see getPollFDs()), which builds the page only when a scrape request
+/// is complete. While the main loop does something else, the clients are
+/// suspended (see suspend()).
+//////////////////////////////////////////////////////////////////////////
+class CMetricsServer {
+public:
+    CMetricsServer();
+
+    ~CMetricsServer();
+
+    void close();
+
+    /// Gets the file descriptor of the listening socket (-1: closed)
+    int getFD() const { return m_fd; }
+
+    void getPollFDs(std::vector<pollfd> &pfds) const;
+
+    int getTimeout() const;
+
+    bool handleEvents();
+
+    bool open(const std::string &address, uint16_t port);
+
+    void resume();
+
+    void sendResponse(const std::string &body);
+
+    void suspend();
+
+private:
+    bool readRequest(SMetricsConn &conn);
+
+    bool writeResponse(SMetricsConn &conn);
+
+    std::list<SMetricsConn> m_conns;
+    int m_fd;
+    bool m_suspended;
+    timeval m_suspend_time;
+};
+
+#endif
@@ -29,7 +29,6 @@
 
 #include <arpa/inet.h>
 #include <cstring>
-#include <iostream>
 #include <net/if.h>
 #include <netinet/ip.h>
 #include <netinet/tcp.h>
@@ -38,6 +37,7 @@
 #include <sys/ioctl.h>
 #include <sys/socket.h>
 
+#include "log.h"
 #include "rawsocket.h"
 
 //////////////////////////////////////////////////////////////////////////
@@ -79,7 +79,7 @@ bool CRawSocket::open(unsigned short port, const char *interface) {
     m_fd = socket(PF_PACKET, SOCK_RAW, htons(m_proto));
 
     if (m_fd < 0) {
-        std::cerr << "socket() failed" << std::endl;
+        logErr("socket() failed");
         close();
         return false;
     }
@@ -105,17 +105,17 @@ bool CRawSocket::open(unsigned short port, const char *interface) {
 bool CRawSocket::send(const unsigned char *data, size_t data_len,
                       char *addr, size_t addr_len) const {
     if (addr_len > 8) {
-        std::cerr << "address too long" << std::endl;
+        logErr("address too long");
         return false;
     }
 
     if (m_fd < 0) {
-        std::cerr << "socket not open" << std::endl;
+        logErr("socket not open");
         return false;
     }
 
     if (!m_ifindex) {
-        std::cerr << "no interface specified" << std::endl;
+        logErr("no interface specified");
         return false;
     }
 
@@ -128,7 +128,7 @@ bool CRawSocket::send(const unsigned char *data, size_t data_len,
 
     if (sendto(m_fd, data, data_len, 0, (sockaddr *) &sa,
                sizeof(sockaddr_ll)) <= 0)
-        std::cerr << "sendto() failed" << std::endl;
+        logErr("sendto() failed");
 
     return true;
 }
@@ -139,14 +139,17 @@ bool CRawSocket::send(const unsigned char *data, size_t data_len,
 /// @param len size of the packet buffer
 /// @param blocking determines, if the reception should be blocking or not
 /// @param timeout the time to wait for an incoming packet
+/// @param[out] if_index index of the interface the packet was received on
+///		(optional)
 /// @return	payload size of the received packet, if a packet has been
 ///		received
 /// @return	0, if no packet has been received
 //////////////////////////////////////////////////////////////////////////
 size_t CRawSocket::receive(unsigned char *buf, size_t len,
-                           bool blocking, int timeout) const {
+                           bool blocking, int timeout,
+                           int *if_index) const {
     if (m_fd < 0) {
-        std::cerr << "UDP socket not open" << std::endl;
+        logErr("UDP socket not open");
         return 0;
     }
 
@@ -162,7 +165,7 @@ size_t CRawSocket::receive(unsigned char *buf, size_t len,
                      blocking ? 0 : &to);
 
     if (sel < 0) {
-        std::cerr << "select() failed" << std::endl;
+        logErr("select() failed");
         return 0;
     }
 
@@ -171,13 +174,17 @@ size_t CRawSocket::receive(unsigned char *buf, size_t len,
         socklen_t salen = sizeof(sockaddr_ll);
         memset(&sa, 0, salen);
 
-        int rbytes = recv(m_fd, buf, len, 0);
+        int rbytes = recvfrom(m_fd, buf, len, 0, (sockaddr *) &sa,
+                              &salen);
 
         if (rbytes < 0) {
-            std::cerr << "recv() failed" << std::endl;
+            logErr("recv() failed");
             return 0;
         }
 
+        if (if_index)
+            *if_index = sa.sll_ifindex;
+
         iphdr *iph = (iphdr *) (buf + sizeof(ether_header));
 
         if (m_sub_proto != 0 && iph->protocol != m_sub_proto)
@@ -55,7 +55,8 @@ public:
 
     size_t receive(unsigned char *buf, size_t len,
                    bool blocking = false,
-                   int timeout = 100000) const;
+                   int timeout = 100000,
+                   int *if_index = 0) const;
 
     bool send(const unsigned char *data, size_t data_len,
               char *addr, size_t addr_len) const;
@@ -0,0 +1,220 @@
+//////////////////////////////////////////////////////////////////////////
+// devolo dLAN TV Sat control application
+// Copyright (C) 2008 devolo AG. All rights reserved.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//
+// Contact information:
+//    devolo AG
+//    Sonnenweg 11
+//    D-52070 Aachen, Germany
+//    gpl@devolo.de
+//////////////////////////////////////////////////////////////////////////
+/// @file reactor.cpp
+/// @brief "dLAN TV Sat Event Reactor" - implementation
+//////////////////////////////////////////////////////////////////////////
+
+#include <cerrno>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "reactor.h"
+
+//////////////////////////////////////////////////////////////////////////
+/// Constructor
+/// @param id a number that identifies the reactor in log messages
+//////////////////////////////////////////////////////////////////////////
+CReactor::CReactor(int id) {
+    m_id = id;
+    m_thread_started = 0;
+
+    m_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    m_stop_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+
+    if ((m_epoll_fd >= 0) && (m_stop_fd >= 0)) {
+        epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.fd = m_stop_fd;
+        epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, m_stop_fd, &ev);
+    }
+
+    // the handlers are also accessed from within the callbacks, e.g. if
+    // a handler re-registers a socket it just reopened
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&m_handlers_access, &attr);
+    pthread_mutexattr_destroy(&attr);
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Destructor
+//////////////////////////////////////////////////////////////////////////
+CReactor::~CReactor() {
+    stop();
+
+    if (m_epoll_fd >= 0)
+        close(m_epoll_fd);
+
+    if (m_stop_fd >= 0)
+        close(m_stop_fd);
+
+    pthread_mutex_destroy(&m_handlers_access);
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Registers a file descriptor
+///
+/// @param fd the file descriptor to watch
+/// @param handler the object that is notified when the fd is ready
+/// @param events the epoll events to wait for
+/// @return true, if successful
+/// @return false, otherwise (e.g. the fd does not support polling)
+//////////////////////////////////////////////////////////////////////////
+bool CReactor::add(int fd, CReactorHandler *handler, uint32_t events) {
+    if ((fd < 0) || !handler)
+        return false;
+
+    epoll_event ev;
+    ev.events = events;
+    ev.data.fd = fd;
+
+    pthread_mutex_lock(&m_handlers_access);
+
+    if (epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+        pthread_mutex_unlock(&m_handlers_access);
+        return false;
+    }
+
+    m_handlers[fd] = handler;
+
+    pthread_mutex_unlock(&m_handlers_access);
+
+    return true;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Gets the number of registered file descriptors
+//////////////////////////////////////////////////////////////////////////
+int CReactor::getLoad() {
+    pthread_mutex_lock(&m_handlers_access);
+    int load = m_handlers.size();
+    pthread_mutex_unlock(&m_handlers_access);
+
+    return load;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Unregisters a file descriptor
+///
+/// Once this function returns, the handler of the fd is not called
+/// anymore, so it is safe to delete it.
+//////////////////////////////////////////////////////////////////////////
+void CReactor::remove(int fd) {
+    pthread_mutex_lock(&m_handlers_access);
+
+    // the fd may already have been closed, which removes it from the
+    // epoll set automatically
+    epoll_ctl(m_epoll_fd, EPOLL_CTL_DEL, fd, 0);
+    m_handlers.erase(fd);
+
+    pthread_mutex_unlock(&m_handlers_access);
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Main loop of the reactor thread
+//////////////////////////////////////////////////////////////////////////
+void CReactor::loop() {
+    const int max_events = 64;
+    epoll_event events[max_events];
+
+    while (1) {
+        int n = epoll_wait(m_epoll_fd, events, max_events, -1);
+
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+
+            logErr("Reactor %i: epoll_wait() failed", m_id);
+            return;
+        }
+
+        // keep the handlers from being removed while we're dispatching,
+        // but look them up again for every event, because an earlier
+        // handler may have removed a later one
+        pthread_mutex_lock(&m_handlers_access);
+
+        for (int i = 0; i < n; ++i) {
+            int fd = events[i].data.fd;
+
+            if (fd == m_stop_fd) {
+                pthread_mutex_unlock(&m_handlers_access);
+                return;
+            }
+
+            std::map<int, CReactorHandler *>::iterator it = m_handlers.find(fd);
+
+            if (it != m_handlers.end())
+                it->second->handleEvent(fd, events[i].events);
+        }
+
+        pthread_mutex_unlock(&m_handlers_access);
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Starts the reactor thread
+//////////////////////////////////////////////////////////////////////////
+bool CReactor::start() {
+    if ((m_epoll_fd < 0) || (m_stop_fd < 0)) {
+        logErr("Reactor %i: failed to create epoll instance", m_id);
+        return false;
+    }
+
+    if (pthread_create(&m_thread, 0, startThread, (void *) this) != 0) {
+        logErr("Reactor %i: failed to create thread", m_id);
+        return false;
+    }
+
+    m_thread_started = 1;
+
+    return true;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Entry point for a new reactor thread
+/// @param reactor an instance of CReactor
+//////////////////////////////////////////////////////////////////////////
+void *CReactor::startThread(void *reactor) {
+    ((CReactor *) reactor)->loop();
+    pthread_exit(0);
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Stops the reactor thread and waits for it to terminate
+//////////////////////////////////////////////////////////////////////////
+void CReactor::stop() {
+    if (!m_thread_started)
+        return;
+
+    uint64_t one = 1;
+
+    if (write(m_stop_fd, &one, sizeof(one)) != sizeof(one))
+        logErr("Reactor %i: failed to signal thread", m_id);
+
+    pthread_join(m_thread, 0);
+    m_thread_started = 0;
+}
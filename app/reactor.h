@@ -0,0 +1,90 @@
+//////////////////////////////////////////////////////////////////////////
+// devolo dLAN TV Sat control application
+// Copyright (C) 2008 devolo AG. All rights reserved.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//
+// Contact information:
+//    devolo AG
+//    Sonnenweg 11
+//    D-52070 Aachen, Germany
+//    gpl@devolo.de
+//////////////////////////////////////////////////////////////////////////
+/// @file reactor.h
+/// @brief "dLAN TV Sat Event Reactor" - header
+//////////////////////////////////////////////////////////////////////////
+
+#ifndef __TVSAT_REACTOR_H
+#define __TVSAT_REACTOR_H
+
+#include <map>
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/epoll.h>
+
+//////////////////////////////////////////////////////////////////////////
+/// Interface of objects that want to be notified by a CReactor
+//////////////////////////////////////////////////////////////////////////
+class CReactorHandler {
+public:
+    virtual ~CReactorHandler() {}
+
+    /// Called from the reactor thread when a registered fd is ready
+    virtual void handleEvent(int fd, uint32_t events) = 0;
+};
+
+//////////////////////////////////////////////////////////////////////////
+/// epoll based event loop
+///
+/// A reactor runs one thread that waits for any of its registered file
+/// descriptors to become ready and dispatches the events to the
+/// respective handlers. This allows a single thread to serve the control
+/// and stream sockets of several devices.
+//////////////////////////////////////////////////////////////////////////
+class CReactor {
+public:
+    CReactor(int id);
+
+    ~CReactor();
+
+    bool add(int fd, CReactorHandler *handler, uint32_t events = EPOLLIN);
+
+    /// Gets the number of registered file descriptors
+    int getLoad();
+
+    /// Gets the reactor thread (only valid after start())
+    pthread_t getThread() const { return m_thread; }
+
+    void remove(int fd);
+
+    bool start();
+
+    void stop();
+
+private:
+    void loop();
+
+    static void *startThread(void *reactor);
+
+    int m_epoll_fd;
+    std::map<int, CReactorHandler *> m_handlers;
+    pthread_mutex_t m_handlers_access;
+    int m_id;
+    int m_stop_fd;
+    pthread_t m_thread;
+    int m_thread_started;
+};
+
+#endif
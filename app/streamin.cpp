@@ -27,17 +27,172 @@
 /// @author Michael Beckers
 //////////////////////////////////////////////////////////////////////////
 
+#include <cerrno>
 #include <cstring>
 #include <iostream>
 #include <netinet/ip.h>
+#include <poll.h>
 #include <stdint.h>
+#include <sys/eventfd.h>
+#include <time.h>
 #include <unistd.h>
 #include <stdio.h>
 
 #include "log.h"
 #include "streamin.h"
+#include "threadsched.h"
 #include "tvsatctl.h"
 
+//////////////////////////////////////////////////////////////////////////
+/// Commands whose retries are counted separately, the last entry counts
+/// all other commands
+//////////////////////////////////////////////////////////////////////////
+static const struct {
+    uint16_t cmd;
+    const char *name;
+} metrics_commands[TVSAT_METRICS_COMMANDS] = {
+    { cCmdConnect, "connect" },
+    { cCmdDisconnect, "disconnect" },
+    { cCmdFeDiseqcSendBurst, "diseqc_burst" },
+    { cCmdFeDiseqcSendMasterCommand, "diseqc_command" },
+    { cCmdFeReadStatus, "read_status" },
+    { cCmdFeSetFrontend, "set_frontend" },
+    { cCmdFeSetTone, "set_tone" },
+    { cCmdFeSetVoltage, "set_voltage" },
+    { cCmdStart, "start" },
+    { cCmdStop, "stop" },
+    { cCmdTseStart2, "set_filter" },
+    { 0xffff, "other" }
+};
+
+//////////////////////////////////////////////////////////////////////////
+/// Upper bounds of the write latency buckets in ns
+//////////////////////////////////////////////////////////////////////////
+static const uint64_t metrics_write_buckets[TVSAT_METRICS_WRITE_BUCKETS] = {
+    10000, 50000, 100000, 500000, 1000000, 10000000
+};
+
+//////////////////////////////////////////////////////////////////////////
+/// A copy of a flight recorder on its way to a file
+//////////////////////////////////////////////////////////////////////////
+struct SFlightDump {
+    CFlightRecorder flight;
+    std::string ip;
+    std::string path;
+    /// A string literal
+    const char *reason;
+    /// Monotonic time of the copy in ns
+    uint64_t time;
+    time_t wall;
+};
+
+//////////////////////////////////////////////////////////////////////////
+/// Serializes the flight recorder dumps
+//////////////////////////////////////////////////////////////////////////
+static pthread_mutex_t flight_dump_lock = PTHREAD_MUTEX_INITIALIZER;
+
+//////////////////////////////////////////////////////////////////////////
+/// Writes a copy of a flight recorder to a file, see
+/// CTVSatStreamIn::dumpFlightRecorder()
+//////////////////////////////////////////////////////////////////////////
+static void *writeFlightDump(void *arg) {
+    SFlightDump *dump = (SFlightDump *) arg;
+
+    static const char *types[] = {
+        "add_pid", "del_pid", "filter", "received", "reset", "retry",
+        "sent", "stale", "state", "tune"
+    };
+
+    const CFlightRecorder &flight = dump->flight;
+    const char *ip = dump->ip.c_str();
+    std::string tmp_path = dump->path + ".tmp";
+
+    // two dumps of a device would share the temporary file
+    pthread_mutex_lock(&flight_dump_lock);
+
+    FILE *file = fopen(tmp_path.c_str(), "w");
+
+    if (!file) {
+        logErr("Failed to dump flight recorder of %s to %s", ip, tmp_path.c_str());
+        pthread_mutex_unlock(&flight_dump_lock);
+        delete dump;
+        return 0;
+    }
+
+    char wall_str[32];
+    strftime(wall_str, sizeof(wall_str), "%Y-%m-%d %H:%M:%S", localtime(&dump->wall));
+
+    fprintf(file, "# flight recorder of %s, dumped at %s on %s\n", ip, wall_str, dump->reason);
+    fprintf(file, "# %u events (%llu older ones overwritten), age in s\n", flight.getCount(),
+            (unsigned long long) flight.getLost());
+
+    for (unsigned int i = 0; i < flight.getCount(); ++i) {
+        const SFlightEvent &ev = flight.getEvent(i);
+        const char *type = (ev.type <= SFlightEvent::eTune) ? types[ev.type] : "unknown";
+
+        fprintf(file, "%12.6f %-20s %-8s", (dump->time - ev.time) / -1e9, CTVSatStreamIn::getStateName(ev.state), type);
+
+        switch (ev.type) {
+            case SFlightEvent::eAddPID:
+            case SFlightEvent::eDelPID:
+                fprintf(file, " pid=%u", ev.arg);
+                break;
+
+            case SFlightEvent::eFilter:
+                fprintf(file, " pids=%u", ev.arg);
+                break;
+
+            case SFlightEvent::eReceived:
+            case SFlightEvent::eRetry:
+            case SFlightEvent::eSent:
+            case SFlightEvent::eStale: {
+                int index = 0;
+
+                while ((index < TVSAT_METRICS_COMMANDS - 1) && (metrics_commands[index].cmd != ev.cmd))
+                    ++index;
+
+                fprintf(file, " cmd=0x%04x (%s)", ev.cmd, metrics_commands[index].name);
+
+                if (ev.type == SFlightEvent::eSent) {
+                    if (ev.result == 0xffff)
+                        fprintf(file, " send failed");
+                } else if (ev.type != SFlightEvent::eRetry)
+                    fprintf(file, " result=%u", ev.result);
+
+                if ((ev.type == SFlightEvent::eReceived) && (ev.cmd == cCmdFeReadStatus))
+                    fprintf(file, " status=0x%x", ev.arg);
+
+                break;
+            }
+
+            case SFlightEvent::eState:
+                fprintf(file, " from=%s", CTVSatStreamIn::getStateName(ev.arg));
+                break;
+
+            case SFlightEvent::eTune:
+                fprintf(file, " frequency=%u", ev.arg);
+                break;
+
+            default:
+                break;
+        }
+
+        fprintf(file, "\n");
+    }
+
+    if ((fclose(file) != 0) || (rename(tmp_path.c_str(), dump->path.c_str()) != 0)) {
+        logErr("Failed to dump flight recorder of %s to %s", ip, dump->path.c_str());
+        unlink(tmp_path.c_str());
+    } else
+        logDump("Dumped flight recorder of %s to %s", ip, dump->path.c_str());
+
+    pthread_mutex_unlock(&flight_dump_lock);
+    delete dump;
+
+    return 0;
+}
+
+
 //////////////////////////////////////////////////////////////////////////
 /// Constructor
 ///
@@ -46,40 +201,82 @@
 //////////////////////////////////////////////////////////////////////////
 CTVSatStreamIn::CTVSatStreamIn(bool verbose) {
     m_verbose = verbose;
+    m_client_port = 0;
+    m_clock = 0;
     m_do_connect = 0;
     m_do_tune = 0;
+    m_flight_dump = 0;
+    timerclear(&m_flight_dump_time);
+    m_flight_state = eDisconnected;
+    m_has_last_diseqc = 0;
     m_is_tuned = 0;
+    m_keepalive_failures = 0;
+    m_liveness_fd = -1;
+    m_reopen_stream_sock = 0;
     m_retry = 0;
     m_select_pids = 0;
+    m_sock_gen = 0;
     m_state = eDisconnected;
     m_stop = 0;
     m_stop_thread = 0;
     m_thread_started = 0;
     m_try_pilot1 = 0;
+    m_transport = 0;
+    m_ts_stats = 0;
     m_tvsat_ip[0] = '\0';
     m_tune = 0;
+    m_tune_gen = 0;
     m_wait = 0;
 
+    m_metrics.bytes = 0;
+    m_metrics.connected_since = 0;
+    m_metrics.datagrams = 0;
+    m_metrics.filter_updates = 0;
+    m_metrics.is_tuned = 0;
+    m_metrics.pids = 0;
+    m_metrics.resets = 0;
+    m_metrics.state = eDisconnected;
+    m_metrics.write_ns = 0;
+    m_metrics.zaps = 0;
+    m_metrics.zap_last_ms = 0;
+    m_metrics.zap_ms = 0;
+
+    for (int i = 0; i < TVSAT_METRICS_COMMANDS; ++i)
+        m_metrics.retries[i] = 0;
+
+    for (int i = 0; i <= TVSAT_METRICS_WRITE_BUCKETS; ++i)
+        m_metrics.write_buckets[i] = 0;
+
+    m_receiver_sched.policy = SCHED_OTHER;
+    m_receiver_sched.priority = 0;
+
     memset(m_client_ip, 0, 4);
+    timerclear(&m_diseqc_ready);
+    timerclear(&m_tune_started);
+    setDiSEqCDelay(100);
 
     m_sock.open(0);
 
-    pthread_mutex_init(&m_stop_access, 0);
+    // wakes the receiver thread up when it has to stop or reopen the
+    // stream socket
+    m_wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
 }
 
 //////////////////////////////////////////////////////////////////////////
 /// Destructor
 ///
-/// Stops the receiving thread and closes the socket.
+/// Stops the receiving thread and closes the sockets.
 //////////////////////////////////////////////////////////////////////////
 CTVSatStreamIn::~CTVSatStreamIn() {
-    pthread_mutex_lock(&m_stop_access);
-    m_stop_thread = 1;
+    stopReceiver();
+
+    m_stream_sock.close();
     m_sock.close();
-    pthread_mutex_unlock(&m_stop_access);
 
-    if (m_thread_started)
-        pthread_join(m_thread, 0);
+    if (m_wake_fd >= 0)
+        close(m_wake_fd);
+
+    delete m_ts_stats;
 }
 
 //////////////////////////////////////////////////////////////////////////
@@ -91,7 +288,9 @@ void CTVSatStreamIn::addPID(uint16_t pid) {
         return;
 
     if (m_del_pids.erase(pid) == 0) {
-        m_pids.insert(pid);
+        if (m_pids.insert(pid).second)
+            m_flight.record(SFlightEvent::eAddPID, m_state, 0, 0, pid);
+
         m_select_pids = 1;
     }
 }
@@ -102,8 +301,30 @@ void CTVSatStreamIn::addPID(uint16_t pid) {
 void CTVSatStreamIn::cleanUp() {
     LOG_DBG(m_verbose, "Resetting connection");
 
-    m_sock.close();
-    m_sock.open(0);
+    if (m_transport)
+        m_transport->reset();
+    else {
+        m_sock.close();
+        m_sock.open(0);
+        ++m_sock_gen;
+    }
+
+    // the switch may have been left anywhere
+    m_has_last_diseqc = 0;
+
+    // nothing sent on the old socket can be answered anymore
+    m_pending.clear();
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Forgets requests that have been waiting too long for a response
+//////////////////////////////////////////////////////////////////////////
+void CTVSatStreamIn::expirePendingRequests() {
+    timeval now;
+    getTime(&now);
+
+    while (!m_pending.empty() && (now.tv_sec - m_pending.front().sent.tv_sec > TVSAT_RESPONSE_TIMEOUT))
+        m_pending.pop_front();
 }
 
 //////////////////////////////////////////////////////////////////////////
@@ -119,7 +340,7 @@ void CTVSatStreamIn::delPID(uint16_t pid) {
 
     if (m_pids.find(pid) != m_pids.end()) {
         timeval tv;
-        gettimeofday(&tv, 0);
+        getTime(&tv);
         tv.tv_sec += 10;
         m_del_pids[pid] = tv;
     }
@@ -134,12 +355,13 @@ void CTVSatStreamIn::delPIDs() {
         return;
 
     timeval t;
-    gettimeofday(&t, 0);
+    getTime(&t);
 
     std::map<uint16_t, timeval>::iterator it = m_del_pids.begin();
 
     while (it != m_del_pids.end()) {
         if (tvlt(&it->second, &t)) {
+            m_flight.record(SFlightEvent::eDelPID, m_state, 0, 0, it->first);
             m_pids.erase(it->first);
             m_del_pids.erase(it);
             m_select_pids = 1;
@@ -149,13 +371,219 @@ void CTVSatStreamIn::delPIDs() {
     }
 }
 
+//////////////////////////////////////////////////////////////////////////
+/// Receives all packets that are waiting in the stream socket's buffer
+///
+/// Called by the receiver thread or, if the stream socket is watched by a
+/// reactor, by the reactor thread. The number of packets per call is
+/// limited, so a single busy device can't starve the other devices of the
+/// same reactor.
+//////////////////////////////////////////////////////////////////////////
+void CTVSatStreamIn::drainStreamData() {
+    char rbuf[IP_MAXPACKET];
+
+    for (int i = 0; i < 64; ++i) {
+        int rbytes = m_stream_sock.tryReceive((unsigned char *) rbuf, IP_MAXPACKET);
+
+        if (rbytes <= 0)
+            break;
+
+        if (m_ts_stats)
+            m_ts_stats->account((const uint8_t *) rbuf, rbytes);
+
+        timespec t1, t2;
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        write(m_input_dev, rbuf, rbytes);
+        clock_gettime(CLOCK_MONOTONIC, &t2);
+
+        uint64_t ns = (t2.tv_sec - t1.tv_sec) * 1000000000ULL + t2.tv_nsec - t1.tv_nsec;
+        int bucket = 0;
+
+        while ((bucket < TVSAT_METRICS_WRITE_BUCKETS) && (ns > metrics_write_buckets[bucket]))
+            ++bucket;
+
+        // only this thread writes these counters, so a load and a store
+        // are enough and cheaper than an atomic increment
+        m_metrics.write_buckets[bucket].store(m_metrics.write_buckets[bucket].load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        m_metrics.write_ns.store(m_metrics.write_ns.load(std::memory_order_relaxed) + ns, std::memory_order_relaxed);
+        m_metrics.bytes.store(m_metrics.bytes.load(std::memory_order_relaxed) + rbytes, std::memory_order_relaxed);
+        m_metrics.datagrams.store(m_metrics.datagrams.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Hands a copy of the flight recorder to a thread that writes it to a
+/// file
+///
+/// The file is named after the device and replaced by every dump, so
+/// repeated error resets don't fill the disk. The ring holds enough
+/// events to cover the previous reset as well. Copying the ring is all
+/// that happens on the calling thread, which may be a reactor serving
+/// other devices.
+///
+/// @param reason why the recorder is dumped, for the file header
+//////////////////////////////////////////////////////////////////////////
+void CTVSatStreamIn::dumpFlightRecorder(const char *reason) const {
+    SFlightDump *dump = new SFlightDump;
+    dump->flight = m_flight;
+    dump->ip = m_tvsat_ip;
+    dump->path = m_flight_dir + "/flight-" + m_tvsat_ip + ".log";
+    dump->reason = reason;
+
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    dump->time = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    dump->wall = time(0);
+
+    // the writer must not compete with real-time receivers and reactors
+    pthread_attr_t attr;
+    sched_param param;
+    memset(&param, 0, sizeof(sched_param));
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+    pthread_attr_setschedpolicy(&attr, SCHED_OTHER);
+    pthread_attr_setschedparam(&attr, &param);
+
+    pthread_t thread;
+
+    if (pthread_create(&thread, &attr, writeFlightDump, dump) != 0) {
+        logErr("Failed to dump flight recorder of %s", m_tvsat_ip);
+        delete dump;
+    }
+
+    pthread_attr_destroy(&attr);
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Turns the continuity and loss accounting of the stream on or off
+///
+/// Must be called before the stream is received, i.e. before
+/// startReceiver() or registering the stream socket with a reactor.
+//////////////////////////////////////////////////////////////////////////
+void CTVSatStreamIn::enableTSStats(bool enable) {
+    if (enable && !m_ts_stats)
+        m_ts_stats = new CTSStats();
+    else if (!enable && m_ts_stats) {
+        delete m_ts_stats;
+        m_ts_stats = 0;
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Gets the name of a command for the retry counters
+/// @param index an index of SStreamInMetrics::retries
+//////////////////////////////////////////////////////////////////////////
+const char *CTVSatStreamIn::getCommandName(int index) {
+    if ((index < 0) || (index >= TVSAT_METRICS_COMMANDS))
+        return 0;
+
+    return metrics_commands[index].name;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Gets the name of a state of the state machine
+/// @param state a state_t
+//////////////////////////////////////////////////////////////////////////
+const char *CTVSatStreamIn::getStateName(int state) {
+    static const char *names[] = {
+        "connected", "disconnected", "diseqc", "error",
+        "sent_connect", "sent_disconnect", "sent_diseqc_burst",
+        "sent_diseqc_command", "sent_keepalive", "sent_prepare_tone",
+        "sent_reset_filter", "sent_set_filter", "sent_set_frontend",
+        "sent_set_tone", "sent_set_voltage", "sent_start", "sent_stop",
+        "tuning"
+    };
+
+    if ((state < 0) || (state > eTuning))
+        return "unknown";
+
+    return names[state];
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Gets the upper bound of a write latency bucket
+/// @param index an index of SStreamInMetrics::write_buckets
+/// @return the upper bound in ns (0: no bound)
+//////////////////////////////////////////////////////////////////////////
+uint64_t CTVSatStreamIn::getWriteBucket(int index) {
+    if ((index < 0) || (index >= TVSAT_METRICS_WRITE_BUCKETS))
+        return 0;
+
+    return metrics_write_buckets[index];
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Gets the current time from the clock or from the system
+//////////////////////////////////////////////////////////////////////////
+void CTVSatStreamIn::getTime(timeval *tv) const {
+    if (m_clock)
+        m_clock->getTime(tv);
+    else
+        gettimeofday(tv, 0);
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Checks if the state machine is waiting for a response to a request
+///
+/// The tuning state is excluded, because the number of ticks it takes
+/// determines how long we wait for a signal lock.
+//////////////////////////////////////////////////////////////////////////
+bool CTVSatStreamIn::isAwaitingResponse() const {
+    switch (m_state) {
+        case eSentConnectRequest:
+        case eSentDisconnectRequest:
+        case eSentDiseqcSendBurstRequest:
+        case eSentDiseqcSendMasterCommandRequest:
+        case eSentKeepaliveRequest:
+        case eSentPrepareToneRequest:
+        case eSentResetFilterRequest:
+        case eSentSetFilterRequest:
+        case eSentSetFrontendRequest:
+        case eSentSetToneRequest:
+        case eSentSetVoltageRequest:
+        case eSentStartRequest:
+        case eSentStopRequest:
+            return true;
+        default:
+            return false;
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Finds the request a response belongs to
+///
+/// The NAT device answers requests in the order they were sent, so the
+/// response belongs to the oldest pending request with the same command.
+/// Any request before that one has been lost.
+///
+/// @param cmd the command of the response
+/// @return true, if the response belongs to a request of the current tune
+/// @return false, if it is stale or unsolicited
+//////////////////////////////////////////////////////////////////////////
+bool CTVSatStreamIn::matchPendingRequest(uint16_t cmd) {
+    expirePendingRequests();
+
+    for (std::deque<SPendingRequest>::iterator it = m_pending.begin(); it != m_pending.end(); ++it) {
+        if (it->cmd != cmd)
+            continue;
+
+        unsigned int gen = it->gen;
+        m_pending.erase(m_pending.begin(), it + 1);
+
+        return gen == m_tune_gen;
+    }
+
+    return false;
+}
+
 //////////////////////////////////////////////////////////////////////////
 /// Tries to receive a response to a connect request
 ///
 /// @return -1, if there was no response
 /// @return  0, otherwise
 //////////////////////////////////////////////////////////////////////////
-int CTVSatStreamIn::receiveConnectResponse() const {
+int CTVSatStreamIn::receiveConnectResponse() {
     if (receiveResponse(cCmdConnect) != 0)
         return -1;
 
@@ -170,7 +598,7 @@ int CTVSatStreamIn::receiveConnectResponse() const {
 /// @return -1, if there was no response
 /// @return  0, otherwise
 //////////////////////////////////////////////////////////////////////////
-int CTVSatStreamIn::receiveDisconnectResponse() const {
+int CTVSatStreamIn::receiveDisconnectResponse() {
     if (receiveResponse(cCmdDisconnect) != 0)
         return -1;
 
@@ -185,7 +613,7 @@ int CTVSatStreamIn::receiveDisconnectResponse() const {
 /// @return -1, if there was no response
 /// @return  0, otherwise
 //////////////////////////////////////////////////////////////////////////
-int CTVSatStreamIn::receiveDiseqcSendBurstResponse() const {
+int CTVSatStreamIn::receiveDiseqcSendBurstResponse() {
     if (receiveResponse(cCmdFeDiseqcSendBurst) != 0)
         return -1;
 
@@ -200,7 +628,7 @@ int CTVSatStreamIn::receiveDiseqcSendBurstResponse() const {
 /// @return -1, if there was no response
 /// @return  0, otherwise
 //////////////////////////////////////////////////////////////////////////
-int CTVSatStreamIn::receiveDiseqcSendMasterCommandResponse() const {
+int CTVSatStreamIn::receiveDiseqcSendMasterCommandResponse() {
     if (receiveResponse(cCmdFeDiseqcSendMasterCommand) != 0)
         return -1;
 
@@ -216,7 +644,7 @@ int CTVSatStreamIn::receiveDiseqcSendMasterCommandResponse() const {
 /// @return  1, if there was a response, but no lock
 /// @return  0, otherwise
 //////////////////////////////////////////////////////////////////////////
-int CTVSatStreamIn::receiveKeepaliveResponse() const {
+int CTVSatStreamIn::receiveKeepaliveResponse() {
     int ret = receiveResponse(cCmdFeReadStatus);
 
     if (ret < 0)
@@ -231,7 +659,7 @@ int CTVSatStreamIn::receiveKeepaliveResponse() const {
 /// @return -1, if there was no response
 /// @return  0, otherwise
 //////////////////////////////////////////////////////////////////////////
-int CTVSatStreamIn::receivePrepareToneResponse() const {
+int CTVSatStreamIn::receivePrepareToneResponse() {
     if (receiveResponse(cCmdFeSetTone) != 0)
         return -1;
 
@@ -246,7 +674,7 @@ int CTVSatStreamIn::receivePrepareToneResponse() const {
 /// @return -1, if there was no response
 /// @return  0, otherwise
 //////////////////////////////////////////////////////////////////////////
-int CTVSatStreamIn::receiveResetFilterResponse() const {
+int CTVSatStreamIn::receiveResetFilterResponse() {
     if (receiveResponse(cCmdTseStart2) != 0)
         return -1;
 
@@ -268,28 +696,49 @@ int CTVSatStreamIn::receiveResetFilterResponse() const {
 /// @return  1, if the command was cCmdFeReadStatus and there was no
 ///             signal lock
 //////////////////////////////////////////////////////////////////////////
-int CTVSatStreamIn::receiveResponse(uint16_t cmd) const {
+int CTVSatStreamIn::receiveResponse(uint16_t cmd) {
     uint8_t buf[IP_MAXPACKET];
-    int rbytes = m_sock.receive(buf, IP_MAXPACKET, false);
+    ResponseHeader *rh = (ResponseHeader *) buf;
 
-    if (rbytes < 6)
-        return -1;
+    // responses to a sequence that was aborted by a new tune may still
+    // be on their way, so skip them instead of taking them for ours
+    while (1) {
+        int rbytes = m_transport ? m_transport->receive(buf, IP_MAXPACKET) : m_sock.receive(buf, IP_MAXPACKET, false);
 
-    ResponseHeader *rh = (ResponseHeader *) buf;
+        if (rbytes < 6) {
+            int i = 0;
+
+            while ((i < TVSAT_METRICS_COMMANDS - 1) && (metrics_commands[i].cmd != cmd))
+                ++i;
 
-    // check for truncated packets
-    if (rbytes < ntohs(rh->mSize)) {
-        logErr("Received truncated packet");
-        return -2;
+            m_metrics.retries[i].fetch_add(1, std::memory_order_relaxed);
+            m_flight.record(SFlightEvent::eRetry, m_state, cmd);
+            return -1;
+        }
+
+        // check for truncated packets
+        if (rbytes < ntohs(rh->mSize)) {
+            logErr("Received truncated packet");
+            return -2;
+        }
+
+        if (matchPendingRequest(ntohs(rh->mCommand)))
+            break;
+
+        m_flight.record(SFlightEvent::eStale, m_state, ntohs(rh->mCommand), ntohs(rh->mResult));
+        LOG_DBG(m_verbose, "Discarded stale response to command 0x%x", ntohs(rh->mCommand));
     }
 
     if (ntohs(rh->mCommand) == cCmdFeReadStatus) {
         ResponseFeReadStatus *rfrs = (ResponseFeReadStatus *) rh;
         uint16_t status = ntohs(rfrs->mData);
 
+        m_flight.record(SFlightEvent::eReceived, m_state, cCmdFeReadStatus, ntohs(rh->mResult), status);
+
         if (status != 0)
             LOG_DBG(m_verbose, "Current Status: %x", status);
-    }
+    } else
+        m_flight.record(SFlightEvent::eReceived, m_state, ntohs(rh->mCommand), ntohs(rh->mResult));
 
     // check if this is a response to the requested command
     if (ntohs(rh->mCommand) != cmd) {
@@ -323,7 +772,7 @@ int CTVSatStreamIn::receiveResponse(uint16_t cmd) const {
 /// @return -1, if there was no response
 /// @return  0, otherwise
 //////////////////////////////////////////////////////////////////////////
-int CTVSatStreamIn::receiveSetFilterResponse() const {
+int CTVSatStreamIn::receiveSetFilterResponse() {
     if (receiveResponse(cCmdTseStart2) != 0)
         return -1;
 
@@ -338,7 +787,7 @@ int CTVSatStreamIn::receiveSetFilterResponse() const {
 /// @return -1, if there was no response
 /// @return  0, otherwise
 //////////////////////////////////////////////////////////////////////////
-int CTVSatStreamIn::receiveSetFrontendResponse() const {
+int CTVSatStreamIn::receiveSetFrontendResponse() {
     if (receiveResponse(cCmdFeSetFrontend) != 0)
         return -1;
 
@@ -353,7 +802,7 @@ int CTVSatStreamIn::receiveSetFrontendResponse() const {
 /// @return -1, if there was no response
 /// @return  0, otherwise
 //////////////////////////////////////////////////////////////////////////
-int CTVSatStreamIn::receiveSetToneResponse() const {
+int CTVSatStreamIn::receiveSetToneResponse() {
     if (receiveResponse(cCmdFeSetTone) != 0)
         return -1;
 
@@ -368,7 +817,7 @@ int CTVSatStreamIn::receiveSetToneResponse() const {
 /// @return -1, if there was no response
 /// @return  0, otherwise
 //////////////////////////////////////////////////////////////////////////
-int CTVSatStreamIn::receiveSetVoltageResponse() const {
+int CTVSatStreamIn::receiveSetVoltageResponse() {
     if (receiveResponse(cCmdFeSetVoltage) != 0)
         return -1;
 
@@ -383,7 +832,7 @@ int CTVSatStreamIn::receiveSetVoltageResponse() const {
 /// @return -1, if there was no response
 /// @return  0, otherwise
 //////////////////////////////////////////////////////////////////////////
-int CTVSatStreamIn::receiveStartResponse() const {
+int CTVSatStreamIn::receiveStartResponse() {
     if (receiveResponse(cCmdStart) != 0)
         return -1;
 
@@ -398,7 +847,7 @@ int CTVSatStreamIn::receiveStartResponse() const {
 /// @return -1, if there was no response
 /// @return  0, otherwise
 //////////////////////////////////////////////////////////////////////////
-int CTVSatStreamIn::receiveStopResponse() const {
+int CTVSatStreamIn::receiveStopResponse() {
     if (receiveResponse(cCmdStop) != 0)
         return -1;
 
@@ -407,32 +856,46 @@ int CTVSatStreamIn::receiveStopResponse() const {
     return 0;
 }
 
-//////////////////////////////////////////////////////////////////////////
-/// Tries to receive all packets from the stream socket's buffer
-//////////////////////////////////////////////////////////////////////////
-void CTVSatStreamIn::receiveStreamData() {
-    char rbuf[IP_MAXPACKET];
-    int rbytes = m_stream_sock.receive((unsigned char *) rbuf, IP_MAXPACKET, false);
-
-    if (rbytes > 0)
-        write(m_input_dev, rbuf, rbytes);
-}
-
 //////////////////////////////////////////////////////////////////////////
 /// Main loop of the receiver thread
+///
+/// Waits for stream data and for the wakeup eventfd at the same time, so
+/// a stop or reconfiguration request is handled immediately and the
+/// packet path doesn't need to take any lock.
 //////////////////////////////////////////////////////////////////////////
 void CTVSatStreamIn::receiverLoop() {
-    while (1) {
-        receiveStreamData();
+    pollfd fds[2];
+    fds[1].fd = m_wake_fd;
+    fds[1].events = POLLIN;
+
+    while (!m_stop_thread) {
+        fds[0].fd = m_stream_sock.getFD();
+        fds[0].events = POLLIN;
+        fds[0].revents = 0;
+        fds[1].revents = 0;
 
-        pthread_mutex_lock(&m_stop_access);
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR)
+                continue;
 
-        if (m_stop_thread) {
-            pthread_mutex_unlock(&m_stop_access);
+            logErr("Receiver thread of %s: poll() failed", m_tvsat_ip);
             return;
         }
 
-        pthread_mutex_unlock(&m_stop_access);
+        if (fds[1].revents & POLLIN) {
+            uint64_t count;
+
+            if (read(m_wake_fd, &count, sizeof(count)) < 0)
+                logErr("Receiver thread of %s: failed to read wakeup event", m_tvsat_ip);
+
+            if (m_reopen_stream_sock.exchange(0))
+                m_stream_sock.open(m_client_port);
+
+            continue;
+        }
+
+        if (fds[0].revents & POLLIN)
+            drainStreamData();
     }
 }
 
@@ -442,7 +905,7 @@ void CTVSatStreamIn::receiverLoop() {
 /// @return -1, if the request failed
 /// @return  0, otherwise
 //////////////////////////////////////////////////////////////////////////
-int CTVSatStreamIn::sendConnectRequest() const {
+int CTVSatStreamIn::sendConnectRequest() {
     if (m_client_ip[0] == 0)
         return -1;
 
@@ -466,7 +929,7 @@ int CTVSatStreamIn::sendConnectRequest() const {
 /// @return -1, if the request failed
 /// @return  0, otherwise
 //////////////////////////////////////////////////////////////////////////
-int CTVSatStreamIn::sendDisconnectRequest() const {
+int CTVSatStreamIn::sendDisconnectRequest() {
     if (m_client_ip[0] == 0)
         return -1;
 
@@ -488,7 +951,7 @@ int CTVSatStreamIn::sendDisconnectRequest() const {
 /// @return -1, if the request failed
 /// @return  0, otherwise
 //////////////////////////////////////////////////////////////////////////
-int CTVSatStreamIn::sendDiseqcSendBurstRequest() const {
+int CTVSatStreamIn::sendDiseqcSendBurstRequest() {
     if (!m_tune)
         return -1;
 
@@ -511,7 +974,7 @@ int CTVSatStreamIn::sendDiseqcSendBurstRequest() const {
 /// @return -1, if the request failed
 /// @return  0, otherwise
 //////////////////////////////////////////////////////////////////////////
-int CTVSatStreamIn::sendDiseqcSendMasterCommandRequest() const {
+int CTVSatStreamIn::sendDiseqcSendMasterCommandRequest() {
     if (!m_tune)
         return -1;
 
@@ -538,7 +1001,7 @@ int CTVSatStreamIn::sendDiseqcSendMasterCommandRequest() const {
 /// @return -1, if the request failed
 /// @return  0, otherwise
 //////////////////////////////////////////////////////////////////////////
-int CTVSatStreamIn::sendKeepaliveRequest() const {
+int CTVSatStreamIn::sendKeepaliveRequest() {
     RequestFeReadStatus rfrs;
     rfrs.mHeader.mCommand = htons(cCmdFeReadStatus);
     rfrs.mHeader.mSize = htons(sizeof(RequestFeReadStatus));
@@ -557,7 +1020,7 @@ int CTVSatStreamIn::sendKeepaliveRequest() const {
 /// @return -1, if the request failed
 /// @return  0, otherwise
 //////////////////////////////////////////////////////////////////////////
-int CTVSatStreamIn::sendPrepareToneRequest() const {
+int CTVSatStreamIn::sendPrepareToneRequest() {
     if (!m_tune) {
         logErr("Tuning parameters missing");
         return -1;
@@ -584,13 +1047,31 @@ int CTVSatStreamIn::sendPrepareToneRequest() const {
 /// @return -1, if the request failed
 /// @return  0, otherwise
 //////////////////////////////////////////////////////////////////////////
-int CTVSatStreamIn::sendRequest(const RequestHeader *packet) const {
+int CTVSatStreamIn::sendRequest(const RequestHeader *packet) {
     if (!m_tvsat_ip)
         return -1;
 
-    if (!m_sock.send((const uint8_t *) packet, ntohs(packet->mSize), m_tvsat_ip, 11111))
+    bool sent;
+
+    if (m_transport)
+        sent = m_transport->send((const uint8_t *) packet, ntohs(packet->mSize));
+    else
+        sent = m_sock.send((const uint8_t *) packet, ntohs(packet->mSize), m_tvsat_ip, 11111);
+
+    // a result of 0xffff marks a request that couldn't be sent
+    m_flight.record(SFlightEvent::eSent, m_state, ntohs(packet->mCommand), sent ? 0 : 0xffff);
+
+    if (!sent)
         return -1;
 
+    expirePendingRequests();
+
+    SPendingRequest req;
+    req.cmd = ntohs(packet->mCommand);
+    req.gen = m_tune_gen;
+    getTime(&req.sent);
+    m_pending.push_back(req);
+
     return 0;
 }
 
@@ -651,11 +1132,28 @@ int CTVSatStreamIn::sendSetFilterRequest(uint16_t *pids, uint16_t num_pids) {
     rts.mFilterMode = htons(0x8001);
     rts.mNumPids = htons((num_pids <= 168) ? num_pids : 168);
 
-    for (int i = 0; (i < num_pids) && (i < 168); ++i) {
-        LOG_DBG(m_verbose, "Select PID %u", pids[i]);
+    // PIDs that come back after a while continue with any counter
+    if (m_ts_stats)
+        m_ts_stats->resync();
+
+    for (int i = 0; (i < num_pids) && (i < 168); ++i)
         rts.mPids[i] = htons(pids[i]);
+
+    // one line per update instead of one per PID
+    if (m_verbose) {
+        char buf[200];
+        int len = snprintf(buf, sizeof(buf), "Select %u PIDs:", num_pids);
+
+        for (int i = 0; (i < num_pids) && (i < 168) && (len < (int) sizeof(buf) - 8); ++i)
+            len += snprintf(buf + len, sizeof(buf) - len, " %u", pids[i]);
+
+        logDbg("%s", buf);
     }
 
+    m_flight.record(SFlightEvent::eFilter, m_state, 0, 0, num_pids);
+    m_metrics.filter_updates.fetch_add(1, std::memory_order_relaxed);
+    m_metrics.pids.store((num_pids <= 168) ? num_pids : 168, std::memory_order_relaxed);
+
     if (sendRequest((RequestHeader *) &rts) != 0) {
         logErr("Set filter request failed");
         return -1;
@@ -713,7 +1211,7 @@ int CTVSatStreamIn::sendSetFrontendRequest() {
 /// @return -1, if the request failed
 /// @return  0, otherwise
 //////////////////////////////////////////////////////////////////////////
-int CTVSatStreamIn::sendSetToneRequest() const {
+int CTVSatStreamIn::sendSetToneRequest() {
     if (!m_tune) {
         logErr("Tuning parameters missing");
         return -1;
@@ -738,7 +1236,7 @@ int CTVSatStreamIn::sendSetToneRequest() const {
 /// @return -1, if the request failed
 /// @return  0, otherwise
 //////////////////////////////////////////////////////////////////////////
-int CTVSatStreamIn::sendSetVoltageRequest() const {
+int CTVSatStreamIn::sendSetVoltageRequest() {
     if (!m_tune) {
         logErr("Tuning parameters missing");
         return -1;
@@ -791,7 +1289,7 @@ int CTVSatStreamIn::sendStartRequest() {
 /// @return -1, if the request failed
 /// @return  0, otherwise
 //////////////////////////////////////////////////////////////////////////
-int CTVSatStreamIn::sendStopRequest() const {
+int CTVSatStreamIn::sendStopRequest() {
     RequestStop rs;
     rs.mHeader.mCommand = htons(cCmdStop);
     rs.mHeader.mSize = htons(sizeof(RequestStop));
@@ -804,6 +1302,148 @@ int CTVSatStreamIn::sendStopRequest() const {
     return 0;
 }
 
+//////////////////////////////////////////////////////////////////////////
+/// Gives up the sockets, so they can be passed on to another process
+///
+/// The receiver thread must not be running anymore.
+//////////////////////////////////////////////////////////////////////////
+void CTVSatStreamIn::detachSockets(int &sock_fd, int &stream_fd) {
+    sock_fd = m_sock.detach();
+    stream_fd = m_stream_sock.detach();
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Continues where another process left off
+///
+/// Takes over the sockets of the other process and the state it saved
+/// with saveState(), so the device doesn't notice the change. A device
+/// that was in the middle of a request sequence is tuned again.
+///
+/// @param state the saved state
+/// @param sock_fd the control socket
+/// @param stream_fd the stream socket
+//////////////////////////////////////////////////////////////////////////
+void CTVSatStreamIn::restoreState(const SStreamInState &state, int sock_fd, int stream_fd) {
+    if (sock_fd >= 0) {
+        m_sock.attach(sock_fd);
+        ++m_sock_gen;
+    }
+
+    m_client_port = state.client_port;
+    m_stream_sock.attach(stream_fd);
+
+    if (state.has_tune)
+        setTuningParameters(&state.tune);
+
+    timeval tv;
+    getTime(&tv);
+    tv.tv_sec += 10;
+
+    m_pids.clear();
+    m_del_pids.clear();
+
+    for (uint16_t pid = 0; pid < 0x2000; ++pid) {
+        if (state.pids[pid / 8] & (1 << (pid % 8)))
+            m_pids.insert(pid);
+
+        if (state.del_pids[pid / 8] & (1 << (pid % 8)))
+            m_del_pids[pid] = tv;
+    }
+
+    m_do_connect = state.do_connect;
+    m_is_tuned = 0;
+    m_wait = 0;
+
+    switch (state.state) {
+        case SStreamInState::eConnected:
+            m_is_tuned = state.is_tuned;
+            m_state = eConnected;
+            break;
+
+        case SStreamInState::eRetune:
+            m_do_tune = (m_tune != 0);
+            m_state = eConnected;
+            break;
+
+        default:
+            m_state = eDisconnected;
+            break;
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Compares two DiSEqC sequences
+///
+/// Only the members that are used by the respective command type are
+/// compared.
+//////////////////////////////////////////////////////////////////////////
+bool CTVSatStreamIn::sameDiSEqC(const tvsat_diseqc_parameters *cmds1, const tvsat_diseqc_parameters *cmds2) {
+    for (int i = 0; i < TVSAT_MAX_DISEQC_CMDS; ++i) {
+        const tvsat_diseqc_parameters &cmd1 = cmds1[i];
+        const tvsat_diseqc_parameters &cmd2 = cmds2[i];
+
+        if (cmd1.type != cmd2.type)
+            return false;
+
+        if ((cmd1.type == 1) &&
+            ((cmd1.message_len != cmd2.message_len) ||
+             (memcmp(cmd1.message, cmd2.message, 6) != 0)))
+            return false;
+
+        if ((cmd1.type == 2) && (cmd1.burst_data != cmd2.burst_data))
+            return false;
+
+        // the rest of the sequence isn't sent
+        if (cmd1.type == 0)
+            break;
+    }
+
+    return true;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Saves the state that another process needs to take over the device
+///
+/// The state machine must not be running anymore.
+//////////////////////////////////////////////////////////////////////////
+void CTVSatStreamIn::saveState(SStreamInState &state) const {
+    memset(&state, 0, sizeof(SStreamInState));
+
+    state.client_port = m_client_port;
+    state.do_connect = m_do_connect;
+    state.has_tune = (m_tune != 0);
+    state.is_tuned = m_is_tuned;
+
+    if (m_tune)
+        state.tune = *m_tune;
+
+    for (std::set<uint16_t>::const_iterator it = m_pids.begin(); it != m_pids.end(); ++it)
+        state.pids[*it / 8] |= 1 << (*it % 8);
+
+    for (std::map<uint16_t, timeval>::const_iterator it = m_del_pids.begin(); it != m_del_pids.end(); ++it)
+        state.del_pids[it->first / 8] |= 1 << (it->first % 8);
+
+    // requests that are in flight are lost, so only a device that is
+    // idle can simply be carried on with
+    switch (m_state) {
+        case eConnected:
+        case eSentKeepaliveRequest:
+            state.state = (m_do_tune || m_select_pids) ? SStreamInState::eRetune : SStreamInState::eConnected;
+            break;
+
+        case eDisconnected:
+        case eError:
+        case eSentConnectRequest:
+        case eSentDisconnectRequest:
+            state.state = SStreamInState::eDisconnected;
+            break;
+
+        default:
+            state.state = SStreamInState::eRetune;
+            break;
+    }
+}
+
 //////////////////////////////////////////////////////////////////////////
 /// Sets the IP address of the client
 //////////////////////////////////////////////////////////////////////////
@@ -814,6 +1454,42 @@ void CTVSatStreamIn::setClientIP(const uint8_t *ip) {
     memcpy(m_client_ip, ip, 4);
 }
 
+//////////////////////////////////////////////////////////////////////////
+/// Sets the UDP port of the client
+///
+/// If the receiver thread is already running, the stream socket is
+/// reopened by the receiver thread itself, so it is never closed while
+/// the thread is waiting for it.
+//////////////////////////////////////////////////////////////////////////
+void CTVSatStreamIn::setClientPort(uint16_t port) {
+    m_client_port = port;
+
+    if (m_thread_started) {
+        m_reopen_stream_sock = 1;
+        signalReceiver();
+    } else
+        m_stream_sock.open(port);
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Sets the time the switch gets to process a DiSEqC command
+/// @param ms the delay in milliseconds
+//////////////////////////////////////////////////////////////////////////
+void CTVSatStreamIn::setDiSEqCDelay(int ms) {
+    m_diseqc_delay = ms;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Gives the switch the DiSEqC delay to process a command
+//////////////////////////////////////////////////////////////////////////
+void CTVSatStreamIn::startDiSEqCDelay() {
+    int ms = m_diseqc_delay;
+    timeval now, delay = {ms / 1000, (ms % 1000) * 1000};
+
+    getTime(&now);
+    timeradd(&now, &delay, &m_diseqc_ready);
+}
+
 //////////////////////////////////////////////////////////////////////////
 /// Sets the IP address of the NAT device
 //////////////////////////////////////////////////////////////////////////
@@ -839,6 +1515,16 @@ void CTVSatStreamIn::setTuningParameters(const tvsat_tuning_parameters *tune) {
     m_tune = new tvsat_tuning_parameters(*tune);
 }
 
+//////////////////////////////////////////////////////////////////////////
+/// Wakes the receiver thread up
+//////////////////////////////////////////////////////////////////////////
+void CTVSatStreamIn::signalReceiver() {
+    uint64_t one = 1;
+
+    if (write(m_wake_fd, &one, sizeof(one)) != sizeof(one))
+        logErr("Failed to wake up receiver thread of %s", m_tvsat_ip);
+}
+
 //////////////////////////////////////////////////////////////////////////
 /// Restarts the state machine by setting its state to 'connected'
 //////////////////////////////////////////////////////////////////////////
@@ -846,6 +1532,16 @@ void CTVSatStreamIn::start() {
     if (!m_tune)
         return;
 
+    // cancel the sequence that may be running for the previous tune
+    ++m_tune_gen;
+
+    if (m_ts_stats)
+        m_ts_stats->resync();
+
+    // the zap time is measured until the signal lock
+    getTime(&m_tune_started);
+    m_flight.record(SFlightEvent::eTune, m_state, 0, 0, m_tune->frequency);
+
     m_do_tune = 1;
     m_stop = 0;
 
@@ -859,8 +1555,36 @@ void CTVSatStreamIn::start() {
 /// Starts the receiver thread
 //////////////////////////////////////////////////////////////////////////
 void CTVSatStreamIn::startReceiver() {
-    pthread_create(&m_thread, 0, startThread, (void *) this);
+    if (m_wake_fd < 0) {
+        logErr("Failed to create wakeup eventfd for receiver thread");
+        return;
+    }
+
+    if (pthread_create(&m_thread, 0, startThread, (void *) this) != 0) {
+        logErr("Failed to start receiver thread");
+        return;
+    }
+
     m_thread_started = 1;
+
+    char name[64];
+    snprintf(name, sizeof(name), "Receiver thread of %s", m_tvsat_ip);
+    setThreadScheduling(m_thread, m_receiver_sched, name);
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Stops the receiver thread and waits for it to terminate
+//////////////////////////////////////////////////////////////////////////
+void CTVSatStreamIn::stopReceiver() {
+    if (!m_thread_started)
+        return;
+
+    m_stop_thread = 1;
+    signalReceiver();
+    pthread_join(m_thread, 0);
+
+    m_thread_started = 0;
+    m_stop_thread = 0;
 }
 
 //////////////////////////////////////////////////////////////////////////
@@ -877,6 +1601,7 @@ void *CTVSatStreamIn::startThread(void *sin) {
 /// device to stop
 //////////////////////////////////////////////////////////////////////////
 void CTVSatStreamIn::stop() {
+    ++m_tune_gen;
     m_do_tune = 0;
     m_stop = 1;
 
@@ -895,8 +1620,12 @@ void CTVSatStreamIn::stop() {
 /// Makes a transition from one state to another
 //////////////////////////////////////////////////////////////////////////
 void CTVSatStreamIn::tick() {
+    timeval tv;
     int rv;
 
+    if (m_flight_dump.exchange(0) && !m_flight_dir.empty())
+        dumpFlightRecorder("request");
+
     switch (m_state) {
         case eConnected:
             if (!m_do_connect) {
@@ -952,6 +1681,9 @@ void CTVSatStreamIn::tick() {
             if (!m_do_connect)
                 break;
 
+            // the LNB may have lost power while we were disconnected
+            m_has_last_diseqc = 0;
+
             if (sendConnectRequest() == 0) {
                 m_state = eSentConnectRequest;
                 m_retry = 10;
@@ -962,7 +1694,20 @@ void CTVSatStreamIn::tick() {
             break;
 
         case eDiSEqC:
+            // give the switch some time to process the previous command
+            // without blocking the thread
+            getTime(&tv);
+
+            if (tvlt(&tv, &m_diseqc_ready))
+                break;
+
             if (m_diseqc_cmd == TVSAT_MAX_DISEQC_CMDS) {
+                // the switch is where this tune wants it now
+                if (m_tune) {
+                    memcpy(m_last_diseqc, m_tune->diseqc, sizeof(m_last_diseqc));
+                    m_has_last_diseqc = 1;
+                }
+
                 if (sendSetToneRequest() == 0) {
                     m_state = eSentSetToneRequest;
                     m_retry = 10;
@@ -1011,8 +1756,24 @@ void CTVSatStreamIn::tick() {
             break;
 
         case eError:
+            m_flight.record(SFlightEvent::eReset, m_state);
             cleanUp();
+            m_metrics.resets.fetch_add(1, std::memory_order_relaxed);
             m_state = eDisconnected;
+
+            // a device that fails over and over again is only dumped
+            // every TVSAT_FLIGHT_DUMP_INTERVAL
+            if (!m_flight_dir.empty()) {
+                timeval now, elapsed;
+                getTime(&now);
+                timersub(&now, &m_flight_dump_time, &elapsed);
+
+                if (!timerisset(&m_flight_dump_time) || (elapsed.tv_sec >= TVSAT_FLIGHT_DUMP_INTERVAL)) {
+                    m_flight_dump_time = now;
+                    dumpFlightRecorder("error reset");
+                }
+            }
+
             break;
 
         case eSentConnectRequest:
@@ -1044,7 +1805,7 @@ void CTVSatStreamIn::tick() {
         case eSentDiseqcSendBurstRequest:
             if (receiveDiseqcSendBurstResponse() == 0) {
                 m_state = eDiSEqC;
-                CTVSatCtl::sleepMS(100);
+                startDiSEqCDelay();
                 break;
             }
 
@@ -1059,7 +1820,7 @@ void CTVSatStreamIn::tick() {
         case eSentDiseqcSendMasterCommandRequest:
             if (receiveDiseqcSendMasterCommandResponse() == 0) {
                 m_state = eDiSEqC;
-                CTVSatCtl::sleepMS(100);
+                startDiSEqCDelay();
                 break;
             }
 
@@ -1083,6 +1844,17 @@ void CTVSatStreamIn::tick() {
                 break;
             }
 
+            // the device may be gone, so let the manager check on it
+            logErr("Device at %s stopped answering keepalive requests", m_tvsat_ip);
+            ++m_keepalive_failures;
+
+            if (m_liveness_fd >= 0) {
+                uint64_t one = 1;
+
+                if (write(m_liveness_fd, &one, sizeof(one)) != sizeof(one))
+                    logErr("Failed to report keepalive failure of %s", m_tvsat_ip);
+            }
+
             m_state = eError;
             break;
 
@@ -1184,6 +1956,20 @@ void CTVSatStreamIn::tick() {
         case eSentSetVoltageRequest:
             if (receiveSetVoltageResponse() == 0) {
                 m_state = eDiSEqC;
+
+                // the switch is still in the right position, so go on
+                // with the tone right away
+                if (m_has_last_diseqc && m_tune && sameDiSEqC(m_tune->diseqc, m_last_diseqc)) {
+                    LOG_DBG(m_verbose, "DiSEqC sequence unchanged, skipping it");
+                    m_diseqc_cmd = TVSAT_MAX_DISEQC_CMDS;
+                    timerclear(&m_diseqc_ready);
+                    tick();
+                    break;
+                }
+
+                // until the sequence is complete, we don't know where the
+                // switch is
+                m_has_last_diseqc = 0;
                 m_diseqc_cmd = 0;
                 break;
             }
@@ -1237,6 +2023,7 @@ void CTVSatStreamIn::tick() {
 
                 m_state = eConnected;
                 m_wait = 100;
+                break;
             }
 
             if (m_retry) {
@@ -1261,6 +2048,15 @@ void CTVSatStreamIn::tick() {
                 m_is_tuned = 1;
                 m_select_pids = 1;
 
+                if (timerisset(&m_tune_started)) {
+                    getTime(&tv);
+                    uint64_t ms = (tv.tv_sec - m_tune_started.tv_sec) * 1000 + (tv.tv_usec - m_tune_started.tv_usec) / 1000;
+                    m_metrics.zaps.fetch_add(1, std::memory_order_relaxed);
+                    m_metrics.zap_ms.fetch_add(ms, std::memory_order_relaxed);
+                    m_metrics.zap_last_ms.store(ms, std::memory_order_relaxed);
+                    timerclear(&m_tune_started);
+                }
+
                 if (sendKeepaliveRequest() == 0) {
                     m_state = eSentKeepaliveRequest;
                     m_retry = 5;
@@ -1304,6 +2100,32 @@ void CTVSatStreamIn::tick() {
         default:
             break;
     }
+
+    updateMetrics();
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Publishes the state of the state machine for the metrics endpoint and
+/// records state transitions in the flight recorder
+//////////////////////////////////////////////////////////////////////////
+void CTVSatStreamIn::updateMetrics() {
+    if (m_state != m_flight_state) {
+        m_flight.record(SFlightEvent::eState, m_state, 0, 0, m_flight_state);
+        m_flight_state = m_state;
+    }
+
+    m_metrics.state.store(m_state, std::memory_order_relaxed);
+    m_metrics.is_tuned.store(m_is_tuned, std::memory_order_relaxed);
+
+    bool connected = (m_state != eDisconnected) && (m_state != eError) && (m_state != eSentConnectRequest);
+
+    if (!connected)
+        m_metrics.connected_since.store(0, std::memory_order_relaxed);
+    else if (m_metrics.connected_since.load(std::memory_order_relaxed) == 0) {
+        timeval tv;
+        gettimeofday(&tv, 0);
+        m_metrics.connected_since.store(tv.tv_sec, std::memory_order_relaxed);
+    }
 }
 
 //////////////////////////////////////////////////////////////////////////
@@ -30,6 +30,8 @@
 #ifndef __TVSAT_STREAMIN_H
 #define __TVSAT_STREAMIN_H
 
+#include <atomic>
+#include <deque>
 #include <map>
 #include <list>
 #include <pthread.h>
@@ -38,9 +40,21 @@
 #include <stdint.h>
 #include <sys/time.h>
 
+#include "config.h"
+#include "flightrec.h"
+#include "transport.h"
+#include "tsstats.h"
 #include "udpsocket.h"
 #include "../include/tvsat.h"
 
+//////////////////////////////////////////////////////////////////////////
+// DEFINITIONS
+//////////////////////////////////////////////////////////////////////////
+#define TVSAT_RESPONSE_TIMEOUT         2 // s
+#define TVSAT_FLIGHT_DUMP_INTERVAL    60 // s, between dumps on error resets
+#define TVSAT_METRICS_COMMANDS        12 // see CTVSatStreamIn::getCommandName()
+#define TVSAT_METRICS_WRITE_BUCKETS    6 // see CTVSatStreamIn::getWriteBucket()
+
 //////////////////////////////////////////////////////////////////////////
 // UDP PACKET STRUCTURES
 //////////////////////////////////////////////////////////////////////////
@@ -450,6 +464,63 @@ struct NvsUserData {
 }
     __attribute ((packed));
 
+//////////////////////////////////////////////////////////////////////////
+/// A request that has been sent to the NAT device, but not answered yet
+//////////////////////////////////////////////////////////////////////////
+struct SPendingRequest {
+    uint16_t cmd;
+    /// The tune generation the request belongs to
+    unsigned int gen;
+    timeval sent;
+};
+
+//////////////////////////////////////////////////////////////////////////
+/// State of a CTVSatStreamIn that is handed over to another process
+//////////////////////////////////////////////////////////////////////////
+struct SStreamInState {
+    enum {
+        eDisconnected,
+        eConnected,
+        eRetune
+    };
+
+    uint16_t client_port;
+    uint8_t del_pids[0x2000 / 8];
+    int32_t do_connect;
+    int32_t has_tune;
+    int32_t is_tuned;
+    uint8_t pids[0x2000 / 8];
+    int32_t state;
+    tvsat_tuning_parameters tune;
+};
+
+//////////////////////////////////////////////////////////////////////////
+/// Counters of a CTVSatStreamIn for the metrics endpoint
+///
+/// Written by the thread that ticks the state machine and by the thread
+/// that receives the stream, read by the main thread, so every field is
+/// an atomic that is accessed with relaxed ordering.
+//////////////////////////////////////////////////////////////////////////
+struct SStreamInMetrics {
+    std::atomic<uint64_t> bytes;
+    /// Time the connection was established (s since the epoch, 0: none)
+    std::atomic<int64_t> connected_since;
+    std::atomic<uint64_t> datagrams;
+    std::atomic<uint64_t> filter_updates;
+    std::atomic<int> is_tuned;
+    std::atomic<int> pids;
+    std::atomic<uint64_t> resets;
+    /// Ticks without a response, per command (see getCommandName())
+    std::atomic<uint64_t> retries[TVSAT_METRICS_COMMANDS];
+    std::atomic<int> state;
+    /// Writes to the input device, per latency bucket (not cumulative)
+    std::atomic<uint64_t> write_buckets[TVSAT_METRICS_WRITE_BUCKETS + 1];
+    std::atomic<uint64_t> write_ns;
+    std::atomic<uint64_t> zaps;
+    std::atomic<uint64_t> zap_last_ms;
+    std::atomic<uint64_t> zap_ms;
+};
+
 //////////////////////////////////////////////////////////////////////////
 /// dLAN TV Sat Device Control and Stream Input
 ///
@@ -491,26 +562,86 @@ public:
 
     void delPIDs();
 
+    void dumpFlightRecorder(const char *reason) const;
+
+    void detachSockets(int &sock_fd, int &stream_fd);
+
     void disconnect() { m_do_connect = 0; }
 
+    void drainStreamData();
+
+    void enableTSStats(bool enable);
+
+    static const char *getCommandName(int index);
+
+    static const char *getStateName(int state);
+
+    /// Gets the port the stream is received on
+    uint16_t getClientPort() const { return m_client_port; }
+
+    /// Gets the number of keepalive requests that went unanswered
+    int getKeepaliveFailures() const { return m_keepalive_failures; }
+
+    /// Gets the counters for the metrics endpoint
+    const SStreamInMetrics &getMetrics() const { return m_metrics; }
+
+    /// Gets the file descriptor of the control socket
+    int getSocketFD() const { return m_sock.getFD(); }
+
+    /// Gets a number that changes whenever the control socket is reopened
+    int getSocketGeneration() const { return m_sock_gen; }
+
+    /// Gets the file descriptor of the stream socket
+    int getStreamSocketFD() const { return m_stream_sock.getFD(); }
+
+    /// Gets the stream statistics (0, if they are disabled)
+    const CTSStats *getTSStats() const { return m_ts_stats; }
+
+    bool isAwaitingResponse() const;
+
+    /// True, if a DVB application uses the device
+    bool isConnectRequested() const { return m_do_connect; }
+
     /// True, if the NAT device is tuned and has a signal lock
     int isTuned() const { return m_is_tuned; }
 
+    /// Makes the state machine dump its flight recorder at the next tick
+    void requestFlightDump() { m_flight_dump = 1; }
+
     /// Gets the current state of the state machine
     state_t getState() const { return m_state; }
 
-    void receiveStreamData();
+    static uint64_t getWriteBucket(int index);
+
+    void restoreState(const SStreamInState &state, int sock_fd, int stream_fd);
+
+    static bool sameDiSEqC(const tvsat_diseqc_parameters *cmds1, const tvsat_diseqc_parameters *cmds2);
+
+    void saveState(SStreamInState &state) const;
 
     void setClientIP(const uint8_t *ip);
 
-    /// Sets the UDP port of the client
-    void setClientPort(uint16_t port) {
-        m_client_port = port;
-        m_stream_sock.open(m_client_port);
-    }
+    /// Replaces the system time, e.g. by virtual time (0: system time)
+    void setClock(CTVSatClock *clock) { m_clock = clock; }
+
+    void setClientPort(uint16_t port);
+
+    void setDiSEqCDelay(int ms);
+
+    /// Sets the directory the flight recorder is dumped to (empty: off)
+    void setFlightRecorderDir(const std::string &dir) { m_flight_dir = dir; }
 
     void setInputDev(int input_dev) { m_input_dev = input_dev; }
 
+    /// Sets an eventfd that is signalled when a keepalive request fails
+    void setLivenessFD(int fd) { m_liveness_fd = fd; }
+
+    /// Sets the CPU affinity and scheduling policy of the receiver thread
+    void setReceiverScheduling(const sched_config_t &sched) { m_receiver_sched = sched; }
+
+    /// Replaces the control socket, e.g. by a simulated device (0: socket)
+    void setTransport(CTVSatTransport *transport) { m_transport = transport; }
+
     void setTVSatIP(const uint8_t *ip);
 
     void setTuningParameters(const tvsat_tuning_parameters *tune);
@@ -521,54 +652,66 @@ public:
 
     void stop();
 
+    void stopReceiver();
+
     void tick();
 
 private:
     void cleanUp();
 
-    int receiveConnectResponse() const;
+    void expirePendingRequests();
 
-    int receiveDisconnectResponse() const;
+    void getTime(timeval *tv) const;
 
-    int receiveDiseqcSendBurstResponse() const;
+    void updateMetrics();
 
-    int receiveDiseqcSendMasterCommandResponse() const;
+    int receiveConnectResponse();
 
-    int receiveKeepaliveResponse() const;
+    int receiveDisconnectResponse();
 
-    int receivePrepareToneResponse() const;
+    int receiveDiseqcSendBurstResponse();
 
-    int receiveResetFilterResponse() const;
+    int receiveDiseqcSendMasterCommandResponse();
 
-    int receiveResponse(uint16_t cmd) const;
+    int receiveKeepaliveResponse();
 
-    int receiveSetFilterResponse() const;
+    int receivePrepareToneResponse();
 
-    int receiveSetFrontendResponse() const;
+    int receiveResetFilterResponse();
 
-    int receiveSetToneResponse() const;
+    int receiveResponse(uint16_t cmd);
 
-    int receiveSetVoltageResponse() const;
+    int receiveSetFilterResponse();
 
-    int receiveStartResponse() const;
+    int receiveSetFrontendResponse();
 
-    int receiveStopResponse() const;
+    int receiveSetToneResponse();
+
+    int receiveSetVoltageResponse();
+
+    int receiveStartResponse();
+
+    int receiveStopResponse();
+
+    bool matchPendingRequest(uint16_t cmd);
 
     void receiverLoop();
 
-    int sendConnectRequest() const;
+    void signalReceiver();
+
+    int sendConnectRequest();
 
-    int sendDisconnectRequest() const;
+    int sendDisconnectRequest();
 
-    int sendDiseqcSendBurstRequest() const;
+    int sendDiseqcSendBurstRequest();
 
-    int sendDiseqcSendMasterCommandRequest() const;
+    int sendDiseqcSendMasterCommandRequest();
 
-    int sendKeepaliveRequest() const;
+    int sendKeepaliveRequest();
 
-    int sendPrepareToneRequest() const;
+    int sendPrepareToneRequest();
 
-    int sendRequest(const RequestHeader *packet) const;
+    int sendRequest(const RequestHeader *packet);
 
     int sendResetFilterRequest();
 
@@ -578,13 +721,15 @@ private:
 
     int sendSetFrontendRequest();
 
-    int sendSetToneRequest() const;
+    int sendSetToneRequest();
 
-    int sendSetVoltageRequest() const;
+    int sendSetVoltageRequest();
 
     int sendStartRequest();
 
-    int sendStopRequest() const;
+    int sendStopRequest();
+
+    void startDiSEqCDelay();
 
     bool tvlt(const timeval *tv1, const timeval *tv2) const;
 
@@ -592,28 +737,49 @@ private:
 
     bool m_verbose;
     uint8_t m_client_ip[4];
-    uint16_t m_client_port;
+    CTVSatClock *m_clock;
+    std::atomic<uint16_t> m_client_port;
     std::map<uint16_t, timeval> m_del_pids;
     int m_diseqc_cmd;
-    int m_do_connect;
+    std::atomic<int> m_diseqc_delay;
+    timeval m_diseqc_ready;
+    std::atomic<int> m_do_connect;
     int m_do_tune;
+    CFlightRecorder m_flight;
+    std::string m_flight_dir;
+    std::atomic<int> m_flight_dump;
+    timeval m_flight_dump_time;
+    state_t m_flight_state;
+    int m_has_last_diseqc;
     int m_input_dev;
     int m_is_tuned;
+    std::atomic<int> m_keepalive_failures;
+    tvsat_diseqc_parameters m_last_diseqc[TVSAT_MAX_DISEQC_CMDS];
+    int m_liveness_fd;
+    SStreamInMetrics m_metrics;
+    std::deque<SPendingRequest> m_pending;
     std::set<uint16_t> m_pids;
+    sched_config_t m_receiver_sched;
     int m_retry;
     int m_select_pids;
     CUDPSocket m_sock;
+    int m_sock_gen;
     state_t m_state;
     int m_stop;
-    pthread_mutex_t m_stop_access;
-    int m_stop_thread;
+    std::atomic<int> m_stop_thread;
+    std::atomic<int> m_reopen_stream_sock;
     CUDPSocket m_stream_sock;
     pthread_t m_thread;
     int m_thread_started;
     int m_try_pilot1;
+    CTSStats *m_ts_stats;
+    CTVSatTransport *m_transport;
     tvsat_tuning_parameters *m_tune;
+    unsigned int m_tune_gen;
+    timeval m_tune_started;
     char m_tvsat_ip[16];
     int m_wait;
+    int m_wake_fd;
 };
 
 #endif
@@ -0,0 +1,129 @@
+//////////////////////////////////////////////////////////////////////////
+// devolo dLAN TV Sat control application
+// Copyright (C) 2008 devolo AG. All rights reserved.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//
+// Contact information:
+//    devolo AG
+//    Sonnenweg 11
+//    D-52070 Aachen, Germany
+//    gpl@devolo.de
+//////////////////////////////////////////////////////////////////////////
+/// @file threadsched.cpp
+/// @brief "dLAN TV Sat Thread Scheduling" - implementation
+//////////////////////////////////////////////////////////////////////////
+
+#include <cstdio>
+#include <cstring>
+#include <sched.h>
+#include <string>
+
+#include "log.h"
+#include "threadsched.h"
+
+//////////////////////////////////////////////////////////////////////////
+/// Gets the name of a scheduling policy
+//////////////////////////////////////////////////////////////////////////
+static const char *policyName(int policy) {
+    switch (policy) {
+        case SCHED_FIFO:
+            return "SCHED_FIFO";
+        case SCHED_RR:
+            return "SCHED_RR";
+        default:
+            return "SCHED_OTHER";
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Pins a thread to a set of CPUs and sets its scheduling policy
+///
+/// The resulting placement is logged, so it can be checked after startup.
+///
+/// @param thread the thread to configure
+/// @param sched the scheduling options
+/// @param name describes the thread in log messages
+/// @return 0, if all options could be applied
+/// @return -1, otherwise
+//////////////////////////////////////////////////////////////////////////
+int setThreadScheduling(pthread_t thread, const sched_config_t &sched,
+                        const char *name) {
+    int ret = 0;
+    std::string cpus = "any CPU";
+
+    if (!sched.cpus.empty()) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+
+        cpus = "CPU";
+
+        for (size_t i = 0; i < sched.cpus.size(); ++i) {
+            char buf[16];
+            snprintf(buf, sizeof(buf), "%s%i", i ? "," : " ",
+                     sched.cpus[i]);
+            cpus += buf;
+            CPU_SET(sched.cpus[i], &set);
+        }
+
+        int err = pthread_setaffinity_np(thread, sizeof(cpu_set_t), &set);
+
+        if (err) {
+            logErr("Failed to pin %s to %s: %s", name, cpus.c_str(),
+                   strerror(err));
+            cpus = "any CPU";
+            ret = -1;
+        }
+    }
+
+    int policy = sched.policy;
+    sched_param param;
+    memset(&param, 0, sizeof(sched_param));
+
+    // real-time policies need a priority, the default policy doesn't
+    // support one
+    if ((policy == SCHED_FIFO) || (policy == SCHED_RR)) {
+        param.sched_priority = sched.priority;
+
+        if (param.sched_priority < sched_get_priority_min(policy))
+            param.sched_priority = sched_get_priority_min(policy);
+
+        if (param.sched_priority > sched_get_priority_max(policy))
+            param.sched_priority = sched_get_priority_max(policy);
+    } else
+        policy = SCHED_OTHER;
+
+    if (policy != SCHED_OTHER) {
+        int err = pthread_setschedparam(thread, policy, &param);
+
+        if (err) {
+            logErr("Failed to set %s priority %i for %s: %s",
+                   policyName(policy), param.sched_priority, name,
+                   strerror(err));
+            policy = SCHED_OTHER;
+            param.sched_priority = 0;
+            ret = -1;
+        }
+    }
+
+    if (policy == SCHED_OTHER)
+        logInf("%s runs on %s with %s", name, cpus.c_str(),
+               policyName(policy));
+    else
+        logInf("%s runs on %s with %s priority %i", name, cpus.c_str(),
+               policyName(policy), param.sched_priority);
+
+    return ret;
+}
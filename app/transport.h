@@ -0,0 +1,69 @@
+//////////////////////////////////////////////////////////////////////////
+// devolo dLAN TV Sat control application
+// Copyright (C) 2008 devolo AG. All rights reserved.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//
+// Contact information:
+//    devolo AG
+//    Sonnenweg 11
+//    D-52070 Aachen, Germany
+//    gpl@devolo.de
+//////////////////////////////////////////////////////////////////////////
+/// @file transport.h
+/// @brief "dLAN TV Sat Control Transport" - header
+//////////////////////////////////////////////////////////////////////////
+
+#ifndef __TVSAT_TRANSPORT_H
+#define __TVSAT_TRANSPORT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/time.h>
+
+//////////////////////////////////////////////////////////////////////////
+/// Source of the time the state machine works with
+///
+/// Without a clock, CTVSatStreamIn uses gettimeofday(). A simulation
+/// replaces it with virtual time.
+//////////////////////////////////////////////////////////////////////////
+class CTVSatClock {
+public:
+    virtual ~CTVSatClock() {}
+
+    /// Gets the current time
+    virtual void getTime(timeval *tv) = 0;
+};
+
+//////////////////////////////////////////////////////////////////////////
+/// Carries requests to the NAT device and its responses back
+///
+/// Without a transport, CTVSatStreamIn uses its UDP control socket.
+//////////////////////////////////////////////////////////////////////////
+class CTVSatTransport {
+public:
+    virtual ~CTVSatTransport() {}
+
+    /// Gets the next response without blocking (0, if there is none)
+    virtual size_t receive(uint8_t *buf, size_t len) = 0;
+
+    /// Drops everything that is on its way, like reopening the socket
+    virtual void reset() = 0;
+
+    /// Sends a request to the NAT device
+    virtual bool send(const uint8_t *data, size_t len) = 0;
+};
+
+#endif
@@ -0,0 +1,184 @@
+//////////////////////////////////////////////////////////////////////////
+// devolo dLAN TV Sat control application
+// Copyright (C) 2008 devolo AG. All rights reserved.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//
+// Contact information:
+//    devolo AG
+//    Sonnenweg 11
+//    D-52070 Aachen, Germany
+//    gpl@devolo.de
+//////////////////////////////////////////////////////////////////////////
+/// @file tsstats.cpp
+/// @brief "dLAN TV Sat Transport Stream Statistics" - implementation
+//////////////////////////////////////////////////////////////////////////
+
+#include "log.h"
+#include "tsstats.h"
+
+//////////////////////////////////////////////////////////////////////////
+/// Increments a counter that only one thread writes
+///
+/// A relaxed load and store is enough for a single writer and avoids the
+/// locked instruction of fetch_add().
+//////////////////////////////////////////////////////////////////////////
+static inline void bump(std::atomic<uint64_t> &counter, uint64_t n = 1) {
+    counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Constructor
+//////////////////////////////////////////////////////////////////////////
+CTSStats::CTSStats() {
+    for (int pid = 0; pid < TVSAT_TS_NUM_PIDS; ++pid) {
+        m_pids[pid].bytes = 0;
+        m_pids[pid].cc_errors = 0;
+        m_pids[pid].duplicates = 0;
+        m_pids[pid].last_cc = 0xff;
+        m_pids[pid].packets = 0;
+    }
+
+    m_resync = 0;
+    m_sync_errors = 0;
+    m_tei_errors = 0;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Accounts the TS packets of a datagram
+///
+/// A packet with payload has to carry the continuity counter of the
+/// previous packet of its PID plus one. The same counter again is a
+/// duplicate, anything else means packets were lost. Packets without
+/// payload keep the counter, and the discontinuity indicator of the
+/// adaptation field allows a jump.
+///
+/// @param buf the datagram
+/// @param len the size of the datagram
+//////////////////////////////////////////////////////////////////////////
+void CTSStats::account(const uint8_t *buf, size_t len) {
+    if (m_resync.load(std::memory_order_relaxed)) {
+        m_resync.store(0, std::memory_order_relaxed);
+
+        for (int pid = 0; pid < TVSAT_TS_NUM_PIDS; ++pid)
+            m_pids[pid].last_cc = 0xff;
+    }
+
+    for (size_t off = 0; off + TVSAT_TS_PACKET_SIZE <= len; off += TVSAT_TS_PACKET_SIZE) {
+        const uint8_t *tsp = buf + off;
+
+        if (tsp[0] != 0x47) {
+            bump(m_sync_errors);
+            continue;
+        }
+
+        // the demodulator couldn't correct the packet, so the header
+        // can't be trusted either
+        if (tsp[1] & 0x80) {
+            bump(m_tei_errors);
+            continue;
+        }
+
+        uint16_t pid = ((tsp[1] & 0x1f) << 8) | tsp[2];
+        SPid &p = m_pids[pid];
+
+        bump(p.packets);
+        bump(p.bytes, TVSAT_TS_PACKET_SIZE);
+
+        // null packets don't have a meaningful counter
+        if (pid == 0x1fff)
+            continue;
+
+        uint8_t afc = (tsp[3] >> 4) & 0x03;
+        uint8_t cc = tsp[3] & 0x0f;
+        bool discontinuity = (afc & 0x02) && (tsp[4] > 0) && (tsp[5] & 0x80);
+
+        if ((p.last_cc != 0xff) && !discontinuity) {
+            if (!(afc & 0x01)) {
+                if (cc != p.last_cc)
+                    bump(p.cc_errors);
+            } else if (cc == p.last_cc)
+                bump(p.duplicates);
+            else if (cc != ((p.last_cc + 1) & 0x0f))
+                bump(p.cc_errors);
+        }
+
+        p.last_cc = cc;
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Gets the counters of a PID
+//////////////////////////////////////////////////////////////////////////
+void CTSStats::getPid(uint16_t pid, STSPidCounters &counters) const {
+    const SPid &p = m_pids[pid & 0x1fff];
+
+    counters.bytes = p.bytes.load(std::memory_order_relaxed);
+    counters.cc_errors = p.cc_errors.load(std::memory_order_relaxed);
+    counters.duplicates = p.duplicates.load(std::memory_order_relaxed);
+    counters.packets = p.packets.load(std::memory_order_relaxed);
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Sums up the counters of all PIDs
+//////////////////////////////////////////////////////////////////////////
+void CTSStats::getTotals(STSTotals &totals) const {
+    totals.bytes = 0;
+    totals.cc_errors = 0;
+    totals.duplicates = 0;
+    totals.packets = 0;
+    totals.pids = 0;
+    totals.sync_errors = m_sync_errors.load(std::memory_order_relaxed);
+    totals.tei_errors = m_tei_errors.load(std::memory_order_relaxed);
+
+    for (int pid = 0; pid < TVSAT_TS_NUM_PIDS; ++pid) {
+        STSPidCounters c;
+        getPid(pid, c);
+
+        if (!c.packets)
+            continue;
+
+        totals.bytes += c.bytes;
+        totals.cc_errors += c.cc_errors;
+        totals.duplicates += c.duplicates;
+        totals.packets += c.packets;
+        ++totals.pids;
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Logs the totals and the counters of every PID that has been received
+/// @param name the name of the stream in the log, e.g. the device address
+//////////////////////////////////////////////////////////////////////////
+void CTSStats::log(const char *name) const {
+    STSTotals t;
+    getTotals(t);
+
+    logDump("TS stats of %s: %llu packets, %llu bytes, %i PIDs, %llu CC errors, %llu duplicates, "
+            "%llu TEI errors, %llu sync errors", name, (unsigned long long) t.packets,
+            (unsigned long long) t.bytes, t.pids, (unsigned long long) t.cc_errors,
+            (unsigned long long) t.duplicates, (unsigned long long) t.tei_errors,
+            (unsigned long long) t.sync_errors);
+
+    for (int pid = 0; pid < TVSAT_TS_NUM_PIDS; ++pid) {
+        STSPidCounters c;
+        getPid(pid, c);
+
+        if (c.packets)
+            logDump("TS stats of %s: PID %i: %llu packets, %llu bytes, %llu CC errors, %llu duplicates",
+                    name, pid, (unsigned long long) c.packets, (unsigned long long) c.bytes,
+                    (unsigned long long) c.cc_errors, (unsigned long long) c.duplicates);
+    }
+}
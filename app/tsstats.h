@@ -0,0 +1,105 @@
+//////////////////////////////////////////////////////////////////////////
+// devolo dLAN TV Sat control application
+// Copyright (C) 2008 devolo AG. All rights reserved.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//
+// Contact information:
+//    devolo AG
+//    Sonnenweg 11
+//    D-52070 Aachen, Germany
+//    gpl@devolo.de
+//////////////////////////////////////////////////////////////////////////
+/// @file tsstats.h
+/// @brief "dLAN TV Sat Transport Stream Statistics" - header
+//////////////////////////////////////////////////////////////////////////
+
+#ifndef __TVSAT_TSSTATS_H
+#define __TVSAT_TSSTATS_H
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+//////////////////////////////////////////////////////////////////////////
+// DEFINITIONS
+//////////////////////////////////////////////////////////////////////////
+#define TVSAT_TS_NUM_PIDS              0x2000
+#define TVSAT_TS_PACKET_SIZE           188
+
+//////////////////////////////////////////////////////////////////////////
+/// Counters of a single PID
+//////////////////////////////////////////////////////////////////////////
+struct STSPidCounters {
+    uint64_t bytes;
+    uint64_t cc_errors;
+    uint64_t duplicates;
+    uint64_t packets;
+};
+
+//////////////////////////////////////////////////////////////////////////
+/// Counters of a whole stream
+//////////////////////////////////////////////////////////////////////////
+struct STSTotals {
+    uint64_t bytes;
+    uint64_t cc_errors;
+    uint64_t duplicates;
+    uint64_t packets;
+    /// Number of PIDs that have been received
+    int pids;
+    uint64_t sync_errors;
+    uint64_t tei_errors;
+};
+
+//////////////////////////////////////////////////////////////////////////
+/// Continuity and loss accounting of a transport stream
+///
+/// Tracks the continuity counter of every PID in a flat table, so the
+/// packet path doesn't need to allocate or search anything. Only one
+/// thread may call account(); any thread may read the counters at the
+/// same time.
+//////////////////////////////////////////////////////////////////////////
+class CTSStats {
+public:
+    CTSStats();
+
+    void account(const uint8_t *buf, size_t len);
+
+    void getPid(uint16_t pid, STSPidCounters &counters) const;
+
+    void getTotals(STSTotals &totals) const;
+
+    void log(const char *name) const;
+
+    /// Forgets the continuity counters, e.g. because the stream is retuned
+    void resync() { m_resync.store(1, std::memory_order_relaxed); }
+
+private:
+    struct SPid {
+        std::atomic<uint64_t> bytes;
+        std::atomic<uint64_t> cc_errors;
+        std::atomic<uint64_t> duplicates;
+        /// Continuity counter of the last packet (0xff: none yet)
+        uint8_t last_cc;
+        std::atomic<uint64_t> packets;
+    };
+
+    SPid m_pids[TVSAT_TS_NUM_PIDS];
+    std::atomic<int> m_resync;
+    std::atomic<uint64_t> m_sync_errors;
+    std::atomic<uint64_t> m_tei_errors;
+};
+
+#endif
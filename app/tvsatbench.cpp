@@ -0,0 +1,428 @@
+//////////////////////////////////////////////////////////////////////////
+// devolo dLAN TV Sat control application
+// Copyright (C) 2008 devolo AG. All rights reserved.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//
+// Contact information:
+//    devolo AG
+//    Sonnenweg 11
+//    D-52070 Aachen, Germany
+//    gpl@devolo.de
+//////////////////////////////////////////////////////////////////////////
+/// @file tvsatbench.cpp
+/// @brief "dLAN TV Sat Receive Path Benchmark" - implementation
+//////////////////////////////////////////////////////////////////////////
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <getopt.h>
+#include <iostream>
+#include <pthread.h>
+#include <stdio.h>
+#include <string>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+#include "reactor.h"
+#include "streamin.h"
+
+//////////////////////////////////////////////////////////////////////////
+// DEFINITIONS
+//////////////////////////////////////////////////////////////////////////
+#define TVSAT_BENCH_FRAME_SIZE         (7 * 188)
+
+#define HELPTXT    "tvsatbench - measures the throughput of the stream receive path\n"\
+        "Usage: tvsatbench [options]\n"\
+        "\n"\
+        "A local sender streams to the receive path of the daemon, which writes the\n"\
+        "stream to a pipe instead of an input device.\n"\
+        "\n"\
+        "Options:\n"\
+        "  -c           --ts-stats      count continuity errors like the daemon\n"\
+        "  -h           --help          show this help text\n"\
+        "  -p port      --port port     stream port (default: 11110)\n"\
+        "  -r rate      --rate rate     datagrams per second (default: 0 = as fast as\n"\
+        "                               possible)\n"\
+        "  -s name      --strategy name receive strategy: threaded, reactor or all\n"\
+        "                               (default: all)\n"\
+        "  -t sec       --time sec      duration of each run (default: 5)\n"
+
+static option long_opts[] = {
+        {"ts-stats", no_argument,       0, 'c'},
+        {"help",     no_argument,       0, 'h'},
+        {"port",     required_argument, 0, 'p'},
+        {"rate",     required_argument, 0, 'r'},
+        {"strategy", required_argument, 0, 's'},
+        {"time",     required_argument, 0, 't'},
+        {0, 0, 0, 0}
+};
+
+//////////////////////////////////////////////////////////////////////////
+/// Settings of a benchmark run
+//////////////////////////////////////////////////////////////////////////
+struct SBenchConfig {
+    int duration;
+    uint16_t port;
+    uint64_t rate;
+    bool ts_stats;
+};
+
+//////////////////////////////////////////////////////////////////////////
+/// State shared by the sender and the sink reader of a run
+//////////////////////////////////////////////////////////////////////////
+struct SBenchRun {
+    SBenchConfig config;
+    std::vector<uint32_t> latencies;
+    int pipe_r;
+    std::atomic<uint64_t> received;
+    std::atomic<uint64_t> received_bytes;
+    std::atomic<int> sending;
+    std::atomic<uint64_t> sent;
+    std::atomic<int> stop;
+};
+
+//////////////////////////////////////////////////////////////////////////
+/// Lets a reactor feed the stream socket to the receive path
+//////////////////////////////////////////////////////////////////////////
+class CBenchHandler : public CReactorHandler {
+public:
+    CBenchHandler(CTVSatStreamIn *sin) { m_sin = sin; }
+
+    void handleEvent(int fd, uint32_t events) { m_sin->drainStreamData(); }
+
+private:
+    CTVSatStreamIn *m_sin;
+};
+
+//////////////////////////////////////////////////////////////////////////
+/// Gets a monotonic timestamp in nanoseconds
+//////////////////////////////////////////////////////////////////////////
+static uint64_t nowNS() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Gets the CPU time of a clock in nanoseconds
+//////////////////////////////////////////////////////////////////////////
+static uint64_t cpuNS(clockid_t clock) {
+    timespec ts;
+    clock_gettime(clock, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Gets the clock rate of the CPU in MHz (0, if unknown)
+//////////////////////////////////////////////////////////////////////////
+static double getCPUMHz() {
+    FILE *f = fopen("/proc/cpuinfo", "r");
+
+    if (!f)
+        return 0;
+
+    char line[256];
+    double mhz = 0;
+
+    while (fgets(line, sizeof(line), f))
+        if (sscanf(line, "cpu MHz : %lf", &mhz) == 1)
+            break;
+
+    fclose(f);
+
+    return mhz;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Sends the stream to the receive path
+///
+/// Every datagram carries its sequence number and send time in the
+/// payload of the first TS packet.
+//////////////////////////////////////////////////////////////////////////
+static void *sendStream(void *arg) {
+    SBenchRun *run = (SBenchRun *) arg;
+    uint8_t frame[TVSAT_BENCH_FRAME_SIZE];
+
+    memset(frame, 0xff, sizeof(frame));
+
+    for (int i = 0; i < 7; ++i) {
+        frame[i * 188] = 0x47;
+        frame[i * 188 + 1] = 0x00;
+        frame[i * 188 + 2] = 0x64;
+        frame[i * 188 + 3] = 0x10;
+    }
+
+    int sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    sockaddr_in sa;
+    memset(&sa, 0, sizeof(sockaddr_in));
+    sa.sin_family = AF_INET;
+    sa.sin_port = htons(run->config.port);
+    sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    connect(sock, (sockaddr *) &sa, sizeof(sockaddr_in));
+
+    uint64_t start = nowNS();
+    uint64_t end = start + (uint64_t) run->config.duration * 1000000000ULL;
+    uint64_t seq = 0;
+
+    while (1) {
+        uint64_t now = nowNS();
+
+        if (now >= end)
+            break;
+
+        // stay on schedule without sleeping, the rates are too high for
+        // the timer resolution
+        if (run->config.rate && (seq >= (now - start) * run->config.rate / 1000000000ULL))
+            continue;
+
+        memcpy(frame + 4, &seq, sizeof(seq));
+        memcpy(frame + 4 + sizeof(seq), &now, sizeof(now));
+
+        if (send(sock, frame, sizeof(frame), 0) == sizeof(frame))
+            ++seq;
+    }
+
+    run->sent = seq;
+    run->sending = 0;
+    close(sock);
+
+    return 0;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Reads the stream from the sink pipe and records the latencies
+//////////////////////////////////////////////////////////////////////////
+static void *readSink(void *arg) {
+    SBenchRun *run = (SBenchRun *) arg;
+    const int frames = 64;
+    uint8_t buf[frames * TVSAT_BENCH_FRAME_SIZE];
+
+    while (!run->stop) {
+        ssize_t len = read(run->pipe_r, buf, sizeof(buf));
+
+        if (len <= 0) {
+            usleep(100);
+            continue;
+        }
+
+        uint64_t now = nowNS();
+
+        // each write of the receive path is a whole datagram and
+        // smaller than PIPE_BUF, so reads return whole frames
+        for (ssize_t off = 0; off + TVSAT_BENCH_FRAME_SIZE <= len; off += TVSAT_BENCH_FRAME_SIZE) {
+            uint64_t sent;
+            memcpy(&sent, buf + off + 4 + sizeof(uint64_t), sizeof(sent));
+
+            if (now > sent)
+                run->latencies.push_back(std::min<uint64_t>(now - sent, 0xffffffff));
+        }
+
+        run->received += len / TVSAT_BENCH_FRAME_SIZE;
+        run->received_bytes += len;
+    }
+
+    return 0;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Runs the benchmark with one receive strategy and prints the results
+/// @return true, if successful
+/// @return false, if the strategy is unknown or the setup failed
+//////////////////////////////////////////////////////////////////////////
+static bool runBenchmark(const std::string &strategy, const SBenchConfig &config) {
+    if ((strategy != "threaded") && (strategy != "reactor")) {
+        std::cerr << "Error: unknown strategy " << strategy << std::endl;
+        return false;
+    }
+
+    int pipe_fds[2];
+
+    if (pipe2(pipe_fds, O_CLOEXEC | O_NONBLOCK) < 0) {
+        std::cerr << "Error: pipe() failed" << std::endl;
+        return false;
+    }
+
+    // the sink should never be the bottleneck
+    fcntl(pipe_fds[1], F_SETPIPE_SZ, 1 << 20);
+
+    SBenchRun run;
+    run.config = config;
+    run.latencies.reserve(1 << 20);
+    run.pipe_r = pipe_fds[0];
+    run.received = 0;
+    run.received_bytes = 0;
+    run.sending = 1;
+    run.sent = 0;
+    run.stop = 0;
+
+    CTVSatStreamIn *sin = new CTVSatStreamIn(false);
+    sin->setClientPort(config.port);
+    sin->setInputDev(pipe_fds[1]);
+    sin->enableTSStats(config.ts_stats);
+
+    if (sin->getStreamSocketFD() < 0) {
+        std::cerr << "Error: can't open stream socket on port " << config.port << std::endl;
+        delete sin;
+        close(pipe_fds[0]);
+        close(pipe_fds[1]);
+        return false;
+    }
+
+    CReactor *reactor = 0;
+    CBenchHandler handler(sin);
+
+    if (strategy == "reactor") {
+        reactor = new CReactor(0);
+        reactor->add(sin->getStreamSocketFD(), &handler);
+        reactor->start();
+    } else
+        sin->startReceiver();
+
+    pthread_t sender, reader;
+    pthread_create(&reader, 0, readSink, &run);
+
+    uint64_t cpu_start = cpuNS(CLOCK_PROCESS_CPUTIME_ID);
+    uint64_t start = nowNS();
+
+    pthread_create(&sender, 0, sendStream, &run);
+
+    clockid_t sender_clock, reader_clock;
+    pthread_getcpuclockid(sender, &sender_clock);
+    pthread_getcpuclockid(reader, &reader_clock);
+
+    // the CPU time of the helper threads doesn't count, so read their
+    // clocks while they still exist
+    uint64_t sender_cpu = 0;
+
+    while (run.sending) {
+        sender_cpu = cpuNS(sender_clock);
+        usleep(10000);
+    }
+
+    uint64_t seconds_ns = nowNS() - start;
+
+    // give the receive path a moment to catch up
+    usleep(200000);
+
+    uint64_t reader_cpu = cpuNS(reader_clock);
+    uint64_t cpu = cpuNS(CLOCK_PROCESS_CPUTIME_ID) - cpu_start;
+
+    run.stop = 1;
+    pthread_join(sender, 0);
+    pthread_join(reader, 0);
+
+    if (reactor) {
+        reactor->stop();
+        delete reactor;
+    }
+
+    delete sin;
+    close(pipe_fds[0]);
+    close(pipe_fds[1]);
+
+    uint64_t received = run.received;
+    uint64_t sent = run.sent;
+    double seconds = seconds_ns / 1e9;
+    double recv_cpu = (cpu > sender_cpu + reader_cpu) ? (double) (cpu - sender_cpu - reader_cpu) : 0;
+    double mhz = getCPUMHz();
+
+    std::sort(run.latencies.begin(), run.latencies.end());
+
+    double p50 = 0, p99 = 0;
+
+    if (!run.latencies.empty()) {
+        p50 = run.latencies[run.latencies.size() / 2] / 1000.0;
+        p99 = run.latencies[run.latencies.size() * 99 / 100] / 1000.0;
+    }
+
+    printf("%-10s %12.0f %10.1f %10.0f %10.1f %10.1f %8.3f\n", strategy.c_str(),
+           received / seconds, run.received_bytes / seconds / 1e6,
+           received ? recv_cpu * (mhz ? mhz / 1000 : 1) / received : 0,
+           p50, p99, sent ? 100.0 * (sent - std::min(sent, received)) / sent : 0);
+
+    return true;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// tvsatbench main function
+//////////////////////////////////////////////////////////////////////////
+int main(int argc, char **argv) {
+    SBenchConfig config;
+    config.duration = 5;
+    config.port = 11110;
+    config.rate = 0;
+    config.ts_stats = false;
+
+    std::string strategy = "all";
+    int c, optidx;
+
+    while ((c = getopt_long(argc, argv, "chp:r:s:t:", long_opts, &optidx)) != -1) {
+        switch (c) {
+            case 'c':
+                config.ts_stats = true;
+                break;
+
+            case 'p':
+                config.port = atoi(optarg);
+                break;
+
+            case 'r':
+                config.rate = strtoull(optarg, 0, 10);
+                break;
+
+            case 's':
+                strategy = optarg;
+                break;
+
+            case 't':
+                config.duration = atoi(optarg);
+
+                if (config.duration <= 0) {
+                    std::cerr << "Error: invalid duration" << std::endl;
+                    return 1;
+                }
+
+                break;
+
+            default:
+                std::cout << HELPTXT;
+                return 0;
+        }
+    }
+
+    std::vector<std::string> strategies;
+
+    if (strategy == "all") {
+        strategies.push_back("threaded");
+        strategies.push_back("reactor");
+    } else
+        strategies.push_back(strategy);
+
+    printf("%-10s %12s %10s %10s %10s %10s %8s\n", "strategy", "datagrams/s", "MB/s",
+           getCPUMHz() ? "cycles/dg" : "cpu ns/dg", "p50 us", "p99 us", "loss %");
+
+    for (size_t i = 0; i < strategies.size(); ++i)
+        if (!runBenchmark(strategies[i], config))
+            return 1;
+
+    return 0;
+}
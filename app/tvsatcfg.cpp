@@ -322,6 +322,9 @@ int main(int argc, char **argv) {
             opt_devmask[4] = {255, 255, 255, 0};
     std::string opt_if;
 
+    // the socket errors are meant for the user
+    openlog("tvsatcfg", LOG_PERROR, LOG_USER);
+
     // parse the command line options
     while ((c = getopt_long(argc, argv, "ab:d:hi:m:", long_opts,
                             &optidx)) != -1) {
@@ -30,22 +30,131 @@
 #include <cstring>
 #include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <sys/inotify.h>
 #include <sys/ioctl.h>
+#include <sys/time.h>
+#include <sys/timerfd.h>
 #include <unistd.h>
 #include <stdio.h>
 
 #include "log.h"
+#include "threadsched.h"
 #include "tvsatctl.h"
 
 //////////////////////////////////////////////////////////////////////////
 /// Constructor
 //////////////////////////////////////////////////////////////////////////
-CTVSatCtl::CTVSatCtl(std::string &client_ip, std::string &device_ip, uint8_t *device_mac, int adapter_num, bool verbose) {
+CTVSatCtl::CTVSatCtl(std::string &client_ip, std::string &device_ip, uint8_t *device_mac, int adapter_num,
+                     const config_t &config, bool verbose) {
+    init(client_ip, device_ip, device_mac, config, verbose);
+
+    // register the device with the kernel module
+    m_dev_id.adapter = adapter_num;
+
+    int ctl_dev = open(TVSAT_DEV_CONTROL_DEVICE_NAME, O_RDWR);
+    int ret = ioctl(ctl_dev, TVS_REGISTER_DEVICE, &m_dev_id);
+    close(ctl_dev);
+
+    // if the kernel module signals success, the input device will be
+    // created by udev (see openInputDevice())
+    if ((ret == 0) && (m_dev_id.minor > 0)) {
+        m_sin->setClientPort(11110 + m_dev_id.minor);
+
+        char dev_name[12];
+        snprintf(dev_name, 12, "/dev/tvs%u", m_dev_id.minor - 1);
+        m_input_dev_name = dev_name;
+    } else
+        m_init = 0;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Constructor for a device that is taken over from another process
+///
+/// The device is already registered with the kernel module, so the
+/// controller just continues with the state and the file descriptors the
+/// other process handed over (see handOver()).
+//////////////////////////////////////////////////////////////////////////
+CTVSatCtl::CTVSatCtl(std::string &client_ip, std::string &device_ip, uint8_t *device_mac,
+                     const STVSatCtlState &state, int sock_fd, int stream_fd, int input_fd,
+                     const config_t &config, bool verbose) {
+    init(client_ip, device_ip, device_mac, config, verbose);
+
+    m_dev_id = state.dev_id;
+    m_has_last_tune = state.has_last_tune;
+    m_input_dev = input_fd;
+    m_is_tuned = state.is_tuned;
+    m_last_tune = state.last_tune;
+
+    if (state.linger_left > 0) {
+        timeval linger;
+        linger.tv_sec = state.linger_left / 1000;
+        linger.tv_usec = (state.linger_left % 1000) * 1000;
+
+        gettimeofday(&m_linger_until, 0);
+        timeradd(&m_linger_until, &linger, &m_linger_until);
+        m_lingering = 1;
+    }
+
+    // without an input device, it is opened again by its name
+    if ((stream_fd >= 0) && (m_dev_id.minor > 0)) {
+        m_sin->restoreState(state.sin, sock_fd, stream_fd);
+
+        char dev_name[12];
+        snprintf(dev_name, 12, "/dev/tvs%u", m_dev_id.minor - 1);
+        m_input_dev_name = dev_name;
+    } else
+        m_init = 0;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Destructor
+//////////////////////////////////////////////////////////////////////////
+CTVSatCtl::~CTVSatCtl() {
+    delete m_sin;
+
+    // the input device has to be closed first, the kernel module may keep
+    // it for a device that is removed while its frontend is still open
+    if (m_input_dev >= 0)
+        close(m_input_dev);
+
+    // unregister the device from the kernel module, unless another
+    // process has taken it over
+    if (!m_handoff) {
+        int ctl_dev = open(TVSAT_DEV_CONTROL_DEVICE_NAME, O_RDWR);
+        ioctl(ctl_dev, TVS_UNREGISTER_DEVICE, &m_dev_id);
+        close(ctl_dev);
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Initializes the members that don't depend on how the device was
+/// registered
+//////////////////////////////////////////////////////////////////////////
+void CTVSatCtl::init(std::string &client_ip, std::string &device_ip, uint8_t *device_mac,
+                     const config_t &config, bool verbose) {
     m_verbose = verbose;
+    m_control_sched = config.control_sched;
+    m_events_pollable = 0;
+    m_failed = 0;
+    m_handoff = 0;
+    m_has_last_tune = 0;
     m_init = 1;
+    m_inotify_fd = -1;
+    m_input_dev = -1;
     m_is_tuned = 0;
+    m_lc = 0;
+    m_linger_time = config.linger_time;
+    m_lingering = 0;
+    m_liveness_fd = -1;
+    m_reactor = 0;
     m_run = 1;
     m_sin = new CTVSatStreamIn(verbose);
+    m_sock_fd = -1;
+    m_sock_gen = 0;
+    m_stream_fd = -1;
+    m_thread_started = 0;
+    m_timer_fd = -1;
 
     m_ip_addr = device_ip;
     memcpy(m_mac_addr, device_mac, 6);
@@ -65,62 +174,321 @@ CTVSatCtl::CTVSatCtl(std::string &client_ip, std::string &device_ip, uint8_t *de
 
     m_sin->setClientIP(cip);
     m_sin->setTVSatIP(dip);
+    m_sin->setReceiverScheduling(config.receiver_sched);
+    m_sin->setDiSEqCDelay(config.diseqc_delay);
+    m_sin->enableTSStats(config.ts_stats);
+    m_sin->setFlightRecorderDir(config.flight_recorder_dir);
 
-    // register the device with the kernel module
     memset(&m_dev_id, 0, sizeof(tvsat_dev_id));
-    m_dev_id.adapter = adapter_num;
     memcpy(m_dev_id.ip_addr, dip, 4);
     m_dev_id.port = 11111;
     m_dev_id.minor = 0;
 
-    int ctl_dev = open(TVSAT_DEV_CONTROL_DEVICE_NAME, O_RDWR);
-    int ret = ioctl(ctl_dev, TVS_REGISTER_DEVICE, &m_dev_id);
-    close(ctl_dev);
+    delete[] cip;
+    delete[] dip;
 
-    // give udev some time to create the device node
-    sleep(1);
+    pthread_mutex_init(&m_run_access, 0);
+}
 
-    // if the kernel module signals success, open the newly created input device
-    if ((ret == 0) && (m_dev_id.minor > 0)) {
-        m_sin->setClientPort(11110 + m_dev_id.minor);
+//////////////////////////////////////////////////////////////////////////
+/// Disconnects from the NAT device once no application uses it anymore
+//////////////////////////////////////////////////////////////////////////
+void CTVSatCtl::disconnect() {
+    m_has_last_tune = 0;
+    m_lingering = 0;
 
-        char dev_name[12];
-        snprintf(dev_name, 12, "/dev/tvs%u", m_dev_id.minor - 1);
+    m_sin->disconnect();
+    m_sin->stop();
+}
 
-        m_input_dev = open(dev_name, O_RDWR);
-        m_sin->setInputDev(m_input_dev);
+//////////////////////////////////////////////////////////////////////////
+/// Registers the input device and the sockets with the reactor once the
+/// input device is open
+/// @return true, if successful
+/// @return false, otherwise
+//////////////////////////////////////////////////////////////////////////
+bool CTVSatCtl::attachReactor() {
+    m_sock_fd = m_sin->getSocketFD();
+    m_sock_gen = m_sin->getSocketGeneration();
+    m_stream_fd = m_sin->getStreamSocketFD();
+
+    // older versions of the kernel module don't support polling the
+    // input device for events
+    m_events_pollable = m_reactor->add(m_input_dev, this);
+
+    LOG_DBG(m_verbose, "Input device %s polling for events",
+            m_events_pollable ? "supports" : "does not support");
+
+    // responses are edge-triggered, because some of them are only
+    // processed by the next tick
+    return m_reactor->add(m_sock_fd, this, EPOLLIN | EPOLLET) &&
+           m_reactor->add(m_stream_fd, this);
+}
 
-        if (m_verbose)
-            LOG_DBG(m_verbose, "successfully opened input device %s", dev_name);
-    } else
-        m_init = 0;
+//////////////////////////////////////////////////////////////////////////
+/// Unregisters all file descriptors from the reactor
+//////////////////////////////////////////////////////////////////////////
+void CTVSatCtl::detachReactor() {
+    // the timer goes first, so it can't trigger any more ticks
+    m_reactor->remove(m_timer_fd);
+
+    if (m_inotify_fd >= 0) {
+        m_reactor->remove(m_inotify_fd);
+        close(m_inotify_fd);
+        m_inotify_fd = -1;
+    }
 
-    delete[] cip;
-    delete[] dip;
+    if (m_sock_fd >= 0)
+        m_reactor->remove(m_sock_fd);
 
-    pthread_mutex_init(&m_run_access, 0);
+    if (m_stream_fd >= 0)
+        m_reactor->remove(m_stream_fd);
+
+    if (m_events_pollable)
+        m_reactor->remove(m_input_dev);
+
+    close(m_timer_fd);
+    m_timer_fd = -1;
+    m_reactor = 0;
 }
 
 //////////////////////////////////////////////////////////////////////////
-/// Destructor
+/// Gives up the device and tells the manager, which then removes it
 //////////////////////////////////////////////////////////////////////////
-CTVSatCtl::~CTVSatCtl() {
-    // unregister the device from the kernel module
-    int ctl_dev = open(TVSAT_DEV_CONTROL_DEVICE_NAME, O_RDWR);
-    ioctl(ctl_dev, TVS_UNREGISTER_DEVICE, &m_dev_id);
-    close(ctl_dev);
+void CTVSatCtl::fail() {
+    m_failed = 1;
+
+    // the manager removes us from the reactor, until then the timer
+    // must not keep it busy
+    if (m_timer_fd >= 0) {
+        itimerspec its;
+        memset(&its, 0, sizeof(itimerspec));
+        timerfd_settime(m_timer_fd, 0, &its, 0);
+    }
 
-    delete m_sin;
+    if (m_liveness_fd >= 0) {
+        uint64_t one = 1;
+
+        if (write(m_liveness_fd, &one, sizeof(one)) != sizeof(one))
+            logErr("Failed to notify manager about failed device %s", m_ip_addr.c_str());
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Handles a ready file descriptor in reactor mode
+/// @param fd the file descriptor that is ready
+/// @param events the epoll events (not used)
+//////////////////////////////////////////////////////////////////////////
+void CTVSatCtl::handleEvent(int fd, uint32_t events) {
+    // stream data is by far the most frequent event
+    if (fd == m_stream_fd) {
+        m_sin->drainStreamData();
+        return;
+    }
+
+    if (m_failed)
+        return;
+
+    // the device is only served once its input device has shown up
+    if (m_input_dev < 0) {
+        waitForInputDevice();
+        return;
+    }
+
+    if (fd == m_timer_fd) {
+        uint64_t expirations;
 
+        if (read(m_timer_fd, &expirations, sizeof(expirations)) < 0)
+            return;
+
+        // without support for polling the input device, we have to
+        // check for events every few ticks
+        if (!m_events_pollable && (++m_lc == 5)) {
+            m_lc = 0;
+            processEvents();
+        }
+
+        update();
+    } else if (fd == m_input_dev) {
+        processEvents();
+    } else if (fd == m_sock_fd) {
+        // process responses right away instead of waiting for the next
+        // tick, so every step of the tuning sequence is a round trip
+        // faster
+        if (m_sin->isAwaitingResponse())
+            m_sin->tick();
+    }
+
+    updateReactorFDs();
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Stops the controller and gives up the device, so another process can
+/// take it over
+///
+/// The NAT device isn't told to stop and the device stays registered with
+/// the kernel module. Once this function returns, the controller only
+/// needs to be deleted.
+///
+/// @param state receives the state of the device
+/// @param sock_fd receives the control socket
+/// @param stream_fd receives the stream socket
+/// @param input_fd receives the input device
+//////////////////////////////////////////////////////////////////////////
+void CTVSatCtl::handOver(STVSatCtlState &state, int &sock_fd, int &stream_fd, int &input_fd) {
+    m_handoff = 1;
+
+    stop();
+    m_sin->stopReceiver();
+
+    memset(&state, 0, sizeof(STVSatCtlState));
+    state.dev_id = m_dev_id;
+    state.has_last_tune = m_has_last_tune;
+    state.is_tuned = m_is_tuned;
+    state.last_tune = m_last_tune;
+
+    if (m_lingering) {
+        timeval now, rm;
+        gettimeofday(&now, 0);
+
+        if (timercmp(&now, &m_linger_until, <)) {
+            timersub(&m_linger_until, &now, &rm);
+            state.linger_left = rm.tv_sec * 1000 + rm.tv_usec / 1000 + 1;
+        } else
+            state.linger_left = 1;
+    }
+    m_sin->saveState(state.sin);
+    m_sin->detachSockets(sock_fd, stream_fd);
+
+    input_fd = m_input_dev;
+    m_input_dev = -1;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Opens the input device of the registered device
+///
+/// The device node is created by udev some time after the device has
+/// been registered, so this function watches /dev until the node can be
+/// opened or the timeout expires.
+///
+/// @param timeout the maximum time to wait in milliseconds
+/// @return true, if successful
+/// @return false, otherwise
+//////////////////////////////////////////////////////////////////////////
+bool CTVSatCtl::openInputDevice(int timeout) {
     if (m_input_dev >= 0)
-        close(m_input_dev);
+        return true;
+
+    // start watching before the first try, so the node can't be created
+    // unnoticed in between
+    int in_fd = watchDevDirectory();
+
+    timeval deadline, now, rm;
+    gettimeofday(&deadline, 0);
+    deadline.tv_sec += timeout / 1000;
+    deadline.tv_usec += (timeout % 1000) * 1000;
+
+    if (deadline.tv_usec >= 1000000) {
+        ++deadline.tv_sec;
+        deadline.tv_usec -= 1000000;
+    }
+
+    while (!tryOpenInputDevice()) {
+        gettimeofday(&now, 0);
+
+        if (!timercmp(&now, &deadline, <))
+            break;
+
+        timersub(&deadline, &now, &rm);
+
+        // without inotify, check again every 50 ms
+        if (in_fd < 0) {
+            sleepMS(50);
+            continue;
+        }
+
+        pollfd pfd;
+        pfd.fd = in_fd;
+        pfd.events = POLLIN;
+
+        if (poll(&pfd, 1, rm.tv_sec * 1000 + rm.tv_usec / 1000 + 1) > 0) {
+            char buf[4096];
+
+            while (read(in_fd, buf, sizeof(buf)) > 0);
+        }
+    }
+
+    if (in_fd >= 0)
+        close(in_fd);
+
+    if (m_input_dev < 0) {
+        logErr("ERROR: Failed to open input device %s", m_input_dev_name.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Retrieves and processes all pending events from the tvsat kernel
+/// module
+//////////////////////////////////////////////////////////////////////////
+void CTVSatCtl::processEvents() {
+    tvsat_event ev;
+    int ret;
+
+    do {
+        ret = ioctl(m_input_dev, TVS_GET_EVENT, &ev);
+
+        if (ret == 0) {
+            LOG_DBG(m_verbose, "Received event from the kernel:");
+
+            switch (ev.type) {
+                case TVSAT_EVENT_PID:
+                    LOG_DBG(m_verbose, "start/stop pid");
+                    selectPID(&ev.event.pid);
+                    break;
+                case TVSAT_EVENT_TUNE:
+                    LOG_DBG(m_verbose, "tune");
+                    tune(&ev.event.tune);
+                    break;
+                case TVSAT_EVENT_CONNECT:
+                    LOG_DBG(m_verbose, "connect");
+
+                    if (m_lingering) {
+                        LOG_DBG(m_verbose, "Device reopened while lingering");
+                        m_lingering = 0;
+                    }
+
+                    m_sin->connect();
+                    break;
+                case TVSAT_EVENT_DISCONNECT:
+                    LOG_DBG(m_verbose, "disconnect");
+
+                    // keep the connection and the tune for a while, so an
+                    // application that comes right back doesn't have to
+                    // wait for the whole tuning sequence
+                    if (m_linger_time > 0) {
+                        timeval linger = {m_linger_time, 0};
+                        gettimeofday(&m_linger_until, 0);
+                        timeradd(&m_linger_until, &linger, &m_linger_until);
+                        m_lingering = 1;
+                        break;
+                    }
+
+                    disconnect();
+                    break;
+                default:
+                    LOG_DBG(m_verbose, "unknown event\n");
+            }
+        }
+    } while (ret == 0);
 }
 
 //////////////////////////////////////////////////////////////////////////
 /// Starts the main event loop
 //////////////////////////////////////////////////////////////////////////
 void CTVSatCtl::run() {
-    int lc = 0;
     int run = 1;
 
     // stop immediately if the constructor failed
@@ -129,77 +497,137 @@ void CTVSatCtl::run() {
         return;
     }
 
+    // waiting for the input device here lets several devices come up
+    // at the same time
+    if (!openInputDevice(TVSAT_INPUT_DEVICE_TIMEOUT)) {
+        fail();
+        return;
+    }
+
     m_sin->startReceiver();
 
     // main loop
     while (run) {
-        tvsat_event ev;
-        int ret;
-
         // don't poll for events each time around
-        if (lc == 5) {
-            lc = 0;
-
-            // retrieve and process all pending messages from the tvsat kernel module
-            do {
-                ret = ioctl(m_input_dev, TVS_GET_EVENT, &ev);
-
-                if (ret == 0) {
-                    LOG_DBG(m_verbose, "Received event from the kernel:");
-
-                    switch (ev.type) {
-                        case TVSAT_EVENT_PID:
-                            LOG_DBG(m_verbose, "start/stop pid");
-                            selectPID(&ev.event.pid);
-                            break;
-                        case TVSAT_EVENT_TUNE:
-                            LOG_DBG(m_verbose, "tune");
-                            tune(&ev.event.tune);
-                            break;
-                        case TVSAT_EVENT_CONNECT:
-                            LOG_DBG(m_verbose, "connect");
-                            m_sin->connect();
-                            break;
-                        case TVSAT_EVENT_DISCONNECT:
-                            LOG_DBG(m_verbose, "disconnect");
-                            m_sin->disconnect();
-                            m_sin->stop();
-                            break;
-                        default:
-                            LOG_DBG(m_verbose, "unknown event\n");
-                    }
-                }
-            } while (ret == 0);
+        if (m_lc == 5) {
+            m_lc = 0;
+            processEvents();
         }
 
-        // report lock to the kernel module
-        if (m_sin->isTuned() && !m_is_tuned) {
-            ioctl(m_input_dev, TVS_HAS_LOCK);
-            m_is_tuned = 1;
-        } else if (!m_sin->isTuned() && m_is_tuned)
-            m_is_tuned = 0;
-
-        // trigger the stream input state machine
-        m_sin->delPIDs();
-        m_sin->tick();
+        update();
 
         // we don't need to do this all the time, so we just sleep for a while
         sleepMS(25);
-        ++lc;
+        ++m_lc;
 
         pthread_mutex_lock(&m_run_access);
         run = m_run;
         pthread_mutex_unlock(&m_run_access);
     }
 
-    m_sin->stop();
+    // the stream goes on in the process that takes the device over
+    if (!m_handoff)
+        m_sin->stop();
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Registers the device's file descriptors with a reactor instead of
+/// running a thread of its own
+///
+/// The reactor then waits for the input device to show up, receives the
+/// stream data, processes kernel events and triggers the state machine
+/// every 25 ms. If the input device doesn't show up in time, the
+/// controller fails (see hasFailed()).
+///
+/// @param reactor the reactor that serves this device
+/// @return true, if successful
+/// @return false, otherwise
+//////////////////////////////////////////////////////////////////////////
+bool CTVSatCtl::runReactor(CReactor *reactor) {
+    if (!m_init) {
+        logErr("ERROR: Failed to initialize controller. Is the tvsat kernel module loaded?");
+        return false;
+    }
+
+    m_timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+
+    if (m_timer_fd < 0) {
+        logErr("ERROR: Failed to create timer");
+        return false;
+    }
+
+    itimerspec its;
+    its.it_interval.tv_sec = 0;
+    its.it_interval.tv_nsec = 25000000;
+    its.it_value = its.it_interval;
+    timerfd_settime(m_timer_fd, 0, &its, 0);
+
+    m_reactor = reactor;
+
+    // the node usually shows up a few ms after the registration, so the
+    // reactor doesn't wait for it, but is woken up by inotify (or, without
+    // it, checks again with every tick)
+    // a device that was taken over from another process may already have
+    // its input device
+    if (m_input_dev < 0) {
+        m_inotify_fd = watchDevDirectory();
+
+        gettimeofday(&m_input_deadline, 0);
+        m_input_deadline.tv_sec += TVSAT_INPUT_DEVICE_TIMEOUT / 1000;
+        m_input_deadline.tv_usec += (TVSAT_INPUT_DEVICE_TIMEOUT % 1000) * 1000;
+
+        if (m_input_deadline.tv_usec >= 1000000) {
+            ++m_input_deadline.tv_sec;
+            m_input_deadline.tv_usec -= 1000000;
+        }
+
+        tryOpenInputDevice();
+    }
+
+    if (m_input_dev >= 0) {
+        if (m_inotify_fd >= 0) {
+            close(m_inotify_fd);
+            m_inotify_fd = -1;
+        }
+
+        if (reactor->add(m_timer_fd, this) && attachReactor())
+            return true;
+
+        logErr("ERROR: Failed to register %s with reactor", m_ip_addr.c_str());
+        detachReactor();
+        return false;
+    }
+
+    // everything the reactor thread needs is set up at this point
+    if ((m_inotify_fd >= 0) && !reactor->add(m_inotify_fd, this)) {
+        close(m_inotify_fd);
+        m_inotify_fd = -1;
+    }
+
+    if (!reactor->add(m_timer_fd, this)) {
+        logErr("ERROR: Failed to register %s with reactor", m_ip_addr.c_str());
+        detachReactor();
+        return false;
+    }
+
+    return true;
 }
 
 //////////////////////////////////////////////////////////////////////////
 /// Starts the main event loop in a separate thread
 //////////////////////////////////////////////////////////////////////////
-void CTVSatCtl::runThreaded() {
-    pthread_create(&m_thread, 0, startThread, (void *) this);
+bool CTVSatCtl::runThreaded() {
+    if (pthread_create(&m_thread, 0, startThread, (void *) this) != 0) {
+        logErr("Failed to start control thread");
+        return false;
+    }
+
+    m_thread_started = 1;
+
+    std::string name = "Control thread of " + m_ip_addr;
+    setThreadScheduling(m_thread, m_control_sched, name.c_str());
+
+    return true;
 }
 
 //////////////////////////////////////////////////////////////////////////
@@ -213,6 +641,28 @@ void CTVSatCtl::selectPID(const tvsat_pid_selection *pid_sel) {
         m_sin->delPID(pid_sel->pid);
 }
 
+//////////////////////////////////////////////////////////////////////////
+/// Compares two sets of tuning parameters
+///
+/// The structs are compared member by member, since the padding between
+/// them isn't necessarily the same.
+//////////////////////////////////////////////////////////////////////////
+bool CTVSatCtl::sameTuning(const tvsat_tuning_parameters *tune1, const tvsat_tuning_parameters *tune2) {
+    if ((tune1->band != tune2->band) ||
+        (tune1->fec != tune2->fec) ||
+        (tune1->frequency != tune2->frequency) ||
+        (tune1->inversion != tune2->inversion) ||
+        (tune1->modulation != tune2->modulation) ||
+        (tune1->pilot != tune2->pilot) ||
+        (tune1->polarization != tune2->polarization) ||
+        (tune1->roll_off != tune2->roll_off) ||
+        (tune1->symbol_rate != tune2->symbol_rate) ||
+        (tune1->delivery_system != tune2->delivery_system))
+        return false;
+
+    return CTVSatStreamIn::sameDiSEqC(tune1->diseqc, tune2->diseqc);
+}
+
 //////////////////////////////////////////////////////////////////////////
 /// Sleeps for the given amount of time
 ///
@@ -254,11 +704,44 @@ void *CTVSatCtl::startThread(void *tvsat_ctl) {
 /// Stops the event loop
 //////////////////////////////////////////////////////////////////////////
 void CTVSatCtl::stop() {
+    // in reactor mode, we're on our own as soon as the reactor has
+    // forgotten about us
+    if (m_reactor) {
+        detachReactor();
+
+        if (!m_handoff)
+            m_sin->stop();
+
+        return;
+    }
+
+    if (!m_thread_started)
+        return;
+
     pthread_mutex_lock(&m_run_access);
     m_run = 0;
     pthread_mutex_unlock(&m_run_access);
 
     pthread_join(m_thread, 0);
+    m_thread_started = 0;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Tries once to open the input device
+/// @return true, if the input device is open
+/// @return false, otherwise
+//////////////////////////////////////////////////////////////////////////
+bool CTVSatCtl::tryOpenInputDevice() {
+    m_input_dev = open(m_input_dev_name.c_str(), O_RDWR);
+
+    if (m_input_dev < 0)
+        return false;
+
+    m_sin->setInputDev(m_input_dev);
+
+    LOG_DBG(m_verbose, "successfully opened input device %s", m_input_dev_name.c_str());
+
+    return true;
 }
 
 //////////////////////////////////////////////////////////////////////////
@@ -272,6 +755,123 @@ void CTVSatCtl::tune(const tvsat_tuning_parameters *tune) {
            tune->symbol_rate, tune->fec,
            tune->modulation, tune->pilot, tune->roll_off);
 
+    // the device still delivers the transponder that was tuned last, so
+    // there is nothing to do but to report the lock again
+    if (m_has_last_tune && sameTuning(tune, &m_last_tune) && m_sin->isTuned()) {
+        LOG_DBG(m_verbose, "Device is already tuned to this transponder");
+        ioctl(m_input_dev, TVS_HAS_LOCK);
+        m_is_tuned = 1;
+        return;
+    }
+
+    m_has_last_tune = 1;
+    m_last_tune = *tune;
+
     m_sin->setTuningParameters(tune);
     m_sin->start();
 }
+
+//////////////////////////////////////////////////////////////////////////
+/// Reports a signal lock to the kernel module and triggers the stream
+/// input state machine
+//////////////////////////////////////////////////////////////////////////
+void CTVSatCtl::update() {
+    // nobody came back for the device
+    if (m_lingering) {
+        timeval now;
+        gettimeofday(&now, 0);
+
+        if (!timercmp(&now, &m_linger_until, <)) {
+            LOG_DBG(m_verbose, "Linger time of %s expired", m_ip_addr.c_str());
+            disconnect();
+        }
+    }
+
+    // report lock to the kernel module
+    if (m_sin->isTuned() && !m_is_tuned) {
+        ioctl(m_input_dev, TVS_HAS_LOCK);
+        m_is_tuned = 1;
+    } else if (!m_sin->isTuned() && m_is_tuned)
+        m_is_tuned = 0;
+
+    // trigger the stream input state machine
+    m_sin->delPIDs();
+    m_sin->tick();
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Registers the control socket with the reactor again after the stream
+/// input has reopened it
+//////////////////////////////////////////////////////////////////////////
+void CTVSatCtl::updateReactorFDs() {
+    if (!m_reactor || (m_sin->getSocketGeneration() == m_sock_gen))
+        return;
+
+    m_reactor->remove(m_sock_fd);
+
+    m_sock_fd = m_sin->getSocketFD();
+    m_sock_gen = m_sin->getSocketGeneration();
+
+    // the responses are still picked up by the ticks, just a little later
+    if (!m_reactor->add(m_sock_fd, this, EPOLLIN | EPOLLET))
+        logErr("Failed to register new control socket of %s with reactor",
+               m_ip_addr.c_str());
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Checks for the input device in reactor mode, when /dev has changed or
+/// the timer has expired
+///
+/// Once the input device is open, the device is served like any other.
+/// If it doesn't show up in time, the controller fails.
+//////////////////////////////////////////////////////////////////////////
+void CTVSatCtl::waitForInputDevice() {
+    char buf[4096];
+
+    if (m_inotify_fd >= 0)
+        while (read(m_inotify_fd, buf, sizeof(buf)) > 0);
+
+    uint64_t expirations;
+
+    while (read(m_timer_fd, &expirations, sizeof(expirations)) > 0);
+
+    if (tryOpenInputDevice()) {
+        if (m_inotify_fd >= 0) {
+            m_reactor->remove(m_inotify_fd);
+            close(m_inotify_fd);
+            m_inotify_fd = -1;
+        }
+
+        if (!attachReactor()) {
+            logErr("ERROR: Failed to register %s with reactor", m_ip_addr.c_str());
+            fail();
+        }
+
+        return;
+    }
+
+    timeval now;
+    gettimeofday(&now, 0);
+
+    if (timercmp(&now, &m_input_deadline, <))
+        return;
+
+    logErr("ERROR: Failed to open input device %s", m_input_dev_name.c_str());
+    fail();
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Starts watching /dev for new device nodes
+/// @return an inotify instance (non-blocking), or -1 if inotify isn't
+///         available
+//////////////////////////////////////////////////////////////////////////
+int CTVSatCtl::watchDevDirectory() {
+    int in_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+
+    if ((in_fd >= 0) && (inotify_add_watch(in_fd, "/dev", IN_CREATE | IN_ATTRIB | IN_MOVED_TO) < 0)) {
+        close(in_fd);
+        in_fd = -1;
+    }
+
+    return in_fd;
+}
@@ -31,29 +31,95 @@
 #define __TVSATCTL_H
 
 #include "../include/tvsat.h"
+#include "reactor.h"
 #include "streamin.h"
 
 //////////////////////////////////////////////////////////////////////////
 // DEFINITIONS
 //////////////////////////////////////////////////////////////////////////
 #define TVSAT_DEV_CONTROL_DEVICE_NAME  "/dev/" TVSAT_CONTROL_DEVICE_NAME
+#define TVSAT_INPUT_DEVICE_TIMEOUT     5000 // ms
+
+//////////////////////////////////////////////////////////////////////////
+/// State of a CTVSatCtl that is handed over to another process
+//////////////////////////////////////////////////////////////////////////
+struct STVSatCtlState {
+    tvsat_dev_id dev_id;
+    int32_t has_last_tune;
+    int32_t is_tuned;
+    tvsat_tuning_parameters last_tune;
+    /// Remaining linger time in ms (0, if the device isn't lingering)
+    int32_t linger_left;
+    SStreamInState sin;
+};
 
 //////////////////////////////////////////////////////////////////////////
 /// dLAN TV Sat Control
 //////////////////////////////////////////////////////////////////////////
-class CTVSatCtl {
+class CTVSatCtl : public CReactorHandler {
 public:
-    CTVSatCtl(std::string &client_ip, std::string &device_ip, uint8_t *device_mac, int adapter_num, bool verbose);
+    CTVSatCtl(std::string &client_ip, std::string &device_ip, uint8_t *device_mac, int adapter_num,
+              const config_t &config, bool verbose);
+
+    CTVSatCtl(std::string &client_ip, std::string &device_ip, uint8_t *device_mac,
+              const STVSatCtlState &state, int sock_fd, int stream_fd, int input_fd,
+              const config_t &config, bool verbose);
 
     ~CTVSatCtl();
 
+    /// Gets the number of the DVB adapter the kernel module registered the
+    /// device as, which isn't necessarily the requested one
+    int getAdapterNum() const { return m_dev_id.adapter; }
+
+    /// Gets the number of keepalive requests that went unanswered
+    int getKeepaliveFailures() const { return m_sin->getKeepaliveFailures(); }
+
+    /// Gets the counters for the metrics endpoint
+    const SStreamInMetrics &getMetrics() const { return m_sin->getMetrics(); }
+
+    /// Gets the port the stream is received on
+    uint16_t getStreamPort() const { return m_sin->getClientPort(); }
+
     const std::string &getTVSatIP() { return m_ip_addr; }
 
+    /// Gets the stream statistics (0, if they are disabled)
+    const CTSStats *getTSStats() const { return m_sin->getTSStats(); }
+
     const uint8_t *getTVSatMAC() { return m_mac_addr; }
 
+    void handleEvent(int fd, uint32_t events);
+
+    void handOver(STVSatCtlState &state, int &sock_fd, int &stream_fd, int &input_fd);
+
+    /// True, if the controller gave up, e.g. because the input device
+    /// didn't show up (see setLivenessFD())
+    bool hasFailed() const { return m_failed.load(std::memory_order_relaxed); }
+
+    /// True, if a DVB application has the device open, i.e. not if the
+    /// connection only lingers after it was closed
+    bool isInUse() const { return m_sin->isConnectRequested() && !m_lingering; }
+
+    /// Makes the device dump its flight recorder (see flight_recorder_dir)
+    void requestFlightDump() { m_sin->requestFlightDump(); }
+
+    bool openInputDevice(int timeout);
+
     void run();
 
-    void runThreaded();
+    bool runReactor(CReactor *reactor);
+
+    bool runThreaded();
+
+    /// Sets the time the switch gets to process a DiSEqC command in ms
+    void setDiSEqCDelay(int ms) { m_sin->setDiSEqCDelay(ms); }
+
+    /// Sets how long the connection is kept after the device was closed
+    /// in s, which applies from the next time it is closed
+    void setLingerTime(int seconds) { m_linger_time = seconds; }
+
+    /// Sets an eventfd that is signalled when a keepalive request fails
+    /// or the controller gives up
+    void setLivenessFD(int fd) { m_liveness_fd = fd; m_sin->setLivenessFD(fd); }
 
     void stop();
 
@@ -62,24 +128,69 @@ public:
 private:
     CTVSatCtl() {};
 
+    bool attachReactor();
+
+    void detachReactor();
+
+    void disconnect();
+
+    void fail();
+
     void handleExitSignal(int signal);
 
+    void init(std::string &client_ip, std::string &device_ip, uint8_t *device_mac,
+              const config_t &config, bool verbose);
+
+    void processEvents();
+
     void selectPID(const tvsat_pid_selection *pid);
 
+    static bool sameTuning(const tvsat_tuning_parameters *tune1, const tvsat_tuning_parameters *tune2);
+
     void tune(const tvsat_tuning_parameters *tune);
 
     static void *startThread(void *tvsat_ctl);
 
+    bool tryOpenInputDevice();
+
+    void update();
+
+    void updateReactorFDs();
+
+    void waitForInputDevice();
+
+    static int watchDevDirectory();
+
+    sched_config_t m_control_sched;
     tvsat_dev_id m_dev_id;
+    int m_events_pollable;
+    std::atomic<int> m_failed;
+    int m_handoff;
+    int m_has_last_tune;
     int m_init;
+    timeval m_input_deadline;
     int m_input_dev;
+    std::string m_input_dev_name;
+    int m_inotify_fd;
     std::string m_ip_addr;
     int m_is_tuned;
+    tvsat_tuning_parameters m_last_tune;
+    int m_lc;
+    std::atomic<int> m_linger_time;
+    timeval m_linger_until;
+    std::atomic<int> m_lingering;
+    int m_liveness_fd;
     uint8_t m_mac_addr[6];
+    CReactor *m_reactor;
     int m_run;
     pthread_mutex_t m_run_access;
     CTVSatStreamIn *m_sin;
+    int m_sock_fd;
+    int m_sock_gen;
+    int m_stream_fd;
     pthread_t m_thread;
+    int m_thread_started;
+    int m_timer_fd;
     bool m_verbose;
 };
 
@@ -0,0 +1,743 @@
+//////////////////////////////////////////////////////////////////////////
+// devolo dLAN TV Sat control application
+// Copyright (C) 2008 devolo AG. All rights reserved.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//
+// Contact information:
+//    devolo AG
+//    Sonnenweg 11
+//    D-52070 Aachen, Germany
+//    gpl@devolo.de
+//////////////////////////////////////////////////////////////////////////
+/// @file tvsatemu.cpp
+/// @brief "dLAN TV Sat Device Emulator" - implementation
+//////////////////////////////////////////////////////////////////////////
+
+#include <arpa/inet.h>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <getopt.h>
+#include <iostream>
+#include <netinet/ip.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "discover.h"
+#include "log.h"
+#include "streamin.h"
+#include "tvsatemu.h"
+
+#define HELPTXT    "tvsatemu - emulates a dLAN TV Sat device on the local host\n"\
+        "Usage: tvsatemu [options]\n"\
+        "\n"\
+        "Options:\n"\
+        "  -a ip        --address ip    IP address reported to clients (default: the\n"\
+        "                               address a request was received on)\n"\
+        "  -b ip        --bind ip       bind the control socket to 'ip' (default: all\n"\
+        "                               addresses; needed to run several emulators)\n"\
+        "  -f file      --file file     stream the TS packets of 'file' in a loop\n"\
+        "                               instead of synthetic packets\n"\
+        "  -h           --help          show this help text\n"\
+        "  -l ms        --lock ms       time from tuning to signal lock (default: 200)\n"\
+        "  -m mac       --mac mac       MAC address of the device\n"\
+        "                               (default: 00:0b:3b:00:00:01)\n"\
+        "  -p port      --port port     control port (default: 11111)\n"\
+        "  -L ms        --latency ms    delay every response by 'ms' (default: 0)\n"\
+        "  -r kbit/s    --rate kbit/s   stream bitrate (default: 38000)\n"\
+        "  -v           --verbose       log every request\n"\
+        "  -x percent   --loss percent  drop 'percent' of the responses (default: 0)\n"\
+        "\n"\
+        "Statistics are printed on exit (SIGINT/SIGTERM).\n"
+
+static option long_opts[] = {
+        {"address", required_argument, 0, 'a'},
+        {"bind",    required_argument, 0, 'b'},
+        {"file",    required_argument, 0, 'f'},
+        {"help",    no_argument,       0, 'h'},
+        {"latency", required_argument, 0, 'L'},
+        {"lock",    required_argument, 0, 'l'},
+        {"mac",     required_argument, 0, 'm'},
+        {"port",    required_argument, 0, 'p'},
+        {"rate",    required_argument, 0, 'r'},
+        {"loss",    required_argument, 0, 'x'},
+        {"verbose", no_argument,       0, 'v'},
+        {0, 0, 0, 0}
+};
+
+static volatile int stop = 0;
+
+//////////////////////////////////////////////////////////////////////////
+/// Constructor
+//////////////////////////////////////////////////////////////////////////
+CTVSatEmu::CTVSatEmu(const SEmuConfig &config) {
+    m_config = config;
+
+    m_connected = false;
+    m_file = 0;
+    m_filter_all = false;
+    m_lock_time = 0;
+    m_next_frame = 0;
+    m_requests = 0;
+    m_responses_dropped = 0;
+    m_sock = -1;
+    m_stream_bytes = 0;
+    m_stream_frames = 0;
+    m_stream_sock = -1;
+    m_streaming = false;
+    m_tuned = false;
+
+    memset(m_cc, 0, sizeof(m_cc));
+    memset(&m_stream_dst, 0, sizeof(sockaddr_in));
+    m_pid_it = m_pids.end();
+
+    // an erased EEPROM with a user data block that enables DHCP
+    memset(m_eeprom, 0xff, sizeof(m_eeprom));
+
+    NvsUserData *nvs = (NvsUserData *) (m_eeprom + cUserDataAddr);
+    memset(nvs, 0, sizeof(NvsUserData));
+    nvs->mFlg[0] = 1;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Destructor
+//////////////////////////////////////////////////////////////////////////
+CTVSatEmu::~CTVSatEmu() {
+    if (m_sock >= 0)
+        close(m_sock);
+
+    if (m_stream_sock >= 0)
+        close(m_stream_sock);
+
+    if (m_file)
+        fclose(m_file);
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Fills a stream frame with TS packets of the selected PIDs
+/// @return the number of packets in the frame
+//////////////////////////////////////////////////////////////////////////
+int CTVSatEmu::fillFrame(uint8_t *frame) {
+    int num = 0;
+
+    for (int i = 0; i < TVSAT_EMU_TSP_PER_FRAME; ++i) {
+        uint8_t *tsp = frame + num * TVSAT_TSP_SIZE;
+
+        if (m_file) {
+            if (fillFromFile(tsp))
+                ++num;
+        } else if (!m_pids.empty()) {
+            fillSynthetic(tsp);
+            ++num;
+        }
+    }
+
+    return num;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Reads the next packet of a selected PID from the TS file
+///
+/// The file is read in a loop. Bytes before a sync byte are skipped.
+///
+/// @return true, if a packet was read
+/// @return false, if the file doesn't contain any selected PID
+//////////////////////////////////////////////////////////////////////////
+bool CTVSatEmu::fillFromFile(uint8_t *tsp) {
+    // give up after a full pass of a large file
+    for (int tries = 0; tries < 100000; ++tries) {
+        int c = fgetc(m_file);
+
+        if (c == EOF) {
+            rewind(m_file);
+            continue;
+        }
+
+        if (c != 0x47)
+            continue;
+
+        tsp[0] = 0x47;
+
+        if (fread(tsp + 1, 1, TVSAT_TSP_SIZE - 1, m_file) != TVSAT_TSP_SIZE - 1) {
+            rewind(m_file);
+            continue;
+        }
+
+        uint16_t pid = ((tsp[1] & 0x1f) << 8) | tsp[2];
+
+        if (m_filter_all || (m_pids.find(pid) != m_pids.end()))
+            return true;
+    }
+
+    return false;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Creates a synthetic packet for the next selected PID
+///
+/// The payload holds the number of the packet, so gaps can be spotted in
+/// a capture.
+//////////////////////////////////////////////////////////////////////////
+void CTVSatEmu::fillSynthetic(uint8_t *tsp) {
+    if ((m_pid_it == m_pids.end()) || (++m_pid_it == m_pids.end()))
+        m_pid_it = m_pids.begin();
+
+    uint16_t pid = *m_pid_it;
+
+    tsp[0] = 0x47;
+    tsp[1] = (pid >> 8) & 0x1f;
+    tsp[2] = pid & 0xff;
+    tsp[3] = 0x10 | m_cc[pid];
+    m_cc[pid] = (m_cc[pid] + 1) & 0x0f;
+
+    uint64_t seq = m_stream_frames * TVSAT_EMU_TSP_PER_FRAME;
+    memcpy(tsp + 4, &seq, sizeof(seq));
+    memset(tsp + 4 + sizeof(seq), 0xff, TVSAT_TSP_SIZE - 4 - sizeof(seq));
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Answers a single request
+///
+/// @param req the request
+/// @param len the size of the request
+/// @param resp buffer for the response (IP_MAXPACKET bytes)
+/// @param local_ip the address the request was received on
+/// @return the size of the response (0: no response)
+//////////////////////////////////////////////////////////////////////////
+uint16_t CTVSatEmu::handleRequest(const uint8_t *req, size_t len, uint8_t *resp, const in_addr &local_ip) {
+    if (len < sizeof(RequestHeader))
+        return 0;
+
+    const RequestHeader *rqh = (const RequestHeader *) req;
+    uint16_t cmd = ntohs(rqh->mCommand);
+
+    // a request for a specific device that is wrapped in a broadcast
+    if (cmd == cCmdBroadcastCmd) {
+        if (len < sizeof(RequestBroadcastCmd))
+            return 0;
+
+        const RequestBroadcastCmd *rqbc = (const RequestBroadcastCmd *) req;
+
+        if (memcmp(rqbc->mDstMac, m_config.mac, 6) != 0)
+            return 0;
+
+        return handleRequest(req + sizeof(RequestBroadcastCmd), len - sizeof(RequestBroadcastCmd), resp, local_ip);
+    }
+
+    ++m_requests;
+
+    ResponseHeader *rsh = (ResponseHeader *) resp;
+    uint16_t size = sizeof(ResponseHeader);
+    uint16_t resp_cmd = cmd;
+    uint16_t result = 0;
+
+    memset(resp, 0, IP_MAXPACKET);
+
+    if (m_config.verbose)
+        printf("Request 0x%04x (%u bytes)\n", cmd, (unsigned) len);
+
+    switch (cmd) {
+        case cCmdGetInfo: {
+            ResponseGetInfo *rgi = (ResponseGetInfo *) resp;
+            in_addr ip = local_ip;
+
+            if (!m_config.dev_ip.empty())
+                inet_aton(m_config.dev_ip.c_str(), &ip);
+
+            rgi->mInterfaceVersion = htons(1);
+            memcpy(rgi->mIpAddress, &ip.s_addr, 4);
+            memcpy(rgi->mMacAddress, m_config.mac, 6);
+            rgi->mDeviceType = 1;
+            rgi->mTunerType = 1;
+            rgi->mFirmwareVersion = htons(0x0100);
+            strncpy((char *) rgi->mSerialNumber, "EMULATOR", sizeof(rgi->mSerialNumber));
+            size = sizeof(ResponseGetInfo);
+            break;
+        }
+
+        case cCmdConnect:
+            m_connected = true;
+            break;
+
+        case cCmdDisconnect:
+            m_connected = false;
+            m_streaming = false;
+            break;
+
+        case cCmdFeDiseqcSendBurst:
+        case cCmdFeDiseqcSendMasterCommand:
+        case cCmdFeSetTone:
+        case cCmdFeSetVoltage:
+        case cCmdTseSetConfig:
+            break;
+
+        case cCmdFeReadStatus: {
+            ResponseFeReadStatus *rfrs = (ResponseFeReadStatus *) resp;
+
+            if (m_tuned && (nowNS() >= m_lock_time))
+                rfrs->mData = htons(0x1f);
+
+            size = sizeof(ResponseFeReadStatus);
+            break;
+        }
+
+        case cCmdFeSetFrontend:
+            if (len < sizeof(RequestFeSetFrontend)) {
+                result = 1;
+                break;
+            }
+
+            if (m_config.verbose) {
+                const RequestFeSetFrontend *rfsf = (const RequestFeSetFrontend *) req;
+                printf("Tuning to %u kHz, %u kSym/s\n", ntohl(rfsf->mFrequency),
+                       ntohl(rfsf->mUnion.mS2.mSymbolRate));
+            }
+
+            m_tuned = true;
+            m_lock_time = nowNS() + (uint64_t) m_config.lock_delay * 1000000;
+            break;
+
+        case cCmdNvsEepromRead:
+        case cCmdNvsEepromVerify:
+        case cCmdNvsEepromWrite: {
+            if (len < sizeof(RequestNvsEepromRead)) {
+                result = 1;
+                break;
+            }
+
+            const RequestNvsEepromRead *rqn = (const RequestNvsEepromRead *) req;
+            uint32_t addr = ntohl(rqn->mAddr);
+            uint32_t nvs_len = ntohl(rqn->mLen);
+
+            if ((nvs_len > sizeof(rqn->mData)) || (addr + nvs_len > TVSAT_EMU_EEPROM_SIZE)) {
+                result = 1;
+                break;
+            }
+
+            if (cmd == cCmdNvsEepromRead) {
+                ResponseNvsEepromRead *rner = (ResponseNvsEepromRead *) resp;
+                rner->mAddr = rqn->mAddr;
+                rner->mLen = rqn->mLen;
+                memcpy(rner->mData, m_eeprom + addr, nvs_len);
+                size = sizeof(ResponseNvsEepromRead);
+            } else if (cmd == cCmdNvsEepromWrite)
+                memcpy(m_eeprom + addr, rqn->mData, nvs_len);
+            else if (memcmp(m_eeprom + addr, rqn->mData, nvs_len) != 0)
+                result = 1;
+
+            break;
+        }
+
+        case cCmdReboot:
+            // the device says goodbye with a disconnect response
+            printf("Reboot requested\n");
+            m_connected = false;
+            m_streaming = false;
+            m_tuned = false;
+            resp_cmd = cCmdDisconnect;
+            break;
+
+        case cCmdStart: {
+            if (len < sizeof(RequestStart)) {
+                result = 1;
+                break;
+            }
+
+            const RequestStart *rs = (const RequestStart *) req;
+            m_stream_dst.sin_family = AF_INET;
+            memcpy(&m_stream_dst.sin_addr.s_addr, rs->mClientIpAddress, 4);
+            m_stream_dst.sin_port = rs->mRecvPort;
+            m_next_frame = nowNS();
+            m_streaming = true;
+            break;
+        }
+
+        case cCmdStop:
+            m_streaming = false;
+            break;
+
+        case cCmdTseStart2: {
+            if (len < sizeof(RequestHeader) + 4) {
+                result = 1;
+                break;
+            }
+
+            const RequestTseStart2 *rts = (const RequestTseStart2 *) req;
+            uint16_t num_pids = ntohs(rts->mNumPids);
+
+            if (num_pids > 168)
+                num_pids = 168;
+
+            m_pids.clear();
+            m_filter_all = false;
+
+            for (uint16_t i = 0; (i < num_pids) && (sizeof(RequestHeader) + 4 + (i + 1) * 2 <= len); ++i) {
+                uint16_t pid = ntohs(rts->mPids[i]);
+
+                if (pid >= 0x2000)
+                    m_filter_all = true;
+                else
+                    m_pids.insert(pid);
+            }
+
+            m_pid_it = m_pids.end();
+            break;
+        }
+
+        default:
+            if (m_config.verbose)
+                printf("Unknown command 0x%04x\n", cmd);
+
+            result = 1;
+            break;
+    }
+
+    rsh->mSize = htons(size);
+    rsh->mCommand = htons(resp_cmd);
+    rsh->mResult = htons(result);
+
+    return size;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Gets a monotonic timestamp in nanoseconds
+//////////////////////////////////////////////////////////////////////////
+uint64_t CTVSatEmu::nowNS() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Opens the sockets and the TS file
+/// @return true, if successful
+/// @return false, otherwise
+//////////////////////////////////////////////////////////////////////////
+bool CTVSatEmu::open() {
+    if (!m_config.ts_file.empty()) {
+        m_file = fopen(m_config.ts_file.c_str(), "rb");
+
+        if (!m_file) {
+            std::cerr << "Error: can't open " << m_config.ts_file << std::endl;
+            return false;
+        }
+    }
+
+    m_sock = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, IPPROTO_UDP);
+    m_stream_sock = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, IPPROTO_UDP);
+
+    if ((m_sock < 0) || (m_stream_sock < 0)) {
+        std::cerr << "Error: socket() failed" << std::endl;
+        return false;
+    }
+
+    int on = 1;
+    setsockopt(m_sock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    setsockopt(m_sock, SOL_SOCKET, SO_BROADCAST, &on, sizeof(on));
+    setsockopt(m_sock, IPPROTO_IP, IP_PKTINFO, &on, sizeof(on));
+
+    sockaddr_in sa;
+    memset(&sa, 0, sizeof(sockaddr_in));
+    sa.sin_family = AF_INET;
+    sa.sin_port = htons(m_config.port);
+    sa.sin_addr.s_addr = htonl(INADDR_ANY);
+
+    if (!m_config.bind_ip.empty() && !inet_aton(m_config.bind_ip.c_str(), &sa.sin_addr)) {
+        std::cerr << "Error: invalid bind address" << std::endl;
+        return false;
+    }
+
+    if (bind(m_sock, (sockaddr *) &sa, sizeof(sockaddr_in)) < 0) {
+        std::cerr << "Error: bind() failed: " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    // send the stream from the device's address
+    if (!m_config.bind_ip.empty()) {
+        sa.sin_port = 0;
+        bind(m_stream_sock, (sockaddr *) &sa, sizeof(sockaddr_in));
+    }
+
+    return true;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Prints the request and stream counters
+//////////////////////////////////////////////////////////////////////////
+void CTVSatEmu::printStats() const {
+    printf("Requests: %llu (%llu responses dropped)\n", (unsigned long long) m_requests,
+           (unsigned long long) m_responses_dropped);
+    printf("Stream:   %llu frames, %llu bytes\n", (unsigned long long) m_stream_frames,
+           (unsigned long long) m_stream_bytes);
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Answers all requests that are waiting in the control socket
+//////////////////////////////////////////////////////////////////////////
+void CTVSatEmu::processControl() {
+    uint8_t req[IP_MAXPACKET];
+    uint8_t resp[IP_MAXPACKET];
+
+    while (1) {
+        sockaddr_in src;
+        char cbuf[CMSG_SPACE(sizeof(in_pktinfo))];
+
+        iovec iov;
+        iov.iov_base = req;
+        iov.iov_len = sizeof(req);
+
+        msghdr msg;
+        memset(&msg, 0, sizeof(msghdr));
+        msg.msg_name = &src;
+        msg.msg_namelen = sizeof(sockaddr_in);
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = cbuf;
+        msg.msg_controllen = sizeof(cbuf);
+
+        ssize_t len = recvmsg(m_sock, &msg, MSG_DONTWAIT);
+
+        if (len <= 0)
+            return;
+
+        in_addr local_ip;
+        local_ip.s_addr = htonl(INADDR_LOOPBACK);
+
+        for (cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+            if ((cmsg->cmsg_level == IPPROTO_IP) && (cmsg->cmsg_type == IP_PKTINFO))
+                local_ip = ((in_pktinfo *) CMSG_DATA(cmsg))->ipi_spec_dst;
+
+        uint16_t size = handleRequest(req, len, resp, local_ip);
+
+        if (!size)
+            continue;
+
+        if (m_config.resp_loss && (rand() % 100 < m_config.resp_loss)) {
+            ++m_responses_dropped;
+            continue;
+        }
+
+        if (!m_config.resp_delay) {
+            sendto(m_sock, resp, size, 0, (sockaddr *) &src, sizeof(sockaddr_in));
+            continue;
+        }
+
+        // the delay is the same for all responses, so the queue stays
+        // sorted by due time
+        SEmuResponse r;
+        r.dst = src;
+        r.due = nowNS() + (uint64_t) m_config.resp_delay * 1000000;
+        r.data.assign(resp, resp + size);
+        m_responses.push_back(r);
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Serves requests and sends the stream until stop is set
+//////////////////////////////////////////////////////////////////////////
+void CTVSatEmu::run(volatile int &stop) {
+    while (!stop) {
+        int timeout = 100;
+        bool stream = m_streaming && m_tuned && (nowNS() >= m_lock_time);
+
+        if (stream) {
+            uint64_t now = nowNS();
+            timeout = (m_next_frame > now) ? (m_next_frame - now) / 1000000 : 0;
+        }
+
+        if (!m_responses.empty()) {
+            uint64_t now = nowNS();
+            int due = (m_responses.front().due > now) ? (m_responses.front().due - now + 999999) / 1000000 : 0;
+
+            if (due < timeout)
+                timeout = due;
+        }
+
+        pollfd pfd;
+        pfd.fd = m_sock;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+
+        if (poll(&pfd, 1, timeout) > 0)
+            processControl();
+
+        sendResponses();
+
+        if (stream)
+            sendStream();
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Sends all delayed responses that are due
+//////////////////////////////////////////////////////////////////////////
+void CTVSatEmu::sendResponses() {
+    uint64_t now = nowNS();
+
+    while (!m_responses.empty() && (m_responses.front().due <= now)) {
+        const SEmuResponse &r = m_responses.front();
+        sendto(m_sock, &r.data[0], r.data.size(), 0, (sockaddr *) &r.dst, sizeof(sockaddr_in));
+        m_responses.pop_front();
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Sends all stream frames that are due
+///
+/// The frames are paced by the configured bitrate. If we fall behind by
+/// more than 100 ms, the missed frames are dropped instead of being sent
+/// in a burst.
+//////////////////////////////////////////////////////////////////////////
+void CTVSatEmu::sendStream() {
+    const uint64_t frame_bits = TVSAT_EMU_TSP_PER_FRAME * TVSAT_TSP_SIZE * 8;
+    uint64_t interval = frame_bits * 1000000000ULL / m_config.bitrate;
+    uint64_t now = nowNS();
+    uint8_t frame[TVSAT_EMU_TSP_PER_FRAME * TVSAT_TSP_SIZE];
+
+    if (now > m_next_frame + 100000000ULL)
+        m_next_frame = now;
+
+    while (m_next_frame <= now) {
+        m_next_frame += interval;
+
+        int num = fillFrame(frame);
+
+        if (!num)
+            continue;
+
+        ssize_t len = sendto(m_stream_sock, frame, num * TVSAT_TSP_SIZE, 0, (sockaddr *) &m_stream_dst,
+                             sizeof(sockaddr_in));
+
+        if (len > 0) {
+            ++m_stream_frames;
+            m_stream_bytes += len;
+        }
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Ends the main loop
+/// @param signum signal (not used)
+//////////////////////////////////////////////////////////////////////////
+static void handleExitSignal(int signum) {
+    stop = 1;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// tvsatemu main function
+//////////////////////////////////////////////////////////////////////////
+int main(int argc, char **argv) {
+    SEmuConfig config;
+    config.bitrate = 38000000;
+    config.lock_delay = 200;
+    config.port = 11111;
+    config.resp_delay = 0;
+    config.resp_loss = 0;
+    config.verbose = false;
+    parseMAC(config.mac, "00:0b:3b:00:00:01");
+
+    // the socket errors are meant for the user
+    openlog("tvsatemu", LOG_PERROR, LOG_USER);
+
+    int c, optidx;
+
+    while ((c = getopt_long(argc, argv, "a:b:f:hL:l:m:p:r:vx:", long_opts, &optidx)) != -1) {
+        switch (c) {
+            case 'a':
+                config.dev_ip = optarg;
+                break;
+
+            case 'b':
+                config.bind_ip = optarg;
+                break;
+
+            case 'f':
+                config.ts_file = optarg;
+                break;
+
+            case 'L':
+                config.resp_delay = atoi(optarg);
+
+                if (config.resp_delay < 0) {
+                    std::cerr << "Error: invalid latency" << std::endl;
+                    return 1;
+                }
+
+                break;
+
+            case 'l':
+                config.lock_delay = atoi(optarg);
+                break;
+
+            case 'm':
+                if (parseMAC(config.mac, optarg) != 0) {
+                    std::cerr << "Error: invalid MAC address" << std::endl;
+                    return 1;
+                }
+
+                break;
+
+            case 'p':
+                config.port = atoi(optarg);
+                break;
+
+            case 'r':
+                config.bitrate = strtoull(optarg, 0, 10) * 1000;
+
+                if (config.bitrate == 0) {
+                    std::cerr << "Error: invalid bitrate" << std::endl;
+                    return 1;
+                }
+
+                break;
+
+            case 'v':
+                config.verbose = true;
+                break;
+
+            case 'x':
+                config.resp_loss = atoi(optarg);
+
+                if ((config.resp_loss < 0) || (config.resp_loss > 100)) {
+                    std::cerr << "Error: invalid loss" << std::endl;
+                    return 1;
+                }
+
+                break;
+
+            default:
+                std::cout << HELPTXT;
+                return 0;
+        }
+    }
+
+    signal(SIGINT, handleExitSignal);
+    signal(SIGTERM, handleExitSignal);
+    srand(time(0));
+
+    CTVSatEmu emu(config);
+
+    if (!emu.open())
+        return 1;
+
+    emu.run(stop);
+    emu.printStats();
+
+    return 0;
+}
@@ -0,0 +1,134 @@
+//////////////////////////////////////////////////////////////////////////
+// devolo dLAN TV Sat control application
+// Copyright (C) 2008 devolo AG. All rights reserved.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//
+// Contact information:
+//    devolo AG
+//    Sonnenweg 11
+//    D-52070 Aachen, Germany
+//    gpl@devolo.de
+//////////////////////////////////////////////////////////////////////////
+/// @file tvsatemu.h
+/// @brief "dLAN TV Sat Device Emulator" - header
+//////////////////////////////////////////////////////////////////////////
+
+#ifndef __TVSATEMU_H
+#define __TVSATEMU_H
+
+#include <deque>
+#include <netinet/in.h>
+#include <set>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+//////////////////////////////////////////////////////////////////////////
+// DEFINITIONS
+//////////////////////////////////////////////////////////////////////////
+#define TVSAT_EMU_EEPROM_SIZE          0x8000
+#define TVSAT_EMU_TSP_PER_FRAME        7
+#define TVSAT_TSP_SIZE                 188
+
+//////////////////////////////////////////////////////////////////////////
+/// Settings of the emulated device
+//////////////////////////////////////////////////////////////////////////
+struct SEmuConfig {
+    /// Stream bitrate in bit/s
+    uint64_t bitrate;
+    /// Address to bind the control socket to (empty: all addresses)
+    std::string bind_ip;
+    /// Address reported in GetInfo responses (empty: the receiving one)
+    std::string dev_ip;
+    /// Time from SetFrontend to signal lock in ms
+    int lock_delay;
+    uint8_t mac[6];
+    uint16_t port;
+    /// Delay of every response in ms
+    int resp_delay;
+    /// Share of responses that are dropped in percent
+    int resp_loss;
+    /// TS file to stream instead of synthetic packets (looped)
+    std::string ts_file;
+    bool verbose;
+};
+
+//////////////////////////////////////////////////////////////////////////
+/// A response that waits for its injected delay to pass
+//////////////////////////////////////////////////////////////////////////
+struct SEmuResponse {
+    sockaddr_in dst;
+    uint64_t due;
+    std::vector<uint8_t> data;
+};
+
+//////////////////////////////////////////////////////////////////////////
+/// Emulates the control protocol and the stream output of a NAT device
+//////////////////////////////////////////////////////////////////////////
+class CTVSatEmu {
+public:
+    CTVSatEmu(const SEmuConfig &config);
+
+    ~CTVSatEmu();
+
+    bool open();
+
+    void printStats() const;
+
+    void run(volatile int &stop);
+
+private:
+    int fillFrame(uint8_t *frame);
+
+    bool fillFromFile(uint8_t *tsp);
+
+    void fillSynthetic(uint8_t *tsp);
+
+    uint16_t handleRequest(const uint8_t *req, size_t len, uint8_t *resp, const in_addr &local_ip);
+
+    void processControl();
+
+    void sendResponses();
+
+    void sendStream();
+
+    static uint64_t nowNS();
+
+    SEmuConfig m_config;
+
+    bool m_connected;
+    uint8_t m_cc[0x2000];
+    uint8_t m_eeprom[TVSAT_EMU_EEPROM_SIZE];
+    FILE *m_file;
+    bool m_filter_all;
+    uint64_t m_lock_time;
+    uint64_t m_next_frame;
+    std::set<uint16_t> m_pids;
+    std::set<uint16_t>::const_iterator m_pid_it;
+    uint64_t m_requests;
+    std::deque<SEmuResponse> m_responses;
+    uint64_t m_responses_dropped;
+    int m_sock;
+    uint64_t m_stream_bytes;
+    uint64_t m_stream_frames;
+    sockaddr_in m_stream_dst;
+    int m_stream_sock;
+    bool m_streaming;
+    bool m_tuned;
+};
+
+#endif
@@ -27,6 +27,7 @@
 /// @author Michael Beckers
 //////////////////////////////////////////////////////////////////////////
 
+#include <algorithm>
 #include <cstdlib>
 #include <cstring>
 #include <fcntl.h>
@@ -35,18 +36,28 @@
 #include <list>
 #include <net/if.h>
 #include <netinet/ip.h>
+#include <poll.h>
+#include <set>
+#include <unordered_set>
 #include <utility>
 #include <signal.h>
 #include <string>
+#include <sys/eventfd.h>
 #include <sys/ioctl.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <stdio.h>
 #include <unistd.h>
+#include <vector>
 
 #include "config.h"
 #include "discover.h"
+#include "handoff.h"
+#include "ifmonitor.h"
 #include "log.h"
+#include "metrics.h"
+#include "reactor.h"
+#include "threadsched.h"
 #include "tvsatctl.h"
 #include "tvsatmgr.h"
 #include "udpsocket.h"
@@ -54,8 +65,16 @@
 //////////////////////////////////////////////////////////////////////////
 // GLOBAL VARIABLES
 //////////////////////////////////////////////////////////////////////////
+volatile sig_atomic_t dump_flight = 0;
+volatile sig_atomic_t dump_stats = 0;
+volatile sig_atomic_t reload = 0;
 bool stop = false;
 
+// wakes the main loop up; signalled by the device controllers when a
+// keepalive request fails or they give up and by the SIGHUP, SIGUSR1 and
+// SIGUSR2 handlers
+int wake_fd = -1;
+
 //////////////////////////////////////////////////////////////////////////
 /// Prepares and forks a new background process and terminates the
 /// original one
@@ -99,9 +118,11 @@ static void daemonize() {
 static void printHelp() {
     printf("tvsatctl is a program for controlling the devolo dLAN TV-Sat network receiver.\n\n");
     printf("It takes the following options:\n");
-    printf("-d|--daemon  - runs the program as a daemon\n");
-    printf("-v|--verbose - outputs more logs to help with debugging\n");
-    printf("-h|--help    - displays this message\n");
+    printf("-d|--daemon   - runs the program as a daemon\n");
+    printf("-t|--takeover - takes the devices over from a running daemon\n");
+    printf("                without interrupting their streams\n");
+    printf("-v|--verbose  - outputs more logs to help with debugging\n");
+    printf("-h|--help     - displays this message\n");
 }
 
 //////////////////////////////////////////////////////////////////////////
@@ -113,146 +134,1140 @@ static void handleExitSignal(int signum) {
 }
 
 //////////////////////////////////////////////////////////////////////////
-/// Updates the lists of new and missing devices
+/// Tells the controller to log the stream statistics
+/// @param signum signal (not used)
 //////////////////////////////////////////////////////////////////////////
-static void updateDeviceLists(std::list<STVSatDev> &fdevs,
-                              std::list<STVSatDev> &ndevs,
-                              std::map<STVSatDev, int> &mdevs,
-                              std::list<CTVSatCtl *> &ctls,
-                              const config_t &cfg,
-                              bool verbose) {
-    std::list<STVSatDev>::iterator fd_it, nd_it;
-    std::map<STVSatDev, int>::iterator md_it;
-    std::list<CTVSatCtl *>::iterator c_it;
-    std::map<std::string, uint8_t>::const_iterator dm_it, dm_it2;
+static void handleDumpSignal(int signum) {
+    dump_stats = 1;
 
-    // remove discovered devices from the list of missing devices
-    for (fd_it = fdevs.begin(); fd_it != fdevs.end(); ++fd_it) {
-        md_it = mdevs.find(*fd_it);
+    if (wake_fd >= 0) {
+        uint64_t one = 1;
 
-        if (md_it != mdevs.end())
-            mdevs.erase(md_it);
+        if (write(wake_fd, &one, sizeof(one)) < 0)
+            return;
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Tells the controller to dump the flight recorders of the devices
+/// @param signum signal (not used)
+//////////////////////////////////////////////////////////////////////////
+static void handleFlightDumpSignal(int signum) {
+    dump_flight = 1;
+
+    if (wake_fd >= 0) {
+        uint64_t one = 1;
+
+        if (write(wake_fd, &one, sizeof(one)) < 0)
+            return;
     }
+}
 
-    // add all discovered devices that aren't already registered to
-    // the list of new devices
-    for (fd_it = fdevs.begin(); fd_it != fdevs.end(); ++fd_it) {
-        bool found = false;
+//////////////////////////////////////////////////////////////////////////
+/// Tells the controller to reload its configuration
+/// @param signum signal (not used)
+//////////////////////////////////////////////////////////////////////////
+static void handleReloadSignal(int signum) {
+    reload = 1;
 
-        for (c_it = ctls.begin(); c_it != ctls.end(); ++c_it)
-            if (memcmp(fd_it->dev_mac, (*c_it)->getTVSatMAC(),
-                       6) == 0)
-                found = true;
+    if (wake_fd >= 0) {
+        uint64_t one = 1;
 
-        if (!found)
-            ndevs.insert(ndevs.end(), *fd_it);
+        if (write(wake_fd, &one, sizeof(one)) < 0)
+            return;
     }
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Creates the controller of a new device and registers the device with
+/// the kernel module
+///
+/// The controller isn't started yet (see startDevices()).
+//////////////////////////////////////////////////////////////////////////
+static CTVSatCtl *addDevice(TDeviceMap &devs, const STVSatDev &dev,
+                            int adapter_num, const config_t &cfg,
+                            bool verbose) {
+    logInf("Adding device at %s", dev.dev_ip.c_str());
+
+    SDevice &sdev = devs[macToKey(dev.dev_mac)];
+    sdev.dev = dev;
+    sdev.ctl = new CTVSatCtl(sdev.dev.net_if.if_ip, sdev.dev.dev_ip,
+                             sdev.dev.dev_mac, adapter_num, cfg,
+                             verbose);
+    sdev.adapter_num = sdev.ctl->getAdapterNum();
+    sdev.requested_adapter = adapter_num;
+    sdev.ctl->setLivenessFD(wake_fd);
+    sdev.keepalive_failures = 0;
+
+    return sdev.ctl;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Stops and deletes the controller of a device
+//////////////////////////////////////////////////////////////////////////
+static void removeDevice(SDevice &dev) {
+    logInf("Removing device at %s", dev.dev.dev_ip.c_str());
 
-    // register the new devices
-    for (nd_it = ndevs.begin(); nd_it != ndevs.end(); ++nd_it) {
-        logInf("Adding device at %s", nd_it->dev_ip.c_str());
+    dev.ctl->stop();
+    delete dev.ctl;
+    dev.ctl = 0;
+}
 
-        int adapter_num = -1;
+//////////////////////////////////////////////////////////////////////////
+/// Starts the controllers of new devices
+///
+/// The devices are started only after all of them have been registered,
+/// so udev creates their input devices in parallel. Devices that can't be
+/// started are removed again, so they aren't left registered without
+/// anybody serving them.
+///
+/// @return the number of devices that have been removed
+//////////////////////////////////////////////////////////////////////////
+static size_t startDevices(TDeviceMap &devs,
+                           const std::vector<CTVSatCtl *> &ctls,
+                           std::vector<CReactor *> &reactors) {
+    size_t failed = 0;
+
+    for (size_t i = 0; i < ctls.size(); ++i) {
+        bool started;
 
-        dm_it = cfg.device_map.find(nd_it->dev_ip);
+        if (reactors.empty())
+            started = ctls[i]->runThreaded();
+        else {
+            // let the least busy reactor serve the new device
+            CReactor *reactor = reactors[0];
 
-        if (dm_it != cfg.device_map.end())
-            adapter_num = dm_it->second;
+            for (size_t r = 1; r < reactors.size(); ++r)
+                if (reactors[r]->getLoad() < reactor->getLoad())
+                    reactor = reactors[r];
 
-        for (dm_it2 = cfg.device_map.begin();
-             dm_it2 != cfg.device_map.end();
-             ++dm_it2) {
-            uint8_t mac[6];
+            started = ctls[i]->runReactor(reactor);
+        }
 
-            if (parseMAC(mac, dm_it2->first.c_str()) != 0)
+        if (started)
+            continue;
+
+        for (TDeviceMap::iterator d_it = devs.begin(); d_it != devs.end();
+             ++d_it) {
+            if (d_it->second.ctl != ctls[i])
                 continue;
 
-            if (memcmp(mac, nd_it->dev_mac, 6) == 0) {
-                adapter_num = dm_it2->second;
-                break;
-            }
+            logErr("Failed to start device at %s",
+                   d_it->second.dev.dev_ip.c_str());
+            removeDevice(d_it->second);
+            devs.erase(d_it);
+            ++failed;
+            break;
+        }
+    }
+
+    return failed;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Removes the devices whose controllers gave up, e.g. because their
+/// input device didn't show up
+///
+/// @return true, if devices have been removed
+/// @return false, otherwise
+//////////////////////////////////////////////////////////////////////////
+static bool removeFailedDevices(TDeviceMap &devs, TMissingMap &mdevs) {
+    bool removed = false;
+    TDeviceMap::iterator d_it = devs.begin();
+
+    while (d_it != devs.end()) {
+        if (!d_it->second.ctl->hasFailed()) {
+            ++d_it;
+            continue;
         }
 
-        int i = 0;
+        mdevs.erase(d_it->first);
+        removeDevice(d_it->second);
+        d_it = devs.erase(d_it);
+        removed = true;
+    }
 
-        while (adapter_num == -1) {
-            bool found = false;
+    return removed;
+}
 
-            for (dm_it = cfg.device_map.begin();
-                 dm_it != cfg.device_map.end();
-                 ++dm_it)
-                if (dm_it->second == i) {
-                    found = true;
-                    break;
-                }
+//////////////////////////////////////////////////////////////////////////
+/// Collects the MAC addresses of all devices we expect to find
+///
+/// These are the devices that are already running and the ones that are
+/// listed in the device map by their MAC address.
+//////////////////////////////////////////////////////////////////////////
+static void getKnownMACs(std::set<uint64_t> &macs, const TDeviceMap &devs,
+                         const SDeviceMap &dmap) {
+    macs.clear();
+
+    for (TDeviceMap::const_iterator d_it = devs.begin();
+         d_it != devs.end(); ++d_it)
+        macs.insert(d_it->first);
+
+    for (std::unordered_map<uint64_t, uint8_t>::const_iterator dm_it =
+                 dmap.by_mac.begin();
+         dm_it != dmap.by_mac.end(); ++dm_it)
+        macs.insert(dm_it->first);
+}
 
-            if (!found)
-                adapter_num = i;
+//////////////////////////////////////////////////////////////////////////
+/// Splits the device map of the configuration into IP and MAC addresses
+//////////////////////////////////////////////////////////////////////////
+static void parseDeviceMap(SDeviceMap &dmap, const config_t &cfg) {
+    std::map<std::string, uint8_t>::const_iterator dm_it;
+
+    for (dm_it = cfg.device_map.begin(); dm_it != cfg.device_map.end();
+         ++dm_it) {
+        uint8_t mac[6];
+
+        dmap.used.insert(dm_it->second);
+
+        if (parseMAC(mac, dm_it->first.c_str()) == 0)
+            dmap.by_mac[macToKey(mac)] = dm_it->second;
+        else
+            dmap.by_ip[dm_it->first] = dm_it->second;
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Gets the adapter number of a new device
+///
+/// A device that is mapped by its MAC address gets that adapter, one that
+/// is mapped by its IP address gets that one and all other devices get
+/// the given fallback or, if there is none, the lowest adapter number
+/// that isn't mapped.
+//////////////////////////////////////////////////////////////////////////
+static int getAdapterNum(const STVSatDev &dev, uint64_t mac,
+                         const SDeviceMap &dmap, int fallback = -1) {
+    std::unordered_map<uint64_t, uint8_t>::const_iterator mac_it =
+            dmap.by_mac.find(mac);
+
+    if (mac_it != dmap.by_mac.end())
+        return mac_it->second;
+
+    std::unordered_map<std::string, uint8_t>::const_iterator ip_it =
+            dmap.by_ip.find(dev.dev_ip);
+
+    if (ip_it != dmap.by_ip.end())
+        return ip_it->second;
+
+    if (fallback >= 0)
+        return fallback;
+
+    int adapter_num = 0;
+
+    while (dmap.used.find(adapter_num) != dmap.used.end())
+        ++adapter_num;
+
+    return adapter_num;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Asks devices directly if they are still there
+///
+/// Each device gets up to liveness_probes unicast requests, one second
+/// apart.
+///
+/// @param pending the devices to ask, only the ones that never replied
+///                are left
+//////////////////////////////////////////////////////////////////////////
+static void probeLiveness(std::list<STVSatDev> &pending,
+                          const config_t &cfg) {
+    for (int i = 0; (i < cfg.liveness_probes) && !pending.empty() && !stop;
+         ++i) {
+        std::list<STVSatDev> found_devs;
+        probeDevices(found_devs, pending);
+
+        for (std::list<STVSatDev>::iterator f_it = found_devs.begin();
+             f_it != found_devs.end(); ++f_it)
+            pending.remove(*f_it);
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Registers the devices from the device cache right away
+///
+/// The cached devices are only unconfirmed until the main loop finds
+/// them (see confirmDevices()).
+//////////////////////////////////////////////////////////////////////////
+static void restoreDevices(TDeviceMap &devs,
+                           std::set<uint64_t> &unconfirmed,
+                           std::vector<CReactor *> &reactors,
+                           const SDeviceMap &dmap,
+                           const config_t &cfg, bool verbose) {
+    std::list<SCachedDev> cdevs;
+
+    if (cfg.device_cache.empty() ||
+        !loadDeviceCache(cdevs, cfg.device_cache) || cdevs.empty())
+        return;
+
+    std::vector<CTVSatCtl *> new_ctls;
+
+    for (std::list<SCachedDev>::iterator it = cdevs.begin();
+         it != cdevs.end(); ++it) {
+        uint64_t mac = macToKey(it->dev.dev_mac);
+
+        if (devs.find(mac) != devs.end())
+            continue;
+
+        int adapter_num = getAdapterNum(it->dev, mac, dmap,
+                                        it->adapter_num);
+
+        new_ctls.push_back(addDevice(devs, it->dev, adapter_num, cfg,
+                                     verbose));
+        unconfirmed.insert(mac);
+    }
+
+    startDevices(devs, new_ctls, reactors);
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Confirms the devices restored from the device cache
+///
+/// The devices that weren't discovered are probed like the ones whose
+/// keepalive requests failed and the ones that don't reply are removed
+/// again.
+///
+/// @return true, if devices have been removed
+/// @return false, otherwise
+//////////////////////////////////////////////////////////////////////////
+static bool confirmDevices(std::set<uint64_t> &unconfirmed,
+                           const std::list<STVSatDev> &fdevs,
+                           TDeviceMap &devs, TMissingMap &mdevs,
+                           const config_t &cfg) {
+    for (std::list<STVSatDev>::const_iterator fd_it = fdevs.begin();
+         fd_it != fdevs.end(); ++fd_it)
+        unconfirmed.erase(macToKey(fd_it->dev_mac));
+
+    std::list<STVSatDev> pending;
+
+    for (std::set<uint64_t>::iterator u_it = unconfirmed.begin();
+         u_it != unconfirmed.end(); ++u_it) {
+        TDeviceMap::iterator d_it = devs.find(*u_it);
+
+        if (d_it != devs.end())
+            pending.insert(pending.end(), d_it->second.dev);
+    }
+
+    unconfirmed.clear();
+    probeLiveness(pending, cfg);
+
+    bool removed = false;
+
+    for (std::list<STVSatDev>::iterator p_it = pending.begin();
+         p_it != pending.end(); ++p_it) {
+        uint64_t mac = macToKey(p_it->dev_mac);
+        TDeviceMap::iterator d_it = devs.find(mac);
+
+        if (d_it == devs.end())
+            continue;
+
+        mdevs.erase(mac);
+        removeDevice(d_it->second);
+        devs.erase(d_it);
+        removed = true;
+    }
 
-            ++i;
+    return removed;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Creates the controller of a device that has been handed over, either
+/// by another daemon or by a failed handoff of our own
+///
+/// The controller isn't started yet (see startDevices()).
+//////////////////////////////////////////////////////////////////////////
+static CTVSatCtl *resumeDevice(SDevice &sdev, const SHandoffEntry &entry,
+                               const config_t &cfg, bool verbose) {
+    sdev.ctl = new CTVSatCtl(sdev.dev.net_if.if_ip, sdev.dev.dev_ip,
+                             sdev.dev.dev_mac, entry.dev.ctl, entry.sock_fd,
+                             entry.stream_fd, entry.input_fd, cfg, verbose);
+    sdev.ctl->setLivenessFD(wake_fd);
+    sdev.keepalive_failures = 0;
+
+    return sdev.ctl;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Hands all devices over to a new daemon that connected to the handoff
+/// socket
+///
+/// The devices stay registered with the kernel module and their sockets
+/// and input devices are passed on, so the streams go on while the new
+/// daemon takes over. We only let go of the devices when the new daemon
+/// confirms that it got all of them. Otherwise, the devices are resumed
+/// from the state they were handed over with.
+///
+/// @return true, if the devices have been handed over
+/// @return false, otherwise
+//////////////////////////////////////////////////////////////////////////
+static bool handOverDevices(TDeviceMap &devs, int listen_fd,
+                            std::vector<CReactor *> &reactors,
+                            const config_t &cfg, bool verbose) {
+    int sock = acceptHandoff(listen_fd);
+
+    if (sock < 0)
+        return false;
+
+    SHandoffHeader hdr;
+
+    // tell a new daemon that doesn't match which version we are
+    if (!receiveHandoffHeader(sock, hdr)) {
+        sendHandoffHeader(sock, 0);
+        close(sock);
+        return false;
+    }
+
+    if (!sendHandoffHeader(sock, devs.size())) {
+        logErr("Failed to start handoff");
+        close(sock);
+        return false;
+    }
+
+    logInf("Handing %u devices over to new daemon", (unsigned) devs.size());
+
+    std::vector<std::pair<uint64_t, SHandoffEntry> > sent;
+    bool complete = true;
+
+    for (TDeviceMap::iterator d_it = devs.begin(); d_it != devs.end();
+         ++d_it) {
+        SDevice &sdev = d_it->second;
+        SHandoffEntry entry;
+
+        memset(&entry.dev, 0, sizeof(SHandoffDev));
+        sdev.ctl->handOver(entry.dev.ctl, entry.sock_fd, entry.stream_fd,
+                           entry.input_fd);
+        delete sdev.ctl;
+        sdev.ctl = 0;
+
+        entry.dev.adapter_num = sdev.adapter_num;
+        strncpy(entry.dev.dev_ip, sdev.dev.dev_ip.c_str(),
+                sizeof(entry.dev.dev_ip) - 1);
+        memcpy(entry.dev.dev_mac, sdev.dev.dev_mac, 6);
+        strncpy(entry.dev.if_bcast, sdev.dev.net_if.if_bcast.c_str(),
+                sizeof(entry.dev.if_bcast) - 1);
+        entry.dev.if_index = sdev.dev.net_if.if_index;
+        strncpy(entry.dev.if_ip, sdev.dev.net_if.if_ip.c_str(),
+                sizeof(entry.dev.if_ip) - 1);
+        strncpy(entry.dev.if_name, sdev.dev.net_if.if_name.c_str(),
+                sizeof(entry.dev.if_name) - 1);
+
+        sent.push_back(std::make_pair(d_it->first, entry));
+
+        if (!sendHandoffDev(sock, entry.dev, entry.sock_fd,
+                            entry.stream_fd, entry.input_fd)) {
+            logErr("Failed to hand over device at %s",
+                   sdev.dev.dev_ip.c_str());
+            complete = false;
+            break;
         }
+    }
 
-        CTVSatCtl *ctl = new CTVSatCtl(nd_it->net_if.if_ip,
-                                       nd_it->dev_ip, nd_it->dev_mac,
-                                       adapter_num, verbose);
-        ctls.insert(ctls.end(), ctl);
-        ctl->runThreaded();
+    if (complete && !receiveHandoffAck(sock, devs.size())) {
+        logErr("New daemon didn't confirm the handoff");
+        complete = false;
     }
 
-    // add registered devices that were not discovered to the list of
-    // missing devices
-    // unregister devices that were reported missing three times in a
-    // row
+    close(sock);
 
-    c_it = ctls.begin();
+    if (complete) {
+        // the new daemon has its own copies now
+        for (size_t i = 0; i < sent.size(); ++i)
+            closeHandoffFDs(sent[i].second);
 
-    while (c_it != ctls.end()) {
-        bool found = false;
+        devs.clear();
 
-        for (fd_it = fdevs.begin(); fd_it != fdevs.end();
-             ++fd_it) {
-            if (memcmp(fd_it->dev_mac,
-                       (*c_it)->getTVSatMAC(), 6)
-                == 0) {
-                found = true;
-                break;
-            }
+        return true;
+    }
+
+    // the new daemon drops its copies without the confirmation, so the
+    // devices just go on with us
+    logInf("Handoff failed, resuming %u devices", (unsigned) sent.size());
+
+    std::vector<CTVSatCtl *> ctls;
+
+    for (size_t i = 0; i < sent.size(); ++i)
+        ctls.push_back(resumeDevice(devs[sent[i].first], sent[i].second,
+                                    cfg, verbose));
+
+    startDevices(devs, ctls, reactors);
+
+    return false;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Takes the devices over from a running daemon (see handOverDevices())
+///
+/// The devices are only taken over if all of them have been received.
+/// Otherwise, the running daemon keeps them.
+///
+/// @return true, if the devices have been taken over or there is no
+///         daemon to take over from
+/// @return false, if the running daemon can't hand over its devices
+//////////////////////////////////////////////////////////////////////////
+static bool takeOverDevices(TDeviceMap &devs,
+                            std::vector<CReactor *> &reactors,
+                            const config_t &cfg, bool verbose) {
+    int sock = connectHandoff();
+
+    if (sock < 0) {
+        logInf("No running daemon to take over from");
+        return true;
+    }
+
+    SHandoffHeader hdr;
+
+    if (!sendHandoffHeader(sock, 0) || !receiveHandoffHeader(sock, hdr)) {
+        logErr("Failed to take over from running daemon");
+        close(sock);
+        return false;
+    }
+
+    std::vector<SHandoffEntry> entries;
+    bool complete = true;
+
+    for (uint32_t i = 0; i < hdr.num_devs; ++i) {
+        SHandoffEntry entry;
+
+        if (!receiveHandoffDev(sock, entry.dev, entry.sock_fd,
+                               entry.stream_fd, entry.input_fd)) {
+            logErr("Failed to receive device %u of %u", i + 1,
+                   hdr.num_devs);
+            closeHandoffFDs(entry);
+            complete = false;
+            break;
         }
 
-        if (!found) {
-            bool found2 = false;
+        entries.push_back(entry);
+    }
 
-            for (md_it = mdevs.begin(); md_it != mdevs.end();
-                 ++md_it) {
-                if (memcmp(md_it->first.dev_mac,
-                           (*c_it)->getTVSatMAC(),
-                           6) == 0) {
-                    found2 = true;
-                    break;
-                }
-            }
+    if (complete && !sendHandoffAck(sock, hdr.num_devs)) {
+        logErr("Failed to confirm the handoff");
+        complete = false;
+    }
+
+    close(sock);
+
+    if (!complete) {
+        for (size_t i = 0; i < entries.size(); ++i)
+            closeHandoffFDs(entries[i]);
+
+        logErr("Failed to take over from running daemon, it keeps its "
+               "devices");
+        return false;
+    }
+
+    std::vector<CTVSatCtl *> new_ctls;
+
+    for (size_t i = 0; i < entries.size(); ++i) {
+        SHandoffDev &hdev = entries[i].dev;
+
+        hdev.dev_ip[sizeof(hdev.dev_ip) - 1] = 0;
+        hdev.if_bcast[sizeof(hdev.if_bcast) - 1] = 0;
+        hdev.if_ip[sizeof(hdev.if_ip) - 1] = 0;
+        hdev.if_name[sizeof(hdev.if_name) - 1] = 0;
 
-            if (!found2) {
-                STVSatDev mdev;
-                memcpy(mdev.dev_mac,
-                       (*c_it)->getTVSatMAC(),
-                       6);
-                mdevs[mdev] = 0;
-                ++c_it;
-            } else if (md_it->second < 3) {
-                ++md_it->second;
-                ++c_it;
-            } else {
-                logInf("Removing device at %s",
-                       (*c_it)->getTVSatIP().c_str());
-
-                (*c_it)->stop();
-                delete *c_it;
-                c_it = ctls.erase(c_it);
+        logInf("Taking over device at %s", hdev.dev_ip);
+
+        SDevice &sdev = devs[macToKey(hdev.dev_mac)];
+        sdev.adapter_num = hdev.adapter_num;
+        sdev.requested_adapter = hdev.adapter_num;
+        sdev.dev.dev_ip = hdev.dev_ip;
+        memcpy(sdev.dev.dev_mac, hdev.dev_mac, 6);
+        sdev.dev.net_if.if_bcast = hdev.if_bcast;
+        sdev.dev.net_if.if_index = hdev.if_index;
+        sdev.dev.net_if.if_ip = hdev.if_ip;
+        sdev.dev.net_if.if_name = hdev.if_name;
+
+        new_ctls.push_back(resumeDevice(sdev, entries[i], cfg, verbose));
+    }
+
+    startDevices(devs, new_ctls, reactors);
+
+    return true;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Compares two thread scheduling settings
+//////////////////////////////////////////////////////////////////////////
+static bool sameScheduling(const sched_config_t &a, const sched_config_t &b) {
+    return (a.cpus == b.cpus) && (a.policy == b.policy) &&
+           (a.priority == b.priority);
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Reloads the configuration file
+///
+/// Settings that are only used by the management thread take effect
+/// immediately, linger_time and diseqc_delay are passed on to the running
+/// devices, new devices get the new thread, stream statistics and flight
+/// recorder settings and the adapter numbers of running devices are
+/// updated by remapDevices(). Reactors are only set up at startup.
+///
+/// @param config the running configuration
+/// @param dmap the parsed device map of the running configuration
+/// @param devs the running devices
+//////////////////////////////////////////////////////////////////////////
+static void reloadConfig(config_t &config, SDeviceMap &dmap,
+                         TDeviceMap &devs) {
+    config_t new_config;
+    defaultConfig(&new_config);
+    loadConfig(&new_config, TVSAT_CONFIG_FILE);
+
+    logInf("Reloading configuration");
+
+    if (new_config.interface != config.interface)
+        logInf("Searching for devices on %s",
+               new_config.interface.empty() ? "all interfaces" :
+               new_config.interface.c_str());
+
+    if ((new_config.reactor_threads != config.reactor_threads) ||
+        (new_config.reactor_cpus != config.reactor_cpus))
+        logInf("Changes of reactor_threads and reactor_cpus take effect "
+               "after a restart");
+
+    if ((new_config.ts_stats != config.ts_stats) ||
+        (new_config.flight_recorder_dir != config.flight_recorder_dir) ||
+        !sameScheduling(new_config.control_sched, config.control_sched) ||
+        !sameScheduling(new_config.receiver_sched, config.receiver_sched))
+        logInf("Changes of ts_stats, flight_recorder_dir, control_sched and "
+               "receiver_sched only apply to devices that are added from "
+               "now on");
+
+    if ((new_config.linger_time != config.linger_time) ||
+        (new_config.diseqc_delay != config.diseqc_delay)) {
+        for (TDeviceMap::iterator d_it = devs.begin(); d_it != devs.end();
+             ++d_it) {
+            d_it->second.ctl->setLingerTime(new_config.linger_time);
+            d_it->second.ctl->setDiSEqCDelay(new_config.diseqc_delay);
+        }
+    }
+
+    if (new_config.broadcast_interval_min >
+        new_config.broadcast_interval * 1000)
+        new_config.broadcast_interval_min =
+                new_config.broadcast_interval * 1000;
+
+    // keep the reactors as they are
+    new_config.reactor_cpus = config.reactor_cpus;
+    new_config.reactor_threads = config.reactor_threads;
+
+    if (new_config.device_map != config.device_map) {
+        dmap = SDeviceMap();
+        parseDeviceMap(dmap, new_config);
+    }
+
+    config = new_config;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Registers running devices again whose adapter number has changed
+///
+/// A device that is used by a DVB application keeps its adapter until it
+/// is released, so the application isn't cut off. A device whose new
+/// adapter is still taken by such a device waits as well. All other
+/// devices keep streaming.
+///
+/// All devices that move are unregistered before any of them is
+/// registered again, so they can swap their adapters.
+///
+/// @return true, if devices have been registered again
+/// @return false, otherwise
+//////////////////////////////////////////////////////////////////////////
+static bool remapDevices(TDeviceMap &devs,
+                         std::vector<CReactor *> &reactors,
+                         const SDeviceMap &dmap, const config_t &cfg,
+                         bool verbose) {
+    std::unordered_map<uint64_t, int> moves;
+
+    for (TDeviceMap::iterator d_it = devs.begin(); d_it != devs.end();
+         ++d_it) {
+        SDevice &sdev = d_it->second;
+
+        // an unmapped device keeps its adapter unless it has been
+        // mapped to another device
+        int fallback = sdev.adapter_num;
+
+        if (dmap.used.find(fallback) != dmap.used.end())
+            fallback = -1;
+
+        int adapter_num = getAdapterNum(sdev.dev, d_it->first, dmap,
+                                        fallback);
+
+        // a device that didn't get its adapter before doesn't try again
+        // until the mapping changes
+        if ((adapter_num == sdev.adapter_num) ||
+            (adapter_num == sdev.requested_adapter) ||
+            sdev.ctl->isInUse())
+            continue;
+
+        moves[d_it->first] = adapter_num;
+    }
+
+    // the adapters of the devices that stay can't be taken, which may
+    // keep further devices where they are
+    bool blocked = true;
+
+    while (blocked) {
+        std::set<int> taken;
+        blocked = false;
+
+        for (TDeviceMap::iterator d_it = devs.begin(); d_it != devs.end();
+             ++d_it)
+            if (moves.find(d_it->first) == moves.end())
+                taken.insert(d_it->second.adapter_num);
+
+        std::unordered_map<uint64_t, int>::iterator m_it = moves.begin();
+
+        while (m_it != moves.end()) {
+            if (taken.find(m_it->second) == taken.end()) {
+                ++m_it;
+                continue;
             }
-        } else
-            ++c_it;
+
+            LOG_DBG(verbose, "Adapter %i is still in use, device at %s "
+                    "has to wait", m_it->second,
+                    devs[m_it->first].dev.dev_ip.c_str());
+            m_it = moves.erase(m_it);
+            blocked = true;
+        }
+    }
+
+    if (moves.empty())
+        return false;
+
+    std::vector<std::pair<STVSatDev, int> > new_devs;
+
+    for (std::unordered_map<uint64_t, int>::iterator m_it = moves.begin();
+         m_it != moves.end(); ++m_it) {
+        SDevice &sdev = devs[m_it->first];
+
+        logInf("Moving device at %s from adapter %i to adapter %i",
+               sdev.dev.dev_ip.c_str(), sdev.adapter_num, m_it->second);
+
+        new_devs.push_back(std::make_pair(sdev.dev, m_it->second));
+        removeDevice(sdev);
+        devs.erase(m_it->first);
+    }
+
+    std::vector<CTVSatCtl *> new_ctls;
+
+    for (size_t i = 0; i < new_devs.size(); ++i) {
+        CTVSatCtl *ctl = addDevice(devs, new_devs[i].first,
+                                   new_devs[i].second, cfg, verbose);
+
+        if (ctl->getAdapterNum() != new_devs[i].second)
+            logErr("Device at %s got adapter %i instead of %i",
+                   new_devs[i].first.dev_ip.c_str(), ctl->getAdapterNum(),
+                   new_devs[i].second);
+
+        new_ctls.push_back(ctl);
+    }
+
+    startDevices(devs, new_ctls, reactors);
+
+    return true;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Stores the running devices in the device cache
+//////////////////////////////////////////////////////////////////////////
+static void saveDevices(const TDeviceMap &devs, const config_t &cfg) {
+    if (cfg.device_cache.empty())
+        return;
+
+    std::list<SCachedDev> cdevs;
+
+    for (TDeviceMap::const_iterator d_it = devs.begin();
+         d_it != devs.end(); ++d_it)
+        cdevs.insert(cdevs.end(), d_it->second);
+
+    saveDeviceCache(cdevs, cfg.device_cache);
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Logs the stream statistics of all running devices
+//////////////////////////////////////////////////////////////////////////
+static void logStreamStats(const TDeviceMap &devs) {
+    for (TDeviceMap::const_iterator d_it = devs.begin();
+         d_it != devs.end(); ++d_it) {
+        const CTSStats *stats = d_it->second.ctl->getTSStats();
+
+        if (stats)
+            stats->log(d_it->second.ctl->getTVSatIP().c_str());
+        else
+            logDump("TS stats of %s are disabled",
+                    d_it->second.ctl->getTVSatIP().c_str());
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Reads the number of dropped datagrams of all UDP sockets
+/// @param drops receives the drops by local port
+//////////////////////////////////////////////////////////////////////////
+static void getSocketDrops(std::unordered_map<uint16_t, uint64_t> &drops) {
+    FILE *file = fopen("/proc/net/udp", "r");
+
+    if (!file)
+        return;
+
+    char line[512];
+
+    // skip the header
+    if (!fgets(line, sizeof(line), file)) {
+        fclose(file);
+        return;
+    }
+
+    // sl local_address rem_address st tx_queue:rx_queue tr:tm->when
+    // retrnsmt uid timeout inode ref pointer drops
+    while (fgets(line, sizeof(line), file)) {
+        unsigned int port;
+        unsigned long long count;
+
+        if (sscanf(line, " %*d: %*x:%x %*x:%*x %*x %*x:%*x %*x:%*x %*x %*u %*u %*u %*u %*x %llu",
+                   &port, &count) == 2)
+            drops[port] += count;
+    }
+
+    fclose(file);
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Writes the metrics of the daemon and all running devices
+/// @param page the page to write to
+/// @param devs the running devices
+/// @param discovery durations of the discovery rounds
+//////////////////////////////////////////////////////////////////////////
+static void writeMetrics(CMetricsPage &page, const TDeviceMap &devs,
+                         const SDiscoveryStats &discovery) {
+    std::vector<std::string> labels;
+    std::vector<const SDevice *> sdevs;
+
+    for (TDeviceMap::const_iterator d_it = devs.begin();
+         d_it != devs.end(); ++d_it) {
+        const uint8_t *mac = d_it->second.dev.dev_mac;
+        char buf[128];
+        snprintf(buf, sizeof(buf),
+                 "device=\"%s\",mac=\"%02x:%02x:%02x:%02x:%02x:%02x\",adapter=\"%i\"",
+                 d_it->second.dev.dev_ip.c_str(), mac[0], mac[1], mac[2],
+                 mac[3], mac[4], mac[5], d_it->second.adapter_num);
+
+        labels.push_back(buf);
+        sdevs.push_back(&d_it->second);
+    }
+
+    timeval now;
+    gettimeofday(&now, 0);
+
+    std::unordered_map<uint16_t, uint64_t> drops;
+    getSocketDrops(drops);
+
+    page.addFamily("tvsat_devices", "gauge", "Number of running devices.");
+    page.addSample("tvsat_devices", "", sdevs.size());
+
+    page.addFamily("tvsat_discovery_last_round_seconds", "gauge",
+                   "Duration of the last device discovery round.");
+    page.addSample("tvsat_discovery_last_round_seconds", "", discovery.last);
+
+    page.addFamily("tvsat_discovery_round_seconds", "summary",
+                   "Duration of the device discovery rounds.");
+    page.addSample("tvsat_discovery_round_seconds_sum", "", discovery.total);
+    page.addSample("tvsat_discovery_round_seconds_count", "", discovery.rounds);
+
+    page.addFamily("tvsat_device_state", "gauge",
+                   "State of the device's state machine (always 1).");
+
+    for (size_t i = 0; i < sdevs.size(); ++i) {
+        int state = sdevs[i]->ctl->getMetrics().state.load(std::memory_order_relaxed);
+        page.addSample("tvsat_device_state", labels[i] + ",state=\"" +
+                       CTVSatStreamIn::getStateName(state) + "\"", 1);
+    }
+
+    page.addFamily("tvsat_device_locked", "gauge",
+                   "1, if the device is tuned and has a signal lock.");
+
+    for (size_t i = 0; i < sdevs.size(); ++i)
+        page.addSample("tvsat_device_locked", labels[i],
+                       sdevs[i]->ctl->getMetrics().is_tuned.load(std::memory_order_relaxed));
+
+    page.addFamily("tvsat_device_connected_seconds", "gauge",
+                   "Time since the connection to the device was established (0: not connected).");
+
+    for (size_t i = 0; i < sdevs.size(); ++i) {
+        int64_t since = sdevs[i]->ctl->getMetrics().connected_since.load(std::memory_order_relaxed);
+        page.addSample("tvsat_device_connected_seconds", labels[i],
+                       since ? std::max<int64_t>(now.tv_sec - since, 0) : 0);
+    }
+
+    page.addFamily("tvsat_connection_resets_total", "counter",
+                   "Connections that were reset after an error.");
+
+    for (size_t i = 0; i < sdevs.size(); ++i)
+        page.addSample("tvsat_connection_resets_total", labels[i],
+                       sdevs[i]->ctl->getMetrics().resets.load(std::memory_order_relaxed));
+
+    page.addFamily("tvsat_command_retries_total", "counter",
+                   "Ticks that found no response to a request, each one uses up a retry.");
+
+    for (size_t i = 0; i < sdevs.size(); ++i)
+        for (int c = 0; c < TVSAT_METRICS_COMMANDS; ++c)
+            page.addSample("tvsat_command_retries_total", labels[i] +
+                           ",command=\"" + CTVSatStreamIn::getCommandName(c) + "\"",
+                           sdevs[i]->ctl->getMetrics().retries[c].load(std::memory_order_relaxed));
+
+    page.addFamily("tvsat_filter_updates_total", "counter",
+                   "PID filter updates sent to the device.");
+
+    for (size_t i = 0; i < sdevs.size(); ++i)
+        page.addSample("tvsat_filter_updates_total", labels[i],
+                       sdevs[i]->ctl->getMetrics().filter_updates.load(std::memory_order_relaxed));
+
+    page.addFamily("tvsat_filter_pids", "gauge",
+                   "PIDs in the last filter sent to the device.");
+
+    for (size_t i = 0; i < sdevs.size(); ++i)
+        page.addSample("tvsat_filter_pids", labels[i],
+                       sdevs[i]->ctl->getMetrics().pids.load(std::memory_order_relaxed));
+
+    page.addFamily("tvsat_zap_last_seconds", "gauge",
+                   "Time from the last tune request to the signal lock.");
+
+    for (size_t i = 0; i < sdevs.size(); ++i)
+        page.addSample("tvsat_zap_last_seconds", labels[i],
+                       sdevs[i]->ctl->getMetrics().zap_last_ms.load(std::memory_order_relaxed) / 1000.0);
+
+    page.addFamily("tvsat_zap_seconds", "summary",
+                   "Time from a tune request to the signal lock.");
+
+    for (size_t i = 0; i < sdevs.size(); ++i) {
+        const SStreamInMetrics &m = sdevs[i]->ctl->getMetrics();
+        page.addSample("tvsat_zap_seconds_sum", labels[i],
+                       m.zap_ms.load(std::memory_order_relaxed) / 1000.0);
+        page.addSample("tvsat_zap_seconds_count", labels[i],
+                       m.zaps.load(std::memory_order_relaxed));
+    }
+
+    page.addFamily("tvsat_stream_datagrams_total", "counter",
+                   "Stream datagrams received from the device.");
+
+    for (size_t i = 0; i < sdevs.size(); ++i)
+        page.addSample("tvsat_stream_datagrams_total", labels[i],
+                       sdevs[i]->ctl->getMetrics().datagrams.load(std::memory_order_relaxed));
+
+    page.addFamily("tvsat_stream_bytes_total", "counter",
+                   "Stream bytes received from the device.");
+
+    for (size_t i = 0; i < sdevs.size(); ++i)
+        page.addSample("tvsat_stream_bytes_total", labels[i],
+                       sdevs[i]->ctl->getMetrics().bytes.load(std::memory_order_relaxed));
+
+    page.addFamily("tvsat_stream_socket_drops_total", "counter",
+                   "Stream datagrams dropped by the kernel because the socket buffer was full.");
+
+    for (size_t i = 0; i < sdevs.size(); ++i)
+        page.addSample("tvsat_stream_socket_drops_total", labels[i],
+                       drops[sdevs[i]->ctl->getStreamPort()]);
+
+    page.addFamily("tvsat_stream_write_seconds", "histogram",
+                   "Time it takes to write a datagram to the input device.");
+
+    for (size_t i = 0; i < sdevs.size(); ++i) {
+        const SStreamInMetrics &m = sdevs[i]->ctl->getMetrics();
+        uint64_t count = 0;
+
+        for (int b = 0; b <= TVSAT_METRICS_WRITE_BUCKETS; ++b) {
+            char le[32];
+            count += m.write_buckets[b].load(std::memory_order_relaxed);
+
+            if (b < TVSAT_METRICS_WRITE_BUCKETS)
+                snprintf(le, sizeof(le), ",le=\"%g\"", CTVSatStreamIn::getWriteBucket(b) / 1e9);
+            else
+                snprintf(le, sizeof(le), ",le=\"+Inf\"");
+
+            page.addSample("tvsat_stream_write_seconds_bucket", labels[i] + le, count);
+        }
+
+        page.addSample("tvsat_stream_write_seconds_sum", labels[i],
+                       m.write_ns.load(std::memory_order_relaxed) / 1e9);
+        page.addSample("tvsat_stream_write_seconds_count", labels[i], count);
     }
+
+    // the transport stream counters are only there if ts_stats is on
+    std::vector<STSTotals> totals(sdevs.size());
+    std::vector<bool> has_totals(sdevs.size());
+
+    for (size_t i = 0; i < sdevs.size(); ++i) {
+        const CTSStats *stats = sdevs[i]->ctl->getTSStats();
+        has_totals[i] = stats;
+
+        if (stats)
+            stats->getTotals(totals[i]);
+    }
+
+    page.addFamily("tvsat_ts_packets_total", "counter",
+                   "Transport stream packets received from the device.");
+
+    for (size_t i = 0; i < sdevs.size(); ++i)
+        if (has_totals[i])
+            page.addSample("tvsat_ts_packets_total", labels[i], totals[i].packets);
+
+    page.addFamily("tvsat_ts_cc_errors_total", "counter",
+                   "Continuity counter errors, i.e. lost transport stream packets.");
+
+    for (size_t i = 0; i < sdevs.size(); ++i)
+        if (has_totals[i])
+            page.addSample("tvsat_ts_cc_errors_total", labels[i], totals[i].cc_errors);
+
+    page.addFamily("tvsat_ts_duplicates_total", "counter",
+                   "Duplicate transport stream packets.");
+
+    for (size_t i = 0; i < sdevs.size(); ++i)
+        if (has_totals[i])
+            page.addSample("tvsat_ts_duplicates_total", labels[i], totals[i].duplicates);
+
+    page.addFamily("tvsat_ts_tei_errors_total", "counter",
+                   "Transport stream packets with the transport error indicator set.");
+
+    for (size_t i = 0; i < sdevs.size(); ++i)
+        if (has_totals[i])
+            page.addSample("tvsat_ts_tei_errors_total", labels[i], totals[i].tei_errors);
+
+    page.addFamily("tvsat_ts_sync_errors_total", "counter",
+                   "Transport stream packets without a sync byte.");
+
+    for (size_t i = 0; i < sdevs.size(); ++i)
+        if (has_totals[i])
+            page.addSample("tvsat_ts_sync_errors_total", labels[i], totals[i].sync_errors);
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Checks the devices whose keepalive requests failed with unicast probes
+/// and removes the ones that don't reply
+///
+/// A DVB application that still uses a removed device only loses the
+/// signal, the kernel module keeps the adapter until it is closed.
+///
+/// @return true, if devices have been removed
+/// @return false, otherwise
+//////////////////////////////////////////////////////////////////////////
+static bool checkLiveness(TDeviceMap &devs, TMissingMap &mdevs,
+                          const config_t &cfg) {
+    std::list<STVSatDev> pending;
+
+    for (TDeviceMap::iterator d_it = devs.begin(); d_it != devs.end();
+         ++d_it) {
+        int failures = d_it->second.ctl->getKeepaliveFailures();
+
+        if (failures != d_it->second.keepalive_failures) {
+            d_it->second.keepalive_failures = failures;
+            pending.insert(pending.end(), d_it->second.dev);
+        }
+    }
+
+    if (!cfg.fast_removal || pending.empty())
+        return false;
+
+    probeLiveness(pending, cfg);
+
+    bool removed = false;
+
+    for (std::list<STVSatDev>::iterator p_it = pending.begin();
+         p_it != pending.end(); ++p_it) {
+        uint64_t mac = macToKey(p_it->dev_mac);
+        TDeviceMap::iterator d_it = devs.find(mac);
+
+        if (d_it == devs.end())
+            continue;
+
+        // an application using the device sees a lost signal, the
+        // module keeps its adapter until the application closes it
+        if (d_it->second.ctl->isInUse())
+            logInf("Device at %s doesn't reply, removing it while in use",
+                   p_it->dev_ip.c_str());
+
+        mdevs.erase(mac);
+        removeDevice(d_it->second);
+        devs.erase(d_it);
+        removed = true;
+    }
+
+    return removed;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Registers new devices and removes the ones that are missing
+///
+/// A device is removed when it wasn't discovered for five times the
+/// broadcast interval, no matter how many rounds there were in between.
+///
+/// @return true, if devices have been added or removed
+/// @return false, otherwise
+//////////////////////////////////////////////////////////////////////////
+static bool updateDeviceLists(const std::list<STVSatDev> &fdevs,
+                              TMissingMap &mdevs,
+                              TDeviceMap &devs,
+                              std::vector<CReactor *> &reactors,
+                              const SDeviceMap &dmap,
+                              const config_t &cfg,
+                              bool verbose) {
+    std::unordered_set<uint64_t> found;
+    std::vector<CTVSatCtl *> new_ctls;
+    bool removed = false;
+
+    // register the discovered devices that aren't already running
+    for (std::list<STVSatDev>::const_iterator fd_it = fdevs.begin();
+         fd_it != fdevs.end(); ++fd_it) {
+        uint64_t mac = macToKey(fd_it->dev_mac);
+
+        found.insert(mac);
+        mdevs.erase(mac);
+
+        if (devs.find(mac) != devs.end())
+            continue;
+
+        new_ctls.push_back(addDevice(devs, *fd_it,
+                                     getAdapterNum(*fd_it, mac, dmap),
+                                     cfg, verbose));
+    }
+
+    size_t failed = startDevices(devs, new_ctls, reactors);
+
+    // remember since when the running devices are missing and unregister
+    // the ones that are missing for too long
+    timeval now, max_missing = {5 * cfg.broadcast_interval, 0};
+    gettimeofday(&now, 0);
+
+    TDeviceMap::iterator d_it = devs.begin();
+
+    while (d_it != devs.end()) {
+        if (found.find(d_it->first) != found.end()) {
+            ++d_it;
+            continue;
+        }
+
+        TMissingMap::iterator md_it = mdevs.find(d_it->first);
+
+        if (md_it == mdevs.end()) {
+            mdevs[d_it->first] = now;
+            ++d_it;
+            continue;
+        }
+
+        timeval missing;
+        timersub(&now, &md_it->second, &missing);
+
+        if (timercmp(&missing, &max_missing, <)) {
+            ++d_it;
+        } else {
+            mdevs.erase(md_it);
+            removeDevice(d_it->second);
+            d_it = devs.erase(d_it);
+            removed = true;
+        }
+    }
+
+    return (new_ctls.size() > failed) || removed;
 }
 
 //////////////////////////////////////////////////////////////////////////
@@ -266,19 +1281,23 @@ int main(int argc, char **argv) {
     // register the signal handler that stops the main loop
     signal(SIGTERM, handleExitSignal);
     signal(SIGQUIT, handleExitSignal);
-    signal(SIGHUP, handleExitSignal);
+    signal(SIGHUP, handleReloadSignal);
+    signal(SIGUSR1, handleDumpSignal);
+    signal(SIGUSR2, handleFlightDumpSignal);
     signal(SIGINT, handleExitSignal);
 
     static struct option options[] = {
             { "daemon", no_argument, 0, 'd' },
+            { "takeover", no_argument, 0, 't' },
             { "verbose", no_argument, 0, 'v' },
             { "help", no_argument, 0, 'h' },
             { 0, 0, 0, 0},
     };
 
     int opt = 0, long_index = 0;
+    bool takeover = false;
     bool verbose = false;
-    while ((opt = getopt_long(argc, argv, "dvh", options, &long_index)) >= 0) {
+    while ((opt = getopt_long(argc, argv, "dtvh", options, &long_index)) >= 0) {
         switch (opt) {
             // if we should start as a daemon, fork to background and create a
             // pid file
@@ -286,6 +1305,10 @@ int main(int argc, char **argv) {
                 daemonize();
                 break;
 
+            case 't':
+                takeover = true;
+                break;
+
             case 'v':
                 verbose = true;
                 break;
@@ -300,69 +1323,328 @@ int main(int argc, char **argv) {
 
     openlog("tvsatd", 0, LOG_ERR);
 
+    // from here on, the device threads never wait for the syslog
+    startLogWriter();
+
     config_t config;
     defaultConfig(&config);
-    loadConfig(&config, "/etc/tvsatd/tvsatd.conf");
+    loadConfig(&config, TVSAT_CONFIG_FILE);
 
     logInf("dLAN TV Sat Controller started");
 
+    // in reactor mode, a few threads serve all devices instead of two
+    // threads per device
+    std::vector<CReactor *> reactors;
+
+    for (int i = 0; i < config.reactor_threads; ++i) {
+        int cpu = -1;
+
+        if (!config.reactor_cpus.empty())
+            cpu = config.reactor_cpus[i % config.reactor_cpus.size()];
+
+        CReactor *reactor = new CReactor(i);
+
+        if (!reactor->start()) {
+            delete reactor;
+            continue;
+        }
+
+        // the reactors do the receivers' work, so they get the same
+        // policy, but they're pinned according to reactor_cpus
+        sched_config_t sched = config.receiver_sched;
+        sched.cpus.clear();
+
+        if (cpu >= 0)
+            sched.cpus.push_back(cpu);
+
+        char name[32];
+        snprintf(name, sizeof(name), "Reactor %i", i);
+        setThreadScheduling(reactor->getThread(), sched, name);
+
+        reactors.push_back(reactor);
+    }
+
+    if (config.reactor_threads && reactors.empty())
+        logErr("Failed to start reactors, falling back to one thread per device");
+
+    wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+
+    SDeviceMap device_map;
     std::list<STVSatDev> found_devs;
-    std::map<STVSatDev, int> missing_devs;
-    std::list<STVSatDev> new_devs;
-    std::list<CTVSatCtl *> tvsat_ctls;
-    timespec sleep_time;
+    std::set<uint64_t> known_macs;
+    TMissingMap missing_devs;
+    std::set<uint64_t> unconfirmed_devs;
+    TDeviceMap tvsat_devs;
+
+    parseDeviceMap(device_map, config);
+
+    // take the devices over before listening ourselves, so the running
+    // daemon is still the one that answers
+    if (takeover && !takeOverDevices(tvsat_devs, reactors, config, verbose)) {
+        for (size_t i = 0; i < reactors.size(); ++i) {
+            reactors[i]->stop();
+            delete reactors[i];
+        }
+
+        stopLogWriter();
+        closelog();
+        return 1;
+    }
+
+    // a newer version of the daemon can take over from us
+    bool handed_over = false;
+    int handoff_fd = openHandoffListener();
+
+    if (handoff_fd < 0)
+        logErr("Failed to open handoff socket %s", TVSAT_HANDOFF_SOCKET);
+
+    // bring up the devices we knew last time before searching for them
+    restoreDevices(tvsat_devs, unconfirmed_devs, reactors, device_map,
+                   config, verbose);
+
+    // keep track of the network interfaces, so they don't have to be
+    // queried for every round and new interfaces are searched at once
+    CIfMonitor ifmon;
+
+    if (!ifmon.open())
+        logErr("Failed to monitor network interfaces, checking them every round");
 
-    sleep_time.tv_sec = config.broadcast_interval;
-    sleep_time.tv_nsec = 0;
+    // search quickly at first and after every change and back off
+    // exponentially to broadcast_interval while nothing changes
+    if (config.broadcast_interval_min > config.broadcast_interval * 1000)
+        config.broadcast_interval_min = config.broadcast_interval * 1000;
+
+    int interval = config.broadcast_interval_min;
+
+    // scrapes are answered from the main loop, between discovery rounds
+    CMetricsServer metrics;
+    SDiscoveryStats discovery;
+    discovery.last = 0;
+    discovery.rounds = 0;
+    discovery.total = 0;
+
+    if (config.metrics_port)
+        metrics.open(config.metrics_address, config.metrics_port);
 
     // main loop of the management thread
     while (!stop) {
-        timeval tv1, tv2;
+        timeval tv1;
+
+        // the round blocks, the metrics clients get their time afterwards
+        metrics.suspend();
 
         gettimeofday(&tv1, 0);
         found_devs.clear();
-        new_devs.clear();
 
-        findDevices(found_devs, config.interface);
-        updateDeviceLists(found_devs, new_devs, missing_devs,
-                          tvsat_ctls, config, verbose);
+        // with early exit, a round ends as soon as all known devices
+        // have replied, so new devices are only found if they reply
+        // before the last known one
+        if (config.discovery_early_exit)
+            getKnownMACs(known_macs, tvsat_devs, device_map);
+
+        // the rounds start every interval, so while it is shorter than
+        // a second, so is the time the replies get
+        int listen_time = std::min(interval, 1000);
+
+        if (ifmon.getFD() >= 0) {
+            std::list<SNetIf> ifs;
+            ifmon.getInterfaces(ifs, config.interface);
+            findDevices(found_devs, ifs, false,
+                        config.discovery_early_exit ? &known_macs : 0,
+                        listen_time);
+        } else
+            findDevices(found_devs, config.interface, false,
+                        config.discovery_early_exit ? &known_macs : 0,
+                        listen_time);
+
+        timeval tv2, round;
         gettimeofday(&tv2, 0);
+        timersub(&tv2, &tv1, &round);
+        discovery.last = round.tv_sec + round.tv_usec / 1e6;
+        discovery.total += discovery.last;
+        ++discovery.rounds;
+
+        // the restored devices that weren't found in the first round
+        // get the same chances as the ones that stop replying
+        bool changed = false;
+
+        if (!unconfirmed_devs.empty())
+            changed = confirmDevices(unconfirmed_devs, found_devs,
+                                     tvsat_devs, missing_devs, config);
+
+        // devices whose adapter changed with a reload may be waiting
+        // for their DVB application to let go of them
+        changed = remapDevices(tvsat_devs, reactors, device_map,
+                               config, verbose) || changed;
+
+        if (updateDeviceLists(found_devs, missing_devs, tvsat_devs,
+                              reactors, device_map, config, verbose) ||
+            changed) {
+            saveDevices(tvsat_devs, config);
+            interval = config.broadcast_interval_min;
+        } else
+            interval = std::min(interval * 2,
+                                config.broadcast_interval * 1000);
 
-        // check for new devices only every few seconds and sleep
-        // in between
-        // use nanosleep to be interruptible, but resume sleeping
-        // if 'stop' isn't set
-        int tdiff = tv2.tv_sec - tv1.tv_sec;
-        timespec orm, rm;
-        rm = sleep_time;
+        LOG_DBG(verbose, "Next device search in %i ms", interval);
 
-        if (rm.tv_sec < tdiff)
-            rm.tv_sec = 0;
-        else
-            rm.tv_sec -= tdiff;
+        // wait until the next round, unless a network interface comes up
+        // or gets an address
+        // poll() is interrupted by the exit signals
+        timeval sleep_time, wake_time;
+        sleep_time.tv_sec = interval / 1000;
+        sleep_time.tv_usec = (interval % 1000) * 1000;
+        timeradd(&tv1, &sleep_time, &wake_time);
 
-        while (((rm.tv_nsec > 0) || (rm.tv_sec > 0)) && !stop) {
-            orm = rm;
+        while (!stop) {
+            timeval now, rm;
+            metrics.resume();
+            gettimeofday(&now, 0);
 
-            if (nanosleep(&orm, &rm) == 0)
+            if (!timercmp(&now, &wake_time, <))
                 break;
 
-            if ((orm.tv_nsec == rm.tv_nsec) &&
-                (orm.tv_sec == rm.tv_sec))
+            timersub(&wake_time, &now, &rm);
+
+            std::vector<pollfd> pfds(3);
+            pfds[0].fd = ifmon.getFD();
+            pfds[0].events = POLLIN;
+            pfds[0].revents = 0;
+            pfds[1].fd = wake_fd;
+            pfds[1].events = POLLIN;
+            pfds[1].revents = 0;
+            pfds[2].fd = handoff_fd;
+            pfds[2].events = POLLIN;
+            pfds[2].revents = 0;
+
+            // the metrics clients get a little at a time, so a slow one
+            // can't hold up the main loop
+            metrics.getPollFDs(pfds);
+
+            int timeout = rm.tv_sec * 1000 + rm.tv_usec / 1000 + 1;
+            int metrics_timeout = metrics.getTimeout();
+
+            if ((metrics_timeout >= 0) && (metrics_timeout < timeout))
+                timeout = metrics_timeout;
+
+            int ret = poll(&pfds[0], pfds.size(), timeout);
+
+            if (metrics.handleEvents()) {
+                CMetricsPage page;
+                writeMetrics(page, tvsat_devs, discovery);
+                metrics.sendResponse(page.getText());
+            }
+
+            if (ret <= 0)
+                continue;
+
+            if ((pfds[2].revents & POLLIN) &&
+                handOverDevices(tvsat_devs, handoff_fd, reactors, config,
+                                verbose)) {
+                // the socket belongs to the new daemon now
+                handed_over = true;
+                stop = true;
                 break;
+            }
+
+            if (pfds[1].revents & POLLIN) {
+                uint64_t count;
+
+                if (read(wake_fd, &count, sizeof(count)) < 0)
+                    logErr("Failed to read wakeup events");
+
+                // the unicast probes block for up to a second each
+                metrics.suspend();
+
+                bool failed = removeFailedDevices(tvsat_devs, missing_devs);
+
+                bool removed =
+                        checkLiveness(tvsat_devs, missing_devs, config) ||
+                        failed;
+
+                if (removed) {
+                    saveDevices(tvsat_devs, config);
+                    interval = config.broadcast_interval_min;
+                }
+
+                if (dump_stats) {
+                    dump_stats = 0;
+                    logStreamStats(tvsat_devs);
+                }
+
+                // the device threads write the files, so the recorders
+                // are only read by the threads that fill them
+                if (dump_flight) {
+                    dump_flight = 0;
+
+                    for (TDeviceMap::iterator d_it = tvsat_devs.begin();
+                         d_it != tvsat_devs.end(); ++d_it)
+                        d_it->second.ctl->requestFlightDump();
+                }
+
+                if (reload) {
+                    reload = 0;
+
+                    std::string metrics_address = config.metrics_address;
+                    uint16_t metrics_port = config.metrics_port;
+
+                    reloadConfig(config, device_map, tvsat_devs);
+
+                    if ((config.metrics_port != metrics_port) ||
+                        (config.metrics_address != metrics_address)) {
+                        metrics.close();
+
+                        if (config.metrics_port)
+                            metrics.open(config.metrics_address,
+                                         config.metrics_port);
+                    }
+
+                    if (remapDevices(tvsat_devs, reactors, device_map,
+                                     config, verbose))
+                        saveDevices(tvsat_devs, config);
+
+                    // search again with the new settings
+                    interval = config.broadcast_interval_min;
+                    break;
+                }
+
+                // search again at once for a device that went away
+                if (removed)
+                    break;
+            }
+
+            if ((pfds[0].revents & POLLIN) && ifmon.processMessages()) {
+                logInf("Network interfaces changed, searching for devices");
+                interval = config.broadcast_interval_min;
+                break;
+            }
         }
     }
 
     // stop all running threads
-    std::list<CTVSatCtl *>::iterator c_it;
+    for (TDeviceMap::iterator d_it = tvsat_devs.begin();
+         d_it != tvsat_devs.end(); ++d_it) {
+        d_it->second.ctl->stop();
+        delete d_it->second.ctl;
+    }
+
+    for (size_t i = 0; i < reactors.size(); ++i) {
+        reactors[i]->stop();
+        delete reactors[i];
+    }
+
+    if (wake_fd >= 0)
+        close(wake_fd);
+
+    if (handoff_fd >= 0) {
+        close(handoff_fd);
 
-    for (c_it = tvsat_ctls.begin();
-         c_it != tvsat_ctls.end(); ++c_it) {
-        (*c_it)->stop();
-        delete *c_it;
+        if (!handed_over)
+            unlink(TVSAT_HANDOFF_SOCKET);
     }
 
     logInf("dLAN TV Sat Controller terminated");
+    stopLogWriter();
     closelog();
 
     return 0;
@@ -30,11 +30,18 @@
 #ifndef __TVSATMGR_H
 #define __TVSATMGR_H
 
+#include <set>
+#include <stdint.h>
 #include <string>
+#include <sys/time.h>
+#include <unordered_map>
+
+#include "devcache.h"
 
 //////////////////////////////////////////////////////////////////////////
 // DEFINITIONS
 //////////////////////////////////////////////////////////////////////////
+#define TVSAT_CONFIG_FILE              "/etc/tvsatd/tvsatd.conf"
 #define TVSAT_PID_FILE                 "/var/run/tvsatd.pid"
 
 //////////////////////////////////////////////////////////////////////////
@@ -42,4 +49,46 @@
 //////////////////////////////////////////////////////////////////////////
 typedef std::pair<std::string, std::string> TStringPair;
 
+class CTVSatCtl;
+
+//////////////////////////////////////////////////////////////////////////
+/// A running device
+//////////////////////////////////////////////////////////////////////////
+struct SDevice : public SCachedDev {
+    CTVSatCtl *ctl;
+    /// Adapter number the device asked for, adapter_num is the one it got
+    int requested_adapter;
+    /// Keepalive failures of the controller that have been handled
+    int keepalive_failures;
+};
+
+/// Running devices by MAC address (see macToKey())
+typedef std::unordered_map<uint64_t, SDevice> TDeviceMap;
+
+/// Time since when a device has been missing by MAC address
+typedef std::unordered_map<uint64_t, timeval> TMissingMap;
+
+//////////////////////////////////////////////////////////////////////////
+/// Durations of the device discovery rounds for the metrics endpoint
+//////////////////////////////////////////////////////////////////////////
+struct SDiscoveryStats {
+    /// Duration of the last round in s
+    double last;
+    uint64_t rounds;
+    /// Duration of all rounds in s
+    double total;
+};
+
+//////////////////////////////////////////////////////////////////////////
+/// The device map of the configuration, parsed once at startup
+//////////////////////////////////////////////////////////////////////////
+struct SDeviceMap {
+    /// Adapter numbers by IP address
+    std::unordered_map<std::string, uint8_t> by_ip;
+    /// Adapter numbers by MAC address (see macToKey())
+    std::unordered_map<uint64_t, uint8_t> by_mac;
+    /// All adapter numbers that are assigned to a device
+    std::set<uint8_t> used;
+};
+
 #endif
@@ -0,0 +1,748 @@
+//////////////////////////////////////////////////////////////////////////
+// devolo dLAN TV Sat control application
+// Copyright (C) 2008 devolo AG. All rights reserved.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//
+// Contact information:
+//    devolo AG
+//    Sonnenweg 11
+//    D-52070 Aachen, Germany
+//    gpl@devolo.de
+//////////////////////////////////////////////////////////////////////////
+/// @file tvsatproxy.cpp
+/// @brief "dLAN TV Sat Network Impairment Proxy" - implementation
+//////////////////////////////////////////////////////////////////////////
+
+#include <arpa/inet.h>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <getopt.h>
+#include <iostream>
+#include <netinet/ip.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "streamin.h"
+#include "tvsatproxy.h"
+
+#define HELPTXT    "tvsatproxy - impairs the traffic between tvsatd and a device\n"\
+        "Usage: tvsatproxy [options] -d ip\n"\
+        "\n"\
+        "The proxy answers on UDP port 11111 in place of the device at 'ip' and\n"\
+        "forwards the control requests, the responses and the stream. Discovery\n"\
+        "responses carry the address of the proxy and the MAC address of the device\n"\
+        "with the locally administered bit set, so the proxied device shows up next\n"\
+        "to the real one.\n"\
+        "\n"\
+        "Options:\n"\
+        "  -b ip        --bind ip       bind the control socket to 'ip' (default: all\n"\
+        "                               addresses)\n"\
+        "  -c spec      --control spec  impairment of requests and responses\n"\
+        "  -d ip        --device ip     address of the device\n"\
+        "  -h           --help          show this help text\n"\
+        "  -i sec       --interval sec  print statistics every 'sec' seconds\n"\
+        "                               (default: only on exit)\n"\
+        "  -S seed      --seed seed     seed of the fault generator (default: 1)\n"\
+        "  -s spec      --stream spec   impairment of the stream\n"\
+        "  -v           --verbose       log every control packet\n"\
+        "\n"\
+        "An impairment is a comma separated list of:\n"\
+        "  loss=percent         random loss\n"\
+        "  burst=percent:len    bursts of 'len' lost packets on average, starting\n"\
+        "                       at any packet with the given probability\n"\
+        "  delay=ms             constant delay\n"\
+        "  jitter=ms            random additional delay\n"\
+        "  reorder=percent      packets that are overtaken by later ones\n"\
+        "  rate=kbit/s          bandwidth cap\n"\
+        "  queue=ms             longest wait for the capped link before a packet\n"\
+        "                       is dropped (default: 100)\n"\
+        "e.g. -s loss=0.1,burst=0.05:20,jitter=5,rate=30000\n"\
+        "\n"\
+        "Statistics are printed on exit (SIGINT/SIGTERM).\n"
+
+static option long_opts[] = {
+        {"bind",     required_argument, 0, 'b'},
+        {"control",  required_argument, 0, 'c'},
+        {"device",   required_argument, 0, 'd'},
+        {"help",     no_argument,       0, 'h'},
+        {"interval", required_argument, 0, 'i'},
+        {"seed",     required_argument, 0, 'S'},
+        {"stream",   required_argument, 0, 's'},
+        {"verbose",  no_argument,       0, 'v'},
+        {0, 0, 0, 0}
+};
+
+static const char *channel_names[] = {"requests", "responses", "stream"};
+
+static volatile int stop = 0;
+
+//////////////////////////////////////////////////////////////////////////
+/// Constructor (no impairment)
+//////////////////////////////////////////////////////////////////////////
+CImpairment::CImpairment() {
+    m_burst = 0;
+    m_burst_len = 1;
+    m_delay = 0;
+    m_in_burst = false;
+    m_jitter = 0;
+    m_loss = 0;
+    m_next_free = 0;
+    m_queue = 100000;
+    m_rate = 0;
+    m_reorder = 0;
+    m_seed = 1;
+
+    memset(&m_counters, 0, sizeof(SImpairmentCounters));
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Reads the settings from a specification like "loss=1,jitter=5"
+/// @return true, if successful
+/// @return false, if the specification is invalid
+//////////////////////////////////////////////////////////////////////////
+bool CImpairment::parse(const std::string &spec) {
+    size_t pos = 0;
+
+    while (pos < spec.size()) {
+        size_t end = spec.find(',', pos);
+
+        if (end == std::string::npos)
+            end = spec.size();
+
+        std::string item = spec.substr(pos, end - pos);
+        size_t eq = item.find('=');
+        pos = end + 1;
+
+        if (eq == std::string::npos)
+            return false;
+
+        std::string key = item.substr(0, eq);
+        const char *value = item.c_str() + eq + 1;
+        char *rest;
+        double v = strtod(value, &rest);
+
+        if ((rest == value) || (v < 0))
+            return false;
+
+        if (key == "burst") {
+            if ((*rest != ':') || (v > 100))
+                return false;
+
+            m_burst = v;
+            value = rest + 1;
+            m_burst_len = strtod(value, &rest);
+
+            if ((rest == value) || (m_burst_len < 1))
+                return false;
+        } else if (*rest)
+            return false;
+        else if (key == "delay")
+            m_delay = v * 1000;
+        else if (key == "jitter")
+            m_jitter = v * 1000;
+        else if ((key == "loss") && (v <= 100))
+            m_loss = v;
+        else if (key == "queue")
+            m_queue = v * 1000;
+        else if (key == "rate")
+            m_rate = v * 1000;
+        else if ((key == "reorder") && (v <= 100))
+            m_reorder = v;
+        else
+            return false;
+    }
+
+    return true;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Decides the fate of a packet
+///
+/// @param len the size of the packet
+/// @param now the current time in us
+/// @param due receives the time the packet is to be sent in us
+/// @return true, if the packet is to be sent
+/// @return false, if it is lost or dropped
+//////////////////////////////////////////////////////////////////////////
+bool CImpairment::pass(size_t len, uint64_t now, uint64_t &due) {
+    ++m_counters.packets;
+    m_counters.bytes += len;
+
+    if (m_in_burst)
+        m_in_burst = random() >= 100.0 / m_burst_len;
+    else if (m_burst)
+        m_in_burst = random() < m_burst;
+
+    if (m_in_burst) {
+        ++m_counters.burst_lost;
+        return false;
+    }
+
+    if (m_loss && (random() < m_loss)) {
+        ++m_counters.lost;
+        return false;
+    }
+
+    due = now;
+
+    // the capped link sends one packet after the other and has a queue
+    // of limited length in front of it
+    if (m_rate) {
+        uint64_t start = (m_next_free > now) ? m_next_free : now;
+
+        if (start - now > m_queue) {
+            ++m_counters.rate_dropped;
+            return false;
+        }
+
+        m_next_free = start + len * 8 * 1000000ULL / m_rate;
+        due = m_next_free;
+    }
+
+    due += m_delay;
+
+    if (m_jitter)
+        due += (uint64_t) (random() / 100 * m_jitter);
+
+    // held back until the following packets have passed
+    if (m_reorder && (random() < m_reorder)) {
+        due += 2 * m_delay + m_jitter + 1000;
+        ++m_counters.reordered;
+    }
+
+    return true;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Gets a pseudo random number from 0 to 100 (xorshift32)
+//////////////////////////////////////////////////////////////////////////
+double CImpairment::random() {
+    m_seed ^= m_seed << 13;
+    m_seed ^= m_seed >> 17;
+    m_seed ^= m_seed << 5;
+
+    return m_seed / 4294967296.0 * 100;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Constructor
+//////////////////////////////////////////////////////////////////////////
+CTVSatProxy::CTVSatProxy(const SProxyConfig &config) {
+    m_config = config;
+    m_dev_mac_known = false;
+    m_sock = -1;
+
+    memset(&m_dev_addr, 0, sizeof(sockaddr_in));
+    memset(m_dev_mac, 0, 6);
+
+    for (int i = 0; i < eNumChannels; ++i)
+        m_impairments[i].seed(config.seed + i);
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Destructor
+//////////////////////////////////////////////////////////////////////////
+CTVSatProxy::~CTVSatProxy() {
+    if (m_sock >= 0)
+        close(m_sock);
+
+    for (std::map<uint64_t, SProxyFlow>::iterator it = m_flows.begin(); it != m_flows.end(); ++it) {
+        close(it->second.ctl_fd);
+        close(it->second.stream_fd);
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Closes the sockets of clients that have been quiet for a while
+//////////////////////////////////////////////////////////////////////////
+void CTVSatProxy::expireFlows() {
+    time_t now = time(0);
+    std::map<uint64_t, SProxyFlow>::iterator it = m_flows.begin();
+
+    while (it != m_flows.end()) {
+        if (now - it->second.last_used > TVSAT_PROXY_FLOW_TIMEOUT) {
+            // packets that are still queued must not go out on a reused fd
+            std::multimap<uint64_t, SProxyPacket>::iterator q = m_queue.begin();
+
+            while (q != m_queue.end()) {
+                if ((q->second.fd == it->second.ctl_fd) || (q->second.fd == it->second.stream_fd))
+                    m_queue.erase(q++);
+                else
+                    ++q;
+            }
+
+            close(it->second.ctl_fd);
+            close(it->second.stream_fd);
+            m_flows.erase(it++);
+        } else
+            ++it;
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Impairs a packet and queues it for sending
+//////////////////////////////////////////////////////////////////////////
+void CTVSatProxy::forward(int channel, const uint8_t *data, size_t len, int fd, const sockaddr_in &dst) {
+    uint64_t now = nowUS();
+    uint64_t due;
+
+    if (!m_impairments[channel].pass(len, now, due))
+        return;
+
+    if (due <= now) {
+        sendto(fd, data, len, 0, (const sockaddr *) &dst, sizeof(sockaddr_in));
+        return;
+    }
+
+    SProxyPacket packet;
+    packet.data.assign(data, data + len);
+    packet.dst = dst;
+    packet.fd = fd;
+    m_queue.insert(std::make_pair(due, packet));
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Gets the flow of a client and creates it, if necessary
+/// @return the flow (0, if the sockets couldn't be created)
+//////////////////////////////////////////////////////////////////////////
+SProxyFlow *CTVSatProxy::getFlow(const sockaddr_in &client, const in_addr &local_ip) {
+    uint64_t key = ((uint64_t) client.sin_addr.s_addr << 16) | client.sin_port;
+    std::map<uint64_t, SProxyFlow>::iterator it = m_flows.find(key);
+
+    if (it != m_flows.end()) {
+        it->second.last_used = time(0);
+        return &it->second;
+    }
+
+    SProxyFlow flow;
+    memset(&flow, 0, sizeof(SProxyFlow));
+    flow.client = client;
+    flow.last_used = time(0);
+    flow.local_ip = local_ip;
+    flow.ctl_fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK, IPPROTO_UDP);
+    flow.stream_fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK, IPPROTO_UDP);
+
+    sockaddr_in sa;
+    memset(&sa, 0, sizeof(sockaddr_in));
+    sa.sin_family = AF_INET;
+    sa.sin_addr.s_addr = htonl(INADDR_ANY);
+
+    // the stream is the largest flow by far, so give it some room
+    int bufsize = 4 << 20;
+
+    if ((flow.ctl_fd < 0) || (flow.stream_fd < 0) ||
+        (connect(flow.ctl_fd, (sockaddr *) &m_dev_addr, sizeof(sockaddr_in)) < 0) ||
+        (bind(flow.stream_fd, (sockaddr *) &sa, sizeof(sockaddr_in)) < 0)) {
+        std::cerr << "Error: can't create sockets for client: " << strerror(errno) << std::endl;
+
+        if (flow.ctl_fd >= 0)
+            close(flow.ctl_fd);
+
+        if (flow.stream_fd >= 0)
+            close(flow.stream_fd);
+
+        return 0;
+    }
+
+    setsockopt(flow.stream_fd, SOL_SOCKET, SO_RCVBUF, &bufsize, sizeof(bufsize));
+
+    if (m_config.verbose)
+        printf("New client %s:%u\n", inet_ntoa(client.sin_addr), ntohs(client.sin_port));
+
+    return &(m_flows[key] = flow);
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Gets a monotonic timestamp in microseconds
+//////////////////////////////////////////////////////////////////////////
+uint64_t CTVSatProxy::nowUS() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Opens the control socket
+/// @return true, if successful
+/// @return false, otherwise
+//////////////////////////////////////////////////////////////////////////
+bool CTVSatProxy::open() {
+    m_dev_addr.sin_family = AF_INET;
+    m_dev_addr.sin_port = htons(11111);
+
+    if (!inet_aton(m_config.dev_ip.c_str(), &m_dev_addr.sin_addr)) {
+        std::cerr << "Error: invalid device address" << std::endl;
+        return false;
+    }
+
+    m_sock = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK, IPPROTO_UDP);
+
+    if (m_sock < 0) {
+        std::cerr << "Error: socket() failed" << std::endl;
+        return false;
+    }
+
+    int on = 1;
+    setsockopt(m_sock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    setsockopt(m_sock, SOL_SOCKET, SO_BROADCAST, &on, sizeof(on));
+    setsockopt(m_sock, IPPROTO_IP, IP_PKTINFO, &on, sizeof(on));
+
+    sockaddr_in sa;
+    memset(&sa, 0, sizeof(sockaddr_in));
+    sa.sin_family = AF_INET;
+    sa.sin_port = htons(11111);
+    sa.sin_addr.s_addr = htonl(INADDR_ANY);
+
+    if (!m_config.bind_ip.empty() && !inet_aton(m_config.bind_ip.c_str(), &sa.sin_addr)) {
+        std::cerr << "Error: invalid bind address" << std::endl;
+        return false;
+    }
+
+    if (bind(m_sock, (sockaddr *) &sa, sizeof(sockaddr_in)) < 0) {
+        std::cerr << "Error: bind() failed: " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Prints the counters of all channels
+//////////////////////////////////////////////////////////////////////////
+void CTVSatProxy::printStats() const {
+    printf("%-10s %10s %12s %8s %8s %8s %8s %8s\n", "channel", "packets", "bytes", "lost", "burst",
+           "rate", "reorder", "loss %");
+
+    for (int i = 0; i < eNumChannels; ++i) {
+        const SImpairmentCounters &c = m_impairments[i].getCounters();
+        uint64_t gone = c.lost + c.burst_lost + c.rate_dropped;
+
+        printf("%-10s %10llu %12llu %8llu %8llu %8llu %8llu %8.3f\n", channel_names[i],
+               (unsigned long long) c.packets, (unsigned long long) c.bytes, (unsigned long long) c.lost,
+               (unsigned long long) c.burst_lost, (unsigned long long) c.rate_dropped,
+               (unsigned long long) c.reordered, c.packets ? 100.0 * gone / c.packets : 0);
+    }
+
+    fflush(stdout);
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Forwards all requests that are waiting in the control socket
+//////////////////////////////////////////////////////////////////////////
+void CTVSatProxy::processRequests() {
+    uint8_t req[IP_MAXPACKET];
+
+    while (1) {
+        sockaddr_in src;
+        char cbuf[CMSG_SPACE(sizeof(in_pktinfo))];
+
+        iovec iov;
+        iov.iov_base = req;
+        iov.iov_len = sizeof(req);
+
+        msghdr msg;
+        memset(&msg, 0, sizeof(msghdr));
+        msg.msg_name = &src;
+        msg.msg_namelen = sizeof(sockaddr_in);
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = cbuf;
+        msg.msg_controllen = sizeof(cbuf);
+
+        ssize_t len = recvmsg(m_sock, &msg, 0);
+
+        if (len <= 0)
+            return;
+
+        in_addr local_ip;
+        local_ip.s_addr = htonl(INADDR_LOOPBACK);
+
+        for (cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+            if ((cmsg->cmsg_level == IPPROTO_IP) && (cmsg->cmsg_type == IP_PKTINFO))
+                local_ip = ((in_pktinfo *) CMSG_DATA(cmsg))->ipi_spec_dst;
+
+        SProxyFlow *flow = getFlow(src, local_ip);
+
+        if (!flow || (len < (ssize_t) sizeof(RequestHeader)))
+            continue;
+
+        rewriteRequest(*flow, req, len);
+        forward(eRequests, req, len, flow->ctl_fd, m_dev_addr);
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Forwards all responses of the device to a client
+//////////////////////////////////////////////////////////////////////////
+void CTVSatProxy::processResponses(SProxyFlow &flow) {
+    uint8_t resp[IP_MAXPACKET];
+    ssize_t len;
+
+    while ((len = recv(flow.ctl_fd, resp, sizeof(resp), 0)) > 0) {
+        if (len < (ssize_t) sizeof(ResponseHeader))
+            continue;
+
+        rewriteResponse(flow, resp, len);
+        forward(eResponses, resp, len, m_sock, flow.client);
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Forwards the stream of the device to a client
+//////////////////////////////////////////////////////////////////////////
+void CTVSatProxy::processStream(SProxyFlow &flow) {
+    uint8_t buf[IP_MAXPACKET];
+    ssize_t len;
+
+    while ((len = recv(flow.stream_fd, buf, sizeof(buf), 0)) > 0)
+        if (flow.stream_dst.sin_port)
+            forward(eStream, buf, len, flow.stream_fd, flow.stream_dst);
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Adapts a request of a client for the device
+///
+/// Requests for the proxied device carry the real MAC address, and the
+/// stream is directed to the proxy.
+//////////////////////////////////////////////////////////////////////////
+void CTVSatProxy::rewriteRequest(SProxyFlow &flow, uint8_t *req, size_t len) {
+    RequestHeader *rqh = (RequestHeader *) req;
+    uint16_t cmd = ntohs(rqh->mCommand);
+
+    if (m_config.verbose)
+        printf("Request 0x%04x from %s:%u\n", cmd, inet_ntoa(flow.client.sin_addr), ntohs(flow.client.sin_port));
+
+    if (cmd == cCmdBroadcastCmd) {
+        if (len < sizeof(RequestBroadcastCmd))
+            return;
+
+        RequestBroadcastCmd *rqbc = (RequestBroadcastCmd *) req;
+        uint8_t mac[6];
+        memcpy(mac, m_dev_mac, 6);
+        mac[0] |= 0x02;
+
+        if (m_dev_mac_known && (memcmp(rqbc->mDstMac, mac, 6) == 0))
+            memcpy(rqbc->mDstMac, m_dev_mac, 6);
+
+        rewriteRequest(flow, req + sizeof(RequestBroadcastCmd), len - sizeof(RequestBroadcastCmd));
+        return;
+    }
+
+    if ((cmd != cCmdStart) || (len < sizeof(RequestStart)))
+        return;
+
+    RequestStart *rs = (RequestStart *) req;
+    flow.stream_dst.sin_family = AF_INET;
+    memcpy(&flow.stream_dst.sin_addr.s_addr, rs->mClientIpAddress, 4);
+    flow.stream_dst.sin_port = rs->mRecvPort;
+
+    // the device streams to the address the proxy talks to it from
+    sockaddr_in ctl, stream;
+    socklen_t sl = sizeof(sockaddr_in);
+    getsockname(flow.ctl_fd, (sockaddr *) &ctl, &sl);
+    sl = sizeof(sockaddr_in);
+    getsockname(flow.stream_fd, (sockaddr *) &stream, &sl);
+
+    memcpy(rs->mClientIpAddress, &ctl.sin_addr.s_addr, 4);
+    rs->mRecvPort = stream.sin_port;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Adapts a response of the device for a client
+///
+/// Info responses carry the address of the proxy and a MAC address that
+/// differs from the real device, so both can be used side by side.
+//////////////////////////////////////////////////////////////////////////
+void CTVSatProxy::rewriteResponse(const SProxyFlow &flow, uint8_t *resp, size_t len) {
+    ResponseHeader *rsh = (ResponseHeader *) resp;
+
+    if ((ntohs(rsh->mCommand) != cCmdGetInfo) || (len < sizeof(ResponseGetInfo)))
+        return;
+
+    ResponseGetInfo *rgi = (ResponseGetInfo *) resp;
+
+    memcpy(m_dev_mac, rgi->mMacAddress, 6);
+    m_dev_mac_known = true;
+
+    memcpy(rgi->mIpAddress, &flow.local_ip.s_addr, 4);
+    rgi->mMacAddress[0] |= 0x02;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Forwards packets until stop is set
+//////////////////////////////////////////////////////////////////////////
+void CTVSatProxy::run(volatile int &stop) {
+    time_t next_stats = time(0) + m_config.interval;
+    time_t next_expiry = time(0) + TVSAT_PROXY_FLOW_TIMEOUT;
+
+    while (!stop) {
+        std::vector<pollfd> pfds;
+        std::vector<SProxyFlow *> flows;
+
+        pollfd pfd;
+        pfd.fd = m_sock;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        pfds.push_back(pfd);
+
+        for (std::map<uint64_t, SProxyFlow>::iterator it = m_flows.begin(); it != m_flows.end(); ++it) {
+            pfd.fd = it->second.ctl_fd;
+            pfds.push_back(pfd);
+            pfd.fd = it->second.stream_fd;
+            pfds.push_back(pfd);
+            flows.push_back(&it->second);
+        }
+
+        int timeout = 100;
+
+        if (!m_queue.empty()) {
+            uint64_t now = nowUS();
+            uint64_t due = m_queue.begin()->first;
+            timeout = (due > now) ? (due - now + 999) / 1000 : 0;
+
+            if (timeout > 100)
+                timeout = 100;
+        }
+
+        if (poll(&pfds[0], pfds.size(), timeout) > 0) {
+            for (size_t i = 0; i < flows.size(); ++i) {
+                if (pfds[1 + 2 * i].revents & POLLIN)
+                    processResponses(*flows[i]);
+
+                if (pfds[2 + 2 * i].revents & POLLIN)
+                    processStream(*flows[i]);
+            }
+
+            // may add flows, so it goes last
+            if (pfds[0].revents & POLLIN)
+                processRequests();
+        }
+
+        sendDue();
+
+        time_t now = time(0);
+
+        if (now >= next_expiry) {
+            expireFlows();
+            next_expiry = now + TVSAT_PROXY_FLOW_TIMEOUT;
+        }
+
+        if (m_config.interval && (now >= next_stats)) {
+            printStats();
+            next_stats = now + m_config.interval;
+        }
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Sends all delayed packets that are due
+//////////////////////////////////////////////////////////////////////////
+void CTVSatProxy::sendDue() {
+    uint64_t now = nowUS();
+
+    while (!m_queue.empty() && (m_queue.begin()->first <= now)) {
+        const SProxyPacket &p = m_queue.begin()->second;
+        sendto(p.fd, &p.data[0], p.data.size(), 0, (const sockaddr *) &p.dst, sizeof(sockaddr_in));
+        m_queue.erase(m_queue.begin());
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Ends the main loop
+/// @param signum signal (not used)
+//////////////////////////////////////////////////////////////////////////
+static void handleExitSignal(int signum) {
+    stop = 1;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// tvsatproxy main function
+//////////////////////////////////////////////////////////////////////////
+int main(int argc, char **argv) {
+    SProxyConfig config;
+    config.interval = 0;
+    config.seed = 1;
+    config.verbose = false;
+
+    std::string ctl_spec, stream_spec;
+    int c, optidx;
+
+    while ((c = getopt_long(argc, argv, "b:c:d:hi:S:s:v", long_opts, &optidx)) != -1) {
+        switch (c) {
+            case 'b':
+                config.bind_ip = optarg;
+                break;
+
+            case 'c':
+                ctl_spec = optarg;
+                break;
+
+            case 'd':
+                config.dev_ip = optarg;
+                break;
+
+            case 'i':
+                config.interval = atoi(optarg);
+                break;
+
+            case 'S':
+                config.seed = strtoul(optarg, 0, 10);
+                break;
+
+            case 's':
+                stream_spec = optarg;
+                break;
+
+            case 'v':
+                config.verbose = true;
+                break;
+
+            default:
+                std::cout << HELPTXT;
+                return 0;
+        }
+    }
+
+    if (config.dev_ip.empty()) {
+        std::cout << HELPTXT;
+        return 1;
+    }
+
+    CTVSatProxy proxy(config);
+
+    if (!proxy.getImpairment(CTVSatProxy::eRequests).parse(ctl_spec) ||
+        !proxy.getImpairment(CTVSatProxy::eResponses).parse(ctl_spec) ||
+        !proxy.getImpairment(CTVSatProxy::eStream).parse(stream_spec)) {
+        std::cerr << "Error: invalid impairment" << std::endl;
+        return 1;
+    }
+
+    if (!proxy.open())
+        return 1;
+
+    signal(SIGINT, handleExitSignal);
+    signal(SIGTERM, handleExitSignal);
+
+    proxy.run(stop);
+    proxy.printStats();
+
+    return 0;
+}
@@ -0,0 +1,194 @@
+//////////////////////////////////////////////////////////////////////////
+// devolo dLAN TV Sat control application
+// Copyright (C) 2008 devolo AG. All rights reserved.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//
+// Contact information:
+//    devolo AG
+//    Sonnenweg 11
+//    D-52070 Aachen, Germany
+//    gpl@devolo.de
+//////////////////////////////////////////////////////////////////////////
+/// @file tvsatproxy.h
+/// @brief "dLAN TV Sat Network Impairment Proxy" - header
+//////////////////////////////////////////////////////////////////////////
+
+#ifndef __TVSATPROXY_H
+#define __TVSATPROXY_H
+
+#include <map>
+#include <netinet/in.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+//////////////////////////////////////////////////////////////////////////
+// DEFINITIONS
+//////////////////////////////////////////////////////////////////////////
+#define TVSAT_PROXY_FLOW_TIMEOUT       60 // s
+
+//////////////////////////////////////////////////////////////////////////
+/// Counters of an impaired channel
+//////////////////////////////////////////////////////////////////////////
+struct SImpairmentCounters {
+    uint64_t bytes;
+    uint64_t burst_lost;
+    uint64_t lost;
+    uint64_t packets;
+    uint64_t rate_dropped;
+    uint64_t reordered;
+};
+
+//////////////////////////////////////////////////////////////////////////
+/// Faults applied to the packets of one channel
+///
+/// The burst loss follows a two state model: each packet may start a
+/// burst, and all packets of a burst are lost.
+//////////////////////////////////////////////////////////////////////////
+class CImpairment {
+public:
+    CImpairment();
+
+    const SImpairmentCounters &getCounters() const { return m_counters; }
+
+    bool parse(const std::string &spec);
+
+    bool pass(size_t len, uint64_t now, uint64_t &due);
+
+    void seed(uint32_t seed) { m_seed = seed ? seed : 1; }
+
+private:
+    double random();
+
+    /// Probability of a burst to start in percent
+    double m_burst;
+    /// Mean burst length in packets
+    double m_burst_len;
+    bool m_in_burst;
+    SImpairmentCounters m_counters;
+    /// Delay in us
+    uint64_t m_delay;
+    /// Random additional delay in us
+    uint64_t m_jitter;
+    /// Loss in percent
+    double m_loss;
+    /// Time the link is free again in us
+    uint64_t m_next_free;
+    /// Longest time a packet may wait for the link in us
+    uint64_t m_queue;
+    /// Bandwidth in bit/s (0: unlimited)
+    uint64_t m_rate;
+    /// Share of packets that are overtaken by later ones in percent
+    double m_reorder;
+    uint32_t m_seed;
+};
+
+//////////////////////////////////////////////////////////////////////////
+/// A client of the device as seen by the proxy
+///
+/// Each client socket gets its own sockets towards the device, so the
+/// responses and the stream can be told apart.
+//////////////////////////////////////////////////////////////////////////
+struct SProxyFlow {
+    sockaddr_in client;
+    int ctl_fd;
+    time_t last_used;
+    /// The address the client sent its requests to
+    in_addr local_ip;
+    sockaddr_in stream_dst;
+    int stream_fd;
+};
+
+//////////////////////////////////////////////////////////////////////////
+/// A packet that waits for its delay to pass
+//////////////////////////////////////////////////////////////////////////
+struct SProxyPacket {
+    std::vector<uint8_t> data;
+    sockaddr_in dst;
+    int fd;
+};
+
+//////////////////////////////////////////////////////////////////////////
+/// Settings of the proxy
+//////////////////////////////////////////////////////////////////////////
+struct SProxyConfig {
+    /// Address to bind the control socket to (empty: all addresses)
+    std::string bind_ip;
+    std::string dev_ip;
+    /// Interval of the statistics output in s (0: only on exit)
+    int interval;
+    uint32_t seed;
+    bool verbose;
+};
+
+//////////////////////////////////////////////////////////////////////////
+/// Forwards the control and stream traffic of a device and impairs it
+//////////////////////////////////////////////////////////////////////////
+class CTVSatProxy {
+public:
+    enum {
+        eRequests,
+        eResponses,
+        eStream,
+        eNumChannels
+    };
+
+    CTVSatProxy(const SProxyConfig &config);
+
+    ~CTVSatProxy();
+
+    /// Gets the impairment of a channel, e.g. to configure it
+    CImpairment &getImpairment(int channel) { return m_impairments[channel]; }
+
+    bool open();
+
+    void printStats() const;
+
+    void run(volatile int &stop);
+
+private:
+    void expireFlows();
+
+    void forward(int channel, const uint8_t *data, size_t len, int fd, const sockaddr_in &dst);
+
+    SProxyFlow *getFlow(const sockaddr_in &client, const in_addr &local_ip);
+
+    void processRequests();
+
+    void processResponses(SProxyFlow &flow);
+
+    void processStream(SProxyFlow &flow);
+
+    void rewriteRequest(SProxyFlow &flow, uint8_t *req, size_t len);
+
+    void rewriteResponse(const SProxyFlow &flow, uint8_t *resp, size_t len);
+
+    void sendDue();
+
+    static uint64_t nowUS();
+
+    SProxyConfig m_config;
+
+    sockaddr_in m_dev_addr;
+    uint8_t m_dev_mac[6];
+    bool m_dev_mac_known;
+    std::map<uint64_t, SProxyFlow> m_flows;
+    CImpairment m_impairments[eNumChannels];
+    std::multimap<uint64_t, SProxyPacket> m_queue;
+    int m_sock;
+};
+
+#endif
@@ -0,0 +1,463 @@
+//////////////////////////////////////////////////////////////////////////
+// devolo dLAN TV Sat control application
+// Copyright (C) 2008 devolo AG. All rights reserved.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//
+// Contact information:
+//    devolo AG
+//    Sonnenweg 11
+//    D-52070 Aachen, Germany
+//    gpl@devolo.de
+//////////////////////////////////////////////////////////////////////////
+/// @file tvsatsim.cpp
+/// @brief "dLAN TV Sat State Machine Simulator" - implementation
+//////////////////////////////////////////////////////////////////////////
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cstdlib>
+#include <cstring>
+#include <getopt.h>
+#include <iostream>
+#include <map>
+#include <stdio.h>
+#include <string>
+#include <time.h>
+#include <vector>
+
+#include "streamin.h"
+
+//////////////////////////////////////////////////////////////////////////
+// DEFINITIONS
+//////////////////////////////////////////////////////////////////////////
+#define TVSAT_SIM_STREAM_PORT          11109 // below the ports of the daemon
+#define TVSAT_SIM_TICK                 25000 // us, same as the daemon
+#define TVSAT_SIM_ZAP_TIMEOUT          30000000 // us
+
+#define HELPTXT    "tvsatsim - runs the device state machine on virtual time\n"\
+        "Usage: tvsatsim [options]\n"\
+        "\n"\
+        "Changes channels against a simulated device under several fault profiles\n"\
+        "and reports the retries, connection resets and tuning times. The results\n"\
+        "only depend on the options, so runs can be compared.\n"\
+        "\n"\
+        "Options:\n"\
+        "  -D           --diseqc        switch between two DiSEqC positions\n"\
+        "  -h           --help          show this help text\n"\
+        "  -l ms        --lock ms       time from tuning to signal lock (default: 200)\n"\
+        "  -n num       --zaps num      channel changes per profile (default: 1000)\n"\
+        "  -p name      --profile name  run only the named profile\n"\
+        "  -s seed      --seed seed     seed of the fault generator (default: 1)\n"\
+        "\n"\
+        "A custom profile is added by any of:\n"\
+        "  -d ms        --delay ms      response delay\n"\
+        "  -j ms        --jitter ms     random additional response delay\n"\
+        "  -r percent   --reorder percent\n"\
+        "                               responses that are overtaken by later ones\n"\
+        "  -x percent   --loss percent  responses that are dropped\n"
+
+static option long_opts[] = {
+        {"delay",   required_argument, 0, 'd'},
+        {"diseqc",  no_argument,       0, 'D'},
+        {"help",    no_argument,       0, 'h'},
+        {"jitter",  required_argument, 0, 'j'},
+        {"lock",    required_argument, 0, 'l'},
+        {"loss",    required_argument, 0, 'x'},
+        {"zaps",    required_argument, 0, 'n'},
+        {"profile", required_argument, 0, 'p'},
+        {"reorder", required_argument, 0, 'r'},
+        {"seed",    required_argument, 0, 's'},
+        {0, 0, 0, 0}
+};
+
+//////////////////////////////////////////////////////////////////////////
+/// Faults injected into the responses of the simulated device
+//////////////////////////////////////////////////////////////////////////
+struct SSimProfile {
+    const char *name;
+    /// Response delay in ms
+    int delay;
+    /// Random additional delay in ms
+    int jitter;
+    /// Share of dropped responses in percent
+    int loss;
+    /// Share of responses that are overtaken by later ones in percent
+    int reorder;
+};
+
+static const SSimProfile profiles[] = {
+        {"ideal",   1,   0,  0,  0},
+        {"lan",     2,   3,  0,  0},
+        {"lossy",   2,   3,  5,  0},
+        {"reorder", 5,   5,  0,  20},
+        {"slow",    150, 100, 0, 0},
+        {"hostile", 50,  50, 10, 10}
+};
+
+//////////////////////////////////////////////////////////////////////////
+/// Results of a simulation run
+//////////////////////////////////////////////////////////////////////////
+struct SSimResult {
+    int failed;
+    std::vector<double> lock_times;
+    uint64_t requests;
+    uint64_t resets;
+    uint64_t retries;
+    uint64_t ticks;
+};
+
+//////////////////////////////////////////////////////////////////////////
+/// Virtual time
+//////////////////////////////////////////////////////////////////////////
+class CSimClock : public CTVSatClock {
+public:
+    CSimClock() { m_now = 1000000; }
+
+    void getTime(timeval *tv) {
+        tv->tv_sec = m_now / 1000000;
+        tv->tv_usec = m_now % 1000000;
+    }
+
+    /// Gets the virtual time in microseconds
+    uint64_t now() const { return m_now; }
+
+    /// Advances the virtual time
+    void set(uint64_t now) {
+        if (now > m_now)
+            m_now = now;
+    }
+
+private:
+    uint64_t m_now;
+};
+
+//////////////////////////////////////////////////////////////////////////
+/// A NAT device that answers through a faulty network
+//////////////////////////////////////////////////////////////////////////
+class CSimDevice : public CTVSatTransport {
+public:
+    CSimDevice(const SSimProfile &profile, CSimClock &clock, int lock_delay, uint32_t seed)
+            : m_clock(clock) {
+        m_lock_delay = lock_delay;
+        m_lock_time = 0;
+        m_profile = profile;
+        m_requests = 0;
+        m_resets = 0;
+        m_seed = seed ? seed : 1;
+        m_tuned = false;
+    }
+
+    /// Gets the time the next response arrives (0, if there is none)
+    uint64_t getNextResponse() const { return m_responses.empty() ? 0 : m_responses.begin()->first; }
+
+    uint64_t getRequests() const { return m_requests; }
+
+    uint64_t getResets() const { return m_resets; }
+
+    size_t receive(uint8_t *buf, size_t len) {
+        if (m_responses.empty() || (m_responses.begin()->first > m_clock.now()))
+            return 0;
+
+        std::vector<uint8_t> &resp = m_responses.begin()->second;
+        size_t size = std::min(len, resp.size());
+        memcpy(buf, &resp[0], size);
+        m_responses.erase(m_responses.begin());
+
+        return size;
+    }
+
+    void reset() {
+        m_responses.clear();
+        ++m_resets;
+    }
+
+    bool send(const uint8_t *data, size_t len) {
+        if (len < sizeof(RequestHeader))
+            return false;
+
+        ++m_requests;
+
+        uint16_t cmd = ntohs(((const RequestHeader *) data)->mCommand);
+        std::vector<uint8_t> resp(sizeof(ResponseHeader));
+
+        if (cmd == cCmdFeSetFrontend) {
+            m_tuned = true;
+            m_lock_time = m_clock.now() + (uint64_t) m_lock_delay * 1000;
+        } else if (cmd == cCmdFeReadStatus) {
+            resp.resize(sizeof(ResponseFeReadStatus));
+
+            if (m_tuned && (m_clock.now() >= m_lock_time))
+                ((ResponseFeReadStatus *) &resp[0])->mData = htons(0x1f);
+        } else if (cmd == cCmdDisconnect)
+            m_tuned = false;
+
+        ResponseHeader *rsh = (ResponseHeader *) &resp[0];
+        rsh->mSize = htons(resp.size());
+        rsh->mCommand = htons(cmd);
+        rsh->mResult = 0;
+
+        if ((int) random(100) < m_profile.loss)
+            return true;
+
+        uint64_t delay = (uint64_t) m_profile.delay * 1000;
+
+        if (m_profile.jitter)
+            delay += random(m_profile.jitter * 1000);
+
+        // held back until the responses to the next requests have passed
+        if ((int) random(100) < m_profile.reorder)
+            delay += (uint64_t) (2 * m_profile.delay + m_profile.jitter + 1) * 1000;
+
+        m_responses.insert(std::make_pair(m_clock.now() + delay, resp));
+
+        return true;
+    }
+
+private:
+    /// Gets a pseudo random number between 0 and max - 1 (xorshift32)
+    uint32_t random(uint32_t max) {
+        m_seed ^= m_seed << 13;
+        m_seed ^= m_seed >> 17;
+        m_seed ^= m_seed << 5;
+
+        return m_seed % max;
+    }
+
+    CSimClock &m_clock;
+    int m_lock_delay;
+    uint64_t m_lock_time;
+    SSimProfile m_profile;
+    uint64_t m_requests;
+    uint64_t m_resets;
+    std::multimap<uint64_t, std::vector<uint8_t> > m_responses;
+    uint32_t m_seed;
+    bool m_tuned;
+};
+
+//////////////////////////////////////////////////////////////////////////
+/// Changes channels against a simulated device
+///
+/// The state machine is driven like in the reactor mode of the daemon:
+/// on every tick and whenever a response arrives. Virtual time jumps from
+/// one of these events to the next.
+//////////////////////////////////////////////////////////////////////////
+static void simulate(const SSimProfile &profile, int zaps, int lock_delay, bool diseqc, uint32_t seed,
+                     SSimResult &result) {
+    CSimClock clock;
+    CSimDevice dev(profile, clock, lock_delay, seed);
+    uint8_t ip[4] = {127, 0, 0, 1};
+
+    CTVSatStreamIn sin(false);
+    sin.setClock(&clock);
+    sin.setTransport(&dev);
+    sin.setClientIP(ip);
+    sin.setTVSatIP(ip);
+
+    // the start request needs a stream port, even if nothing is streamed
+    sin.setClientPort(TVSAT_SIM_STREAM_PORT);
+    sin.connect();
+
+    result.failed = 0;
+    result.lock_times.clear();
+    result.retries = 0;
+    result.ticks = 0;
+
+    uint64_t next_tick = clock.now();
+
+    for (int zap = 0; zap < zaps; ++zap) {
+        int tp = zap % 4;
+
+        tvsat_tuning_parameters tune;
+        memset(&tune, 0, sizeof(tvsat_tuning_parameters));
+        tune.band = tp % 2;
+        tune.fec = 9;
+        tune.frequency = 1100000 + tp * 20000;
+        tune.polarization = tp / 2;
+        tune.symbol_rate = 27500000;
+
+        if (diseqc) {
+            tune.diseqc[0].type = 1;
+            tune.diseqc[0].message[0] = 0xe0;
+            tune.diseqc[0].message[1] = 0x10;
+            tune.diseqc[0].message[2] = 0x38;
+            tune.diseqc[0].message[3] = 0xf0 | ((tp % 2) << 2) | (tune.polarization << 1) | tune.band;
+            tune.diseqc[0].message_len = 4;
+        }
+
+        uint64_t start = clock.now();
+        bool unlocked = !sin.isTuned();
+        bool locked = false;
+
+        sin.setTuningParameters(&tune);
+        sin.start();
+
+        while (clock.now() - start < TVSAT_SIM_ZAP_TIMEOUT) {
+            uint64_t next = next_tick;
+            uint64_t resp = dev.getNextResponse();
+
+            if (resp && sin.isAwaitingResponse() && (resp < next))
+                next = resp;
+
+            clock.set(next);
+
+            if (clock.now() >= next_tick) {
+                // a tick that finds no response is a retry
+                if (sin.isAwaitingResponse() && (!resp || (resp > clock.now())))
+                    ++result.retries;
+
+                sin.delPIDs();
+                sin.tick();
+                next_tick += TVSAT_SIM_TICK;
+                ++result.ticks;
+            } else if (sin.isAwaitingResponse()) {
+                sin.tick();
+                ++result.ticks;
+            }
+
+            if (!sin.isTuned())
+                unlocked = true;
+            else if (unlocked) {
+                locked = true;
+                break;
+            }
+        }
+
+        if (locked)
+            result.lock_times.push_back((clock.now() - start) / 1000.0);
+        else
+            ++result.failed;
+    }
+
+    result.requests = dev.getRequests();
+    result.resets = dev.getResets();
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Gets a percentile of sorted times
+//////////////////////////////////////////////////////////////////////////
+static double percentile(const std::vector<double> &times, int p) {
+    if (times.empty())
+        return 0;
+
+    return times[std::min(times.size() - 1, times.size() * p / 100)];
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// tvsatsim main function
+//////////////////////////////////////////////////////////////////////////
+int main(int argc, char **argv) {
+    SSimProfile custom = {"custom", 0, 0, 0, 0};
+    bool has_custom = false;
+    bool diseqc = false;
+    int lock_delay = 200;
+    std::string name;
+    uint32_t seed = 1;
+    int zaps = 1000;
+
+    int c, optidx;
+
+    while ((c = getopt_long(argc, argv, "d:Dhj:l:n:p:r:s:x:", long_opts, &optidx)) != -1) {
+        switch (c) {
+            case 'd':
+                custom.delay = atoi(optarg);
+                has_custom = true;
+                break;
+
+            case 'D':
+                diseqc = true;
+                break;
+
+            case 'j':
+                custom.jitter = atoi(optarg);
+                has_custom = true;
+                break;
+
+            case 'l':
+                lock_delay = atoi(optarg);
+                break;
+
+            case 'n':
+                zaps = atoi(optarg);
+                break;
+
+            case 'p':
+                name = optarg;
+                break;
+
+            case 'r':
+                custom.reorder = atoi(optarg);
+                has_custom = true;
+                break;
+
+            case 's':
+                seed = strtoul(optarg, 0, 10);
+                break;
+
+            case 'x':
+                custom.loss = atoi(optarg);
+                has_custom = true;
+                break;
+
+            default:
+                std::cout << HELPTXT;
+                return 0;
+        }
+    }
+
+    if ((zaps <= 0) || (lock_delay < 0) || (custom.delay < 0) || (custom.jitter < 0) || (custom.loss < 0) ||
+        (custom.loss > 100) || (custom.reorder < 0) || (custom.reorder > 100)) {
+        std::cerr << "Error: invalid argument" << std::endl;
+        return 1;
+    }
+
+    std::vector<SSimProfile> run;
+
+    for (size_t i = 0; i < sizeof(profiles) / sizeof(profiles[0]); ++i)
+        if (name.empty() || (name == profiles[i].name))
+            run.push_back(profiles[i]);
+
+    if (has_custom && (name.empty() || (name == custom.name)))
+        run.push_back(custom);
+
+    if (run.empty()) {
+        std::cerr << "Error: unknown profile " << name << std::endl;
+        return 1;
+    }
+
+    printf("%-8s %6s %8s %8s %8s %8s %9s %9s %9s %10s\n", "profile", "failed", "req/zap", "retries",
+           "resets", "ticks", "p50 ms", "p99 ms", "max ms", "ticks/s");
+
+    for (size_t i = 0; i < run.size(); ++i) {
+        SSimResult result;
+        timespec t1, t2;
+
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        simulate(run[i], zaps, lock_delay, diseqc, seed, result);
+        clock_gettime(CLOCK_MONOTONIC, &t2);
+
+        double wall = (t2.tv_sec - t1.tv_sec) + (t2.tv_nsec - t1.tv_nsec) / 1e9;
+
+        std::sort(result.lock_times.begin(), result.lock_times.end());
+
+        printf("%-8s %6i %8.1f %8llu %8llu %8llu %9.1f %9.1f %9.1f %10.0f\n", run[i].name, result.failed,
+               (double) result.requests / zaps, (unsigned long long) result.retries,
+               (unsigned long long) result.resets, (unsigned long long) result.ticks,
+               percentile(result.lock_times, 50), percentile(result.lock_times, 99),
+               result.lock_times.empty() ? 0 : result.lock_times.back(), wall ? result.ticks / wall : 0);
+    }
+
+    return 0;
+}
@@ -0,0 +1,356 @@
+//////////////////////////////////////////////////////////////////////////
+// devolo dLAN TV Sat control application
+// Copyright (C) 2008 devolo AG. All rights reserved.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+//
+// Contact information:
+//    devolo AG
+//    Sonnenweg 11
+//    D-52070 Aachen, Germany
+//    gpl@devolo.de
+//////////////////////////////////////////////////////////////////////////
+/// @file tvsatzap.cpp
+/// @brief "dLAN TV Sat Zap Time Benchmark" - implementation
+//////////////////////////////////////////////////////////////////////////
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <getopt.h>
+#include <iostream>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+#include "streamin.h"
+
+//////////////////////////////////////////////////////////////////////////
+// DEFINITIONS
+//////////////////////////////////////////////////////////////////////////
+#define TVSAT_ZAP_FIRST_PID            0x100
+#define TVSAT_ZAP_TICK                 25 // ms, same as the daemon
+
+#define HELPTXT    "tvsatzap - measures how long channel changes take\n"\
+        "Usage: tvsatzap [options]\n"\
+        "\n"\
+        "Tunes a device through the control protocol of the daemon again and again\n"\
+        "and measures the time from the tune request to the signal lock and to the\n"\
+        "first TS packet of the new channel. Run it against tvsatemu (with injected\n"\
+        "latency and loss) or a real device.\n"\
+        "\n"\
+        "Options:\n"\
+        "  -c ip        --client ip     address the device streams to\n"\
+        "                               (default: 127.0.0.1)\n"\
+        "  -d ip        --device ip     address of the device (default: 127.0.0.1)\n"\
+        "  -D           --diseqc        switch between two DiSEqC positions\n"\
+        "  -h           --help          show this help text\n"\
+        "  -n num       --zaps num      number of channel changes (default: 200)\n"\
+        "  -p port      --port port     stream port (default: 11110)\n"\
+        "  -t num       --transponders num\n"\
+        "                               number of transponders to cycle through\n"\
+        "                               (default: 4)\n"\
+        "  -T ms        --timeout ms    give up on a channel change after 'ms'\n"\
+        "                               (default: 10000)\n"\
+        "  -v           --verbose       log the control protocol\n"
+
+static option long_opts[] = {
+        {"client",       required_argument, 0, 'c'},
+        {"device",       required_argument, 0, 'd'},
+        {"diseqc",       no_argument,       0, 'D'},
+        {"help",         no_argument,       0, 'h'},
+        {"zaps",         required_argument, 0, 'n'},
+        {"port",         required_argument, 0, 'p'},
+        {"transponders", required_argument, 0, 't'},
+        {"timeout",      required_argument, 0, 'T'},
+        {"verbose",      no_argument,       0, 'v'},
+        {0, 0, 0, 0}
+};
+
+static volatile int stop = 0;
+
+//////////////////////////////////////////////////////////////////////////
+/// Gets a monotonic timestamp in milliseconds
+//////////////////////////////////////////////////////////////////////////
+static double nowMS() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Ends the benchmark early
+/// @param signum signal (not used)
+//////////////////////////////////////////////////////////////////////////
+static void handleExitSignal(int signum) {
+    stop = 1;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Checks the stream written by the receive path for a packet of a PID
+/// @param pipe_r the read end of the sink pipe
+/// @param pid the PID to look for
+/// @return true, if a packet of the PID was found
+//////////////////////////////////////////////////////////////////////////
+static bool readSink(int pipe_r, uint16_t pid) {
+    uint8_t buf[64 * 7 * 188];
+    bool found = false;
+    ssize_t len;
+
+    // the receive path writes whole datagrams, so reads return whole
+    // TS packets
+    while ((len = read(pipe_r, buf, sizeof(buf))) > 0)
+        for (ssize_t off = 0; !found && (off + 188 <= len); off += 188)
+            if ((buf[off] == 0x47) && ((((buf[off + 1] & 0x1f) << 8) | buf[off + 2]) == pid))
+                found = true;
+
+    return found;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Prints the distribution of a series of times
+//////////////////////////////////////////////////////////////////////////
+static void printDistribution(const char *name, std::vector<double> &times) {
+    if (times.empty()) {
+        printf("%-16s %8s\n", name, "-");
+        return;
+    }
+
+    std::sort(times.begin(), times.end());
+
+    double sum = 0;
+
+    for (size_t i = 0; i < times.size(); ++i)
+        sum += times[i];
+
+    printf("%-16s %8.1f %8.1f %8.1f %8.1f %8.1f %8.1f\n", name, times.front(), sum / times.size(),
+           times[times.size() / 2], times[times.size() * 90 / 100], times[times.size() * 99 / 100], times.back());
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// tvsatzap main function
+//////////////////////////////////////////////////////////////////////////
+int main(int argc, char **argv) {
+    std::string client_ip = "127.0.0.1";
+    std::string device_ip = "127.0.0.1";
+    bool diseqc = false;
+    int num_zaps = 200;
+    uint16_t port = 11110;
+    int timeout = 10000;
+    int transponders = 4;
+    bool verbose = false;
+
+    int c, optidx;
+
+    while ((c = getopt_long(argc, argv, "c:d:Dhn:p:t:T:v", long_opts, &optidx)) != -1) {
+        switch (c) {
+            case 'c':
+                client_ip = optarg;
+                break;
+
+            case 'd':
+                device_ip = optarg;
+                break;
+
+            case 'D':
+                diseqc = true;
+                break;
+
+            case 'n':
+                num_zaps = atoi(optarg);
+                break;
+
+            case 'p':
+                port = atoi(optarg);
+                break;
+
+            case 't':
+                transponders = atoi(optarg);
+                break;
+
+            case 'T':
+                timeout = atoi(optarg);
+                break;
+
+            case 'v':
+                verbose = true;
+                break;
+
+            default:
+                std::cout << HELPTXT;
+                return 0;
+        }
+    }
+
+    if ((num_zaps <= 0) || (transponders <= 0) || (timeout <= 0)) {
+        std::cerr << "Error: invalid argument" << std::endl;
+        return 1;
+    }
+
+    in_addr cia, dia;
+
+    if (!inet_aton(client_ip.c_str(), &cia) || !inet_aton(device_ip.c_str(), &dia)) {
+        std::cerr << "Error: invalid IP address" << std::endl;
+        return 1;
+    }
+
+    int pipe_fds[2];
+
+    if (pipe2(pipe_fds, O_CLOEXEC | O_NONBLOCK) < 0) {
+        std::cerr << "Error: pipe() failed" << std::endl;
+        return 1;
+    }
+
+    fcntl(pipe_fds[1], F_SETPIPE_SZ, 1 << 20);
+
+    signal(SIGINT, handleExitSignal);
+    signal(SIGTERM, handleExitSignal);
+
+    // drive the state machine the way the daemon does in reactor mode:
+    // on every tick and whenever a response arrives
+    CTVSatStreamIn sin(verbose);
+    sin.setClientIP((uint8_t *) &cia.s_addr);
+    sin.setTVSatIP((uint8_t *) &dia.s_addr);
+    sin.setClientPort(port);
+    sin.setInputDev(pipe_fds[1]);
+
+    if (sin.getStreamSocketFD() < 0) {
+        std::cerr << "Error: can't open stream socket on port " << port << std::endl;
+        return 1;
+    }
+
+    sin.connect();
+
+    std::vector<double> lock_times, ts_times;
+    int failed = 0;
+    int zaps = 0;
+    uint16_t pid = 0;
+
+    for (; (zaps < num_zaps) && !stop; ++zaps) {
+        int tp = zaps % transponders;
+
+        tvsat_tuning_parameters tune;
+        memset(&tune, 0, sizeof(tvsat_tuning_parameters));
+        tune.band = tp % 2;
+        tune.fec = 9;
+        tune.frequency = 1100000 + tp * 20000;
+        tune.polarization = (tp / 2) % 2;
+        tune.symbol_rate = 27500000;
+
+        if (diseqc) {
+            tune.diseqc[0].type = 1;
+            tune.diseqc[0].message[0] = 0xe0;
+            tune.diseqc[0].message[1] = 0x10;
+            tune.diseqc[0].message[2] = 0x38;
+            tune.diseqc[0].message[3] = 0xf0 | ((tp % 2) << 2) | (tune.polarization << 1) | tune.band;
+            tune.diseqc[0].message_len = 4;
+        }
+
+        // every channel change selects a new PID, so packets of the
+        // previous channel can't be mistaken for the new one
+        if (pid)
+            sin.delPID(pid);
+
+        pid = TVSAT_ZAP_FIRST_PID + zaps % 0x1000;
+        sin.addPID(pid);
+
+        double start = nowMS();
+        double lock = 0, first_ts = 0;
+        double next_tick = start;
+        bool unlocked = !sin.isTuned();
+
+        sin.setTuningParameters(&tune);
+        sin.start();
+
+        while (!stop && (!lock || !first_ts)) {
+            double now = nowMS();
+
+            if (now - start > timeout)
+                break;
+
+            if (now >= next_tick) {
+                sin.delPIDs();
+                sin.tick();
+                next_tick = now + TVSAT_ZAP_TICK;
+            }
+
+            pollfd pfd[2];
+            pfd[0].fd = sin.getSocketFD();
+            pfd[0].events = POLLIN;
+            pfd[0].revents = 0;
+            pfd[1].fd = sin.getStreamSocketFD();
+            pfd[1].events = POLLIN;
+            pfd[1].revents = 0;
+
+            int wait = next_tick - nowMS();
+
+            if (poll(pfd, 2, (wait > 0) ? wait : 0) > 0) {
+                if ((pfd[0].revents & POLLIN) && sin.isAwaitingResponse())
+                    sin.tick();
+
+                if (pfd[1].revents & POLLIN) {
+                    sin.drainStreamData();
+
+                    if (readSink(pipe_fds[0], pid) && !first_ts)
+                        first_ts = nowMS() - start;
+                }
+            }
+
+            // the lock of the previous channel is reported until the
+            // device has been stopped
+            if (!sin.isTuned())
+                unlocked = true;
+            else if (unlocked && !lock)
+                lock = nowMS() - start;
+        }
+
+        if (!lock || !first_ts)
+            ++failed;
+
+        if (lock)
+            lock_times.push_back(lock);
+
+        if (first_ts)
+            ts_times.push_back(first_ts);
+
+        if (verbose)
+            printf("Zap %i: lock after %.1f ms, first TS after %.1f ms\n", zaps + 1, lock, first_ts);
+    }
+
+    sin.disconnect();
+    sin.stop();
+
+    // give the disconnect request a chance
+    for (int i = 0; (i < 10) && (sin.getState() != CTVSatStreamIn::eDisconnected); ++i) {
+        sin.tick();
+        usleep(TVSAT_ZAP_TICK * 1000);
+    }
+
+    printf("%i channel changes, %i failed (timeout %i ms)\n\n", zaps, failed, timeout);
+    printf("%-16s %8s %8s %8s %8s %8s %8s\n", "ms", "min", "mean", "p50", "p90", "p99", "max");
+    printDistribution("tune -> lock", lock_times);
+    printDistribution("tune -> first TS", ts_times);
+
+    close(pipe_fds[0]);
+    close(pipe_fds[1]);
+
+    return failed ? 2 : 0;
+}
@@ -28,12 +28,15 @@
 /// @author Michael Beckers
 //////////////////////////////////////////////////////////////////////////
 
+#include <cerrno>
 #include <cstring>
-#include <iostream>
 #include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
 #include <sys/socket.h>
 #include <unistd.h>
 
+#include "log.h"
 #include "udpsocket.h"
 
 //////////////////////////////////////////////////////////////////////////
@@ -52,6 +55,33 @@ CUDPSocket::~CUDPSocket() {
         ::close(m_fd);
 }
 
+//////////////////////////////////////////////////////////////////////////
+/// Takes ownership of a socket that was opened elsewhere
+//////////////////////////////////////////////////////////////////////////
+void CUDPSocket::attach(int fd) {
+    close();
+
+    m_fd = fd;
+
+    socklen_t sa_len = sizeof(sockaddr_in);
+
+    if (m_fd >= 0)
+        getsockname(m_fd, (sockaddr *) &m_sock_addr, &sa_len);
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Gives up ownership of the socket without closing it
+/// @return the file descriptor of the socket
+//////////////////////////////////////////////////////////////////////////
+int CUDPSocket::detach() {
+    int fd = m_fd;
+
+    m_fd = -1;
+    memset(&m_sock_addr, 0, sizeof(sockaddr_in));
+
+    return fd;
+}
+
 //////////////////////////////////////////////////////////////////////////
 /// Opens a socket and binds it to the specified port
 //////////////////////////////////////////////////////////////////////////
@@ -63,7 +93,7 @@ bool CUDPSocket::open(unsigned short port) {
     m_fd = socket(PF_INET, (int) SOCK_DGRAM, IPPROTO_UDP);
 
     if (m_fd < 0) {
-        std::cerr << "socket() failed" << std::endl;
+        logErr("socket() failed");
         close();
     } else {
         int reuse = 1;
@@ -77,7 +107,7 @@ bool CUDPSocket::open(unsigned short port) {
         m_sock_addr.sin_addr.s_addr = htonl(INADDR_ANY);
 
         if (bind(m_fd, (sockaddr *) &m_sock_addr, sizeof(sockaddr_in)) < 0) {
-            std::cerr << "bind() failed" << std::endl;
+            logErr("bind() failed");
             close();
         } else
             rc = true;
@@ -123,9 +153,9 @@ bool CUDPSocket::send(const unsigned char *data, size_t len, const std::string &
     in_addr a;
 
     if (!inet_aton(ipaddr.c_str(), &a))
-        std::cerr << "Invalid IP address" << std::endl;
+        logErr("Invalid IP address");
     else if (m_fd < 0)
-        std::cerr << "UDP socket not open" << std::endl;
+        logErr("UDP socket not open");
     else {
         sockaddr_in sa;
         memset(&sa, 0, sizeof(sockaddr_in));
@@ -134,7 +164,7 @@ bool CUDPSocket::send(const unsigned char *data, size_t len, const std::string &
         sa.sin_port = htons(port);
 
         if (sendto(m_fd, data, len, 0, (sockaddr *) &sa, sizeof(sockaddr_in)) <= 0)
-            std::cerr << "sendto() failed" << std::endl;
+            logErr("sendto() failed");
         else
             rc = true;
     }
@@ -155,7 +185,7 @@ size_t CUDPSocket::receive(unsigned char *buf, size_t len, bool blocking, int ti
     size_t ret = 0;
 
     if (m_fd < 0)
-        std::cerr << "UDP socket not open" << std::endl;
+        logErr("UDP socket not open");
     else {
         fd_set set;
         FD_ZERO(&set);
@@ -168,7 +198,7 @@ size_t CUDPSocket::receive(unsigned char *buf, size_t len, bool blocking, int ti
         int sel = select(FD_SETSIZE, &set, 0, 0, blocking ? 0 : &to);
 
         if (sel < 0)
-            std::cerr << "select() failed" << std::endl;
+            logErr("select() failed");
         else if (sel > 0) {
             sockaddr_in sa;
             socklen_t salen = sizeof(sockaddr_in);
@@ -177,7 +207,7 @@ size_t CUDPSocket::receive(unsigned char *buf, size_t len, bool blocking, int ti
             int rbytes = recvfrom(m_fd, buf, len, 0, (sockaddr *) &sa, &salen);
 
             if (rbytes < 0)
-                std::cerr << "recv() failed" << std::endl;
+                logErr("recv() failed");
             else
                 ret = (size_t) rbytes;
         }
@@ -185,3 +215,96 @@ size_t CUDPSocket::receive(unsigned char *buf, size_t len, bool blocking, int ti
 
     return ret;
 }
+
+//////////////////////////////////////////////////////////////////////////
+/// Receives a UDP packet and the interface it arrived on
+///
+/// The IP_PKTINFO option has to be enabled on the socket, otherwise the
+/// interface can't be determined.
+///
+/// @param buf pointer to the buffer that will hold the received payload
+/// @param len size of the payload buffer
+/// @param[out] if_index index of the receiving interface (0, if unknown)
+/// @param timeout the time to wait for an incoming packet in microseconds
+/// @return payload size of the received packet, if a packet has been
+///         received
+/// @return 0, if no packet has been received
+//////////////////////////////////////////////////////////////////////////
+size_t CUDPSocket::receiveIf(unsigned char *buf, size_t len, int &if_index, int timeout) const {
+    if_index = 0;
+
+    if (m_fd < 0) {
+        logErr("UDP socket not open");
+        return 0;
+    }
+
+    pollfd pfd;
+    pfd.fd = m_fd;
+    pfd.events = POLLIN;
+
+    int ret = poll(&pfd, 1, timeout / 1000);
+
+    if (ret < 0) {
+        logErr("poll() failed");
+        return 0;
+    }
+
+    if (ret == 0)
+        return 0;
+
+    char cbuf[CMSG_SPACE(sizeof(in_pktinfo))];
+    iovec iov;
+    iov.iov_base = buf;
+    iov.iov_len = len;
+
+    msghdr msg;
+    memset(&msg, 0, sizeof(msghdr));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = cbuf;
+    msg.msg_controllen = sizeof(cbuf);
+
+    int rbytes = recvmsg(m_fd, &msg, MSG_DONTWAIT);
+
+    if (rbytes < 0) {
+        if ((errno != EAGAIN) && (errno != EWOULDBLOCK))
+            logErr("recv() failed");
+
+        return 0;
+    }
+
+    for (cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+        if ((cmsg->cmsg_level == IPPROTO_IP) && (cmsg->cmsg_type == IP_PKTINFO))
+            if_index = ((in_pktinfo *) CMSG_DATA(cmsg))->ipi_ifindex;
+
+    return (size_t) rbytes;
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Receives a UDP packet if one is already waiting in the socket buffer
+///
+/// Unlike receive(), this function never waits and gets by with a single
+/// system call, so it is suited for draining a socket that has been
+/// reported readable.
+///
+/// @param buf pointer to the buffer that will hold the received payload
+/// @param len size of the payload buffer
+/// @return payload size of the received packet, if a packet has been
+///         received
+/// @return 0, if no packet was waiting
+//////////////////////////////////////////////////////////////////////////
+size_t CUDPSocket::tryReceive(unsigned char *buf, size_t len) const {
+    if (m_fd < 0)
+        return 0;
+
+    int rbytes = recv(m_fd, buf, len, MSG_DONTWAIT);
+
+    if (rbytes < 0) {
+        if ((errno != EAGAIN) && (errno != EWOULDBLOCK))
+            logErr("recv() failed");
+
+        return 0;
+    }
+
+    return (size_t) rbytes;
+}
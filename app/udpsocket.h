@@ -48,16 +48,27 @@ public:
 
     ~CUDPSocket();
 
+    void attach(int fd);
+
     void close();
 
+    int detach();
+
+    /// Gets the file descriptor of the socket (-1, if it isn't open)
+    int getFD() const { return m_fd; }
+
     unsigned short getPort();
 
     bool open(unsigned short port);
 
     size_t receive(unsigned char *buf, size_t len, bool blocking = true, int timeout = 100000) const;
 
+    size_t receiveIf(unsigned char *buf, size_t len, int &if_index, int timeout) const;
+
     bool send(const unsigned char *data, size_t len, const std::string &ipaddr, unsigned short port) const;
 
+    size_t tryReceive(unsigned char *buf, size_t len) const;
+
 private:
     int m_fd;
     unsigned short m_port;
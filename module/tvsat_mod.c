@@ -34,12 +34,20 @@
 #include <linux/dvb/frontend.h>
 #include <linux/dvb/version.h>
 #include <linux/cdev.h>
+#include <linux/debugfs.h>
 #include <linux/ioctl.h>
 #include <linux/fs.h>
+#include <linux/ktime.h>
+#include <linux/mutex.h>
+#include <linux/percpu.h>
+#include <linux/poll.h>
 #include <linux/proc_fs.h>
+#include <linux/seq_file.h>
 #include <linux/time.h>
 #include <linux/uaccess.h>
 #include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/workqueue.h>
 #include <asm/io.h>
 
 #if KERNEL_VERSION(4, 15, 0) > LINUX_VERSION_CODE
@@ -69,6 +77,13 @@
 #define SYM_MIN               22000000
 #define SYM_MAX               27500000
 
+// statistics in /sys/kernel/debug/dlan-tvsat/tvs<n>/stats
+#if defined(CONFIG_DEBUG_FS) && (KERNEL_VERSION(3, 17, 0) <= LINUX_VERSION_CODE)
+	#define TVSAT_STATS
+#endif
+
+#define TVSAT_FE_IOCTLS       20
+
 
 MODULE_AUTHOR("Michael Beckers");
 MODULE_LICENSE("GPL v2");
@@ -78,8 +93,61 @@ struct tvsat_event_list {
 	struct tvsat_event  *first;
 	struct tvsat_event  *last;
 	unsigned int         count;
+	wait_queue_head_t    wq;
+};
+
+// frontend ioctls that are counted separately, the last entry counts all others
+static const struct {
+	unsigned int  cmd;
+	const char   *name;
+} tvsat_fe_ioctls[TVSAT_FE_IOCTLS] = {
+	{ FE_GET_INFO,                    "FE_GET_INFO" },
+	{ FE_DISEQC_RESET_OVERLOAD,       "FE_DISEQC_RESET_OVERLOAD" },
+	{ FE_DISEQC_SEND_MASTER_CMD,      "FE_DISEQC_SEND_MASTER_CMD" },
+	{ FE_DISEQC_RECV_SLAVE_REPLY,     "FE_DISEQC_RECV_SLAVE_REPLY" },
+	{ FE_DISEQC_SEND_BURST,           "FE_DISEQC_SEND_BURST" },
+	{ FE_SET_TONE,                    "FE_SET_TONE" },
+	{ FE_SET_VOLTAGE,                 "FE_SET_VOLTAGE" },
+	{ FE_ENABLE_HIGH_LNB_VOLTAGE,     "FE_ENABLE_HIGH_LNB_VOLTAGE" },
+	{ FE_READ_STATUS,                 "FE_READ_STATUS" },
+	{ FE_READ_BER,                    "FE_READ_BER" },
+	{ FE_READ_SIGNAL_STRENGTH,        "FE_READ_SIGNAL_STRENGTH" },
+	{ FE_READ_SNR,                    "FE_READ_SNR" },
+	{ FE_READ_UNCORRECTED_BLOCKS,     "FE_READ_UNCORRECTED_BLOCKS" },
+	{ FE_SET_FRONTEND,                "FE_SET_FRONTEND" },
+	{ FE_GET_FRONTEND,                "FE_GET_FRONTEND" },
+	{ FE_GET_EVENT,                   "FE_GET_EVENT" },
+	{ FE_DISHNETWORK_SEND_LEGACY_CMD, "FE_DISHNETWORK_SEND_LEGACY_CMD" },
+	{ FE_GET_PROPERTY,                "FE_GET_PROPERTY" },
+	{ FE_SET_PROPERTY,                "FE_SET_PROPERTY" },
+	{ 0,                              "other" }
+};
+
+// counters of a device
+// every cpu has its own copy, so counting needs neither locks nor atomic
+// operations; the copies are only summed up when the stats are read
+struct tvsat_stats {
+	u64  events_dropped;
+	u64  events_popped;
+	u64  events_queued;
+	u64  fe_ioctls[TVSAT_FE_IOCTLS];
+	u64  lock_reports;
+	u64  swfilter_ns;
+	u64  write_bytes;
+	u64  write_calls;
 };
 
+#ifdef TVSAT_STATS
+	#define TVSAT_STATS_ADD(dev, field, n) \
+		do { if ((dev)->stats) this_cpu_add((dev)->stats->field, (n)); } while (0)
+	#define TVSAT_STATS_NOW() ktime_get_ns()
+#else
+	// the arguments are still evaluated, so the variables that only feed
+	// the statistics don't end up set but unused
+	#define TVSAT_STATS_ADD(dev, field, n) do { (void)(dev); (void)(n); } while (0)
+	#define TVSAT_STATS_NOW() 0ULL
+#endif
+
 // this structure represents a device
 // it contains everything that is device specific
 struct tvsat_device {
@@ -88,12 +156,19 @@ struct tvsat_device {
 	struct tvsat_dev_id            *dev_id;
 	struct nat_device              *device;
 	struct dmxdev                  *dmxdev;
+	struct dentry                  *debugfs;
 	struct tvsat_event_list         events;
+	atomic_t                        feeds;
 	struct dvb_device              *frontend;
+	int                             fe_users;
 	int                             in_use;
 	struct cdev                     input_cdev;
+	int                             removed;
+	struct work_struct              remove_work;
+	struct tvsat_stats __percpu    *stats;
 	int                             tuned;
 	struct tvsat_tuning_parameters  tuning_parameters;
+	spinlock_t                      users_lock;
 };
 
 // the private data of the driver
@@ -102,6 +177,8 @@ struct tvsat {
 	dev_t                           dev_node;
 	struct tvsat_device             devices[MAX_DEVS];
 	struct nat_driver               driver;
+	struct dentry                  *debugfs;
+	struct mutex                    lock;
 	struct class                   *nat_class;
 	wait_queue_head_t               pollq;
 };
@@ -132,6 +209,7 @@ static void tvsat_init_event_list(struct tvsat_event_list *el)
 	el->first = NULL;
 	el->last = NULL;
 	el->count = 0;
+	init_waitqueue_head(&el->wq);
 };
 
 // removes an event from the top of a given event list and returns it
@@ -165,10 +243,14 @@ static struct tvsat_event *tvsat_pop_event(struct tvsat_event_list *el)
 static void tvsat_add_event(struct tvsat_event_list *el, struct tvsat_event *ev)
 {
 	struct tvsat_event *old_ev;
+	struct tvsat_device *dev;
 
 	if (!el || !ev)
 		return;
 
+	dev = container_of(el, struct tvsat_device, events);
+	TVSAT_STATS_ADD(dev, events_queued, 1);
+
 	ev->next = NULL;
 
 	if (!el->last) {
@@ -185,7 +267,11 @@ static void tvsat_add_event(struct tvsat_event_list *el, struct tvsat_event *ev)
 		printk(KERN_ERR "%s(): event list overflow\n", __func__);
 		old_ev = tvsat_pop_event(el);
 		kfree(old_ev);
+		TVSAT_STATS_ADD(dev, events_dropped, 1);
 	}
+
+	// wake up the userspace daemon if it polls the input device
+	wake_up_interruptible(&el->wq);
 }
 
 // add a parameterless event to a given event list
@@ -486,6 +572,11 @@ static long tvsat_frontend_ioctl(struct file *file, unsigned int cmd, unsigned l
 
 	dev = ((struct dvb_device *)file->private_data)->priv;
 
+	// a removed device only tells the application that the signal is gone
+	// until the application lets go of it
+	if (dev->removed && (cmd != FE_GET_INFO) && (cmd != FE_READ_STATUS) && (cmd != FE_GET_EVENT))
+		return -ENODEV;
+
 	switch (cmd) {
 	case FE_GET_INFO:
 		// returns the frontend info
@@ -567,7 +658,8 @@ static long tvsat_frontend_ioctl(struct file *file, unsigned int cmd, unsigned l
 		//
 		// this is not really necessary because all the major dvb programs
 		// rely on fe_get_event to get locking information
-		status = FE_HAS_SIGNAL | FE_HAS_LOCK | FE_HAS_SYNC | FE_HAS_CARRIER | FE_HAS_VITERBI;
+		if (!dev->removed)
+			status = FE_HAS_SIGNAL | FE_HAS_LOCK | FE_HAS_SYNC | FE_HAS_CARRIER | FE_HAS_VITERBI;
 
 		return copy_to_user((void __user *)arg, &status, sizeof(enum fe_status));
 
@@ -678,6 +770,25 @@ static long tvsat_frontend_ioctl(struct file *file, unsigned int cmd, unsigned l
 	return 0;
 }
 
+// counts the ioctls on our dvb frontends by command
+// FE_GET_EVENT calls tvsat_frontend_ioctl() again, so it can't count itself
+static long tvsat_frontend_counted_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
+{
+	struct tvsat_device *dev;
+	int i;
+
+	dev = ((struct dvb_device *)file->private_data)->priv;
+
+	for (i = 0; i < TVSAT_FE_IOCTLS - 1; ++i) {
+		if (tvsat_fe_ioctls[i].cmd == cmd)
+			break;
+	}
+
+	TVSAT_STATS_ADD(dev, fe_ioctls[i], 1);
+
+	return tvsat_frontend_ioctl(file, cmd, arg);
+}
+
 // input is always possible because our frontend doesn't block
 static unsigned int tvsat_frontend_poll(struct file *file, struct poll_table_struct *wait)
 {
@@ -693,6 +804,16 @@ static int tvsat_frontend_open(struct inode *inode, struct file *file)
 	dvbdev = file->private_data;
 	dev = dvbdev->priv;
 
+	spin_lock(&dev->users_lock);
+
+	if (dev->removed) {
+		spin_unlock(&dev->users_lock);
+		return -ENODEV;
+	}
+
+	++dev->fe_users;
+	spin_unlock(&dev->users_lock);
+
 	tvsat_add_connect_event(&dev->events);
 
 	return 0;
@@ -703,19 +824,33 @@ static int tvsat_frontend_release(struct inode *inode, struct file *file)
 {
 	struct dvb_device *dvbdev;
 	struct tvsat_device *dev;
+	int last, ret;
 
 	dvbdev = file->private_data;
 	dev = dvbdev->priv;
 
 	tvsat_add_disconnect_event(&dev->events);
 
-	return dvb_generic_release(inode, file);
+	// the frontend must not be unregistered before this is done
+	ret = dvb_generic_release(inode, file);
+
+	spin_lock(&dev->users_lock);
+	--dev->fe_users;
+	last = dev->removed && !dev->fe_users;
+	spin_unlock(&dev->users_lock);
+
+	// a removed device can finally go, but not from here, because the
+	// file still refers to the frontend until this returns
+	if (last)
+		schedule_work(&dev->remove_work);
+
+	return ret;
 }
 
 // the frontends' file ops struct
 static struct file_operations tvsat_frontend_file_operations = {
 	.owner          = THIS_MODULE,
-	.unlocked_ioctl = tvsat_frontend_ioctl,
+	.unlocked_ioctl = tvsat_frontend_counted_ioctl,
 	.poll           = tvsat_frontend_poll,
 	.open           = tvsat_frontend_open,
 	.release        = tvsat_frontend_release,
@@ -741,6 +876,7 @@ static int tvsat_start_feed(struct dvb_demux_feed *feed)
 	pid_sel.pid = feed->pid;
 	pid_sel.type = feed->pes_type;
 	tvsat_add_pid_event(&dev->events, &pid_sel);
+	atomic_inc(&dev->feeds);
 
 	return 0;
 }
@@ -757,6 +893,7 @@ static int tvsat_stop_feed(struct dvb_demux_feed *feed)
 	pid_sel.pid = feed->pid;
 	pid_sel.type = feed->pes_type;
 	tvsat_add_pid_event(&dev->events, &pid_sel);
+	atomic_dec(&dev->feeds);
 
 	return 0;
 }
@@ -765,10 +902,21 @@ static int tvsat_stop_feed(struct dvb_demux_feed *feed)
 static ssize_t tvsat_input_write(struct file *file, const char *buf, size_t count, loff_t *offset)
 {
 	struct tvsat_device *dev;
+	u64 start;
 
 	dev = &tvsat->devices[iminor(/* file->f_dentry->d_inode */ file->f_path.dentry->d_inode) - 1];
+
+	// the daemon may still be writing while its device is unregistered
+	if (!dev->in_use || dev->removed)
+		return -ENODEV;
+
+	start = TVSAT_STATS_NOW();
 	dvb_dmx_swfilter(dev->demux, buf, count);
 
+	TVSAT_STATS_ADD(dev, swfilter_ns, TVSAT_STATS_NOW() - start);
+	TVSAT_STATS_ADD(dev, write_bytes, count);
+	TVSAT_STATS_ADD(dev, write_calls, 1);
+
 	return count;
 }
 
@@ -780,11 +928,17 @@ static long tvsat_input_ioctl(/* struct inode *inode, */ struct file *file, unsi
 
 	dev = &tvsat->devices[iminor(/* inode */ file->f_path.dentry->d_inode) - 1];
 
+	// the input device of a removed device stays until it is released, but
+	// its events are kept for the daemon that revives it
+	if (!dev->in_use || dev->removed)
+		return -ENODEV;
+
 	switch (cmd) {
 	case TVS_HAS_LOCK:
 		// the userspace daemon reports a signal lock
 		// reported only once when the locking state changes
 		dev->tuned = 1;
+		TVSAT_STATS_ADD(dev, lock_reports, 1);
 
 		return 0;
 	case TVS_GET_EVENT:
@@ -801,6 +955,7 @@ static long tvsat_input_ioctl(/* struct inode *inode, */ struct file *file, unsi
 			return -EFAULT;
 
 		kfree(ev);
+		TVSAT_STATS_ADD(dev, events_popped, 1);
 
 		return 0;
 	default:
@@ -808,19 +963,156 @@ static long tvsat_input_ioctl(/* struct inode *inode, */ struct file *file, unsi
 	}
 }
 
+// lets the userspace daemon wait for events instead of polling for them
+// writing is always possible because the data goes straight to the demuxer
+static unsigned int tvsat_input_poll(struct file *file, struct poll_table_struct *wait)
+{
+	struct tvsat_device *dev;
+	unsigned int mask = POLLOUT | POLLWRNORM;
+
+	dev = &tvsat->devices[iminor(file->f_path.dentry->d_inode) - 1];
+	poll_wait(file, &dev->events.wq, wait);
+
+	if (dev->events.first)
+		mask |= POLLIN | POLLRDNORM;
+
+	return mask;
+}
+
 // the input devs' file ops struct
 static struct file_operations tvsat_input_file_operations = {
 	.owner          = THIS_MODULE,
 	.write          = tvsat_input_write,
 	.unlocked_ioctl = tvsat_input_ioctl,
+	.poll           = tvsat_input_poll,
+};
+
+#ifdef TVSAT_STATS
+// prints the statistics of a device, summed up over all cpus
+static int tvsat_stats_show(struct seq_file *m, void *v)
+{
+	struct tvsat_device *dev = m->private;
+	struct tvsat_stats sum, *s;
+	int cpu, i;
+
+	memset(&sum, 0, sizeof(sum));
+
+	for_each_possible_cpu(cpu) {
+		s = per_cpu_ptr(dev->stats, cpu);
+
+		sum.events_dropped += s->events_dropped;
+		sum.events_popped += s->events_popped;
+		sum.events_queued += s->events_queued;
+		sum.lock_reports += s->lock_reports;
+		sum.swfilter_ns += s->swfilter_ns;
+		sum.write_bytes += s->write_bytes;
+		sum.write_calls += s->write_calls;
+
+		for (i = 0; i < TVSAT_FE_IOCTLS; ++i)
+			sum.fe_ioctls[i] += s->fe_ioctls[i];
+	}
+
+	seq_printf(m, "device %s\n", dev->device->name);
+	seq_printf(m, "feeds %i\n", atomic_read(&dev->feeds));
+	seq_printf(m, "events_pending %u\n", dev->events.count);
+	seq_printf(m, "events_queued %llu\n", sum.events_queued);
+	seq_printf(m, "events_dropped %llu\n", sum.events_dropped);
+	seq_printf(m, "events_popped %llu\n", sum.events_popped);
+	seq_printf(m, "lock_reports %llu\n", sum.lock_reports);
+	seq_printf(m, "write_calls %llu\n", sum.write_calls);
+	seq_printf(m, "write_bytes %llu\n", sum.write_bytes);
+	seq_printf(m, "swfilter_ns %llu\n", sum.swfilter_ns);
+
+	for (i = 0; i < TVSAT_FE_IOCTLS; ++i)
+		seq_printf(m, "fe_ioctl %s %llu\n", tvsat_fe_ioctls[i].name, sum.fe_ioctls[i]);
+
+	// the input path per cpu shows where the demuxing time is spent
+	for_each_possible_cpu(cpu) {
+		s = per_cpu_ptr(dev->stats, cpu);
+
+		if (s->write_calls)
+			seq_printf(m, "cpu%i write_calls %llu write_bytes %llu swfilter_ns %llu\n",
+					cpu, s->write_calls, s->write_bytes, s->swfilter_ns);
+	}
+
+	return 0;
+}
+
+static int tvsat_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, tvsat_stats_show, inode->i_private);
+}
+
+static const struct file_operations tvsat_stats_file_operations = {
+	.owner   = THIS_MODULE,
+	.open    = tvsat_stats_open,
+	.read    = seq_read,
+	.llseek  = seq_lseek,
+	.release = single_release,
 };
 
+// creates /sys/kernel/debug/dlan-tvsat/tvs<n>/stats for a device
+static void tvsat_stats_create(struct tvsat_device *dev, int dev_num)
+{
+	char name[16];
+
+	if (IS_ERR_OR_NULL(tvsat->debugfs) || !dev->stats)
+		return;
+
+	snprintf(name, sizeof(name), "tvs%i", dev_num);
+	dev->debugfs = debugfs_create_dir(name, tvsat->debugfs);
+
+	if (IS_ERR_OR_NULL(dev->debugfs)) {
+		dev->debugfs = NULL;
+		return;
+	}
+
+	debugfs_create_file("stats", 0444, dev->debugfs, dev, &tvsat_stats_file_operations);
+}
+#endif
+
+// creates the input character device of a device
+static int tvsat_add_input(struct tvsat_device *dev, int dev_num)
+{
+	dev_t dev_node;
+
+	cdev_init(&dev->input_cdev, &tvsat_input_file_operations);
+	tvsat->control_cdev.owner = THIS_MODULE;
+
+	dev_node = MKDEV(MAJOR(tvsat->dev_node), MINOR(tvsat->dev_node) + dev_num + 1);
+
+	if (cdev_add(&dev->input_cdev, dev_node, 1) < 0)
+		return -EFAULT;
+
+#if KERNEL_VERSION(2, 6, 27) < LINUX_VERSION_CODE
+	device_create(tvsat->nat_class, NULL, dev_node, NULL, "tvs%i", dev_num);
+#else
+#if KERNEL_VERSION(2, 6, 18) < LINUX_VERSION_CODE
+	device_create(tvsat->nat_class, NULL, dev_node, "tvs%i", dev_num);
+#else
+	class_device_create(tvsat->nat_class, NULL, dev_node, NULL, "tvs%i", dev_num);
+#endif
+#endif
+
+	return 0;
+}
+
+// removes the input character device of a device
+static void tvsat_remove_input(struct tvsat_device *dev, int dev_num)
+{
+	cdev_del(&dev->input_cdev);
+#if KERNEL_VERSION(2, 6, 18) < LINUX_VERSION_CODE
+	device_destroy(tvsat->nat_class, MKDEV(MAJOR(tvsat->dev_node), MINOR(tvsat->dev_node) + dev_num + 1));
+#else
+	class_device_destroy(tvsat->nat_class, MKDEV(MAJOR(tvsat->dev_node), MINOR(tvsat->dev_node) + dev_num + 1));
+#endif
+}
+
 // registers a new device with the nat bus and the dvb subsystem
 static int tvsat_register_device(struct tvsat_dev_id *dev_id)
 {
 	struct tvsat_device *dev;
 	int i, ret;
-	dev_t dev_node;
 #if KERNEL_VERSION(2, 6, 26) < LINUX_VERSION_CODE
 	short pref_nums[DVB_MAX_ADAPTERS];
 	int j;
@@ -839,6 +1131,18 @@ static int tvsat_register_device(struct tvsat_dev_id *dev_id)
 		return -ENOMEM;
 	}
 
+	dev->fe_users = 0;
+	dev->removed = 0;
+
+	// the statistics are optional, counting is skipped if this fails
+	atomic_set(&dev->feeds, 0);
+	dev->debugfs = NULL;
+#ifdef TVSAT_STATS
+	dev->stats = alloc_percpu(struct tvsat_stats);
+#else
+	dev->stats = NULL;
+#endif
+
 	// create and register a new nat device
 	dev->dev_id = kmalloc(sizeof(struct tvsat_dev_id), GFP_KERNEL);
 	memcpy(dev->dev_id, dev_id, sizeof(struct tvsat_dev_id));
@@ -911,13 +1215,11 @@ static int tvsat_register_device(struct tvsat_dev_id *dev_id)
 
 	dvb_register_device(dev->adapter, &dev->frontend, &tvsat_frontend_template, dev, DVB_DEVICE_FRONTEND, 1);
 
-	// create an input character device
-	cdev_init(&dev->input_cdev, &tvsat_input_file_operations);
-	tvsat->control_cdev.owner = THIS_MODULE;
-
-	dev_node = MKDEV(MAJOR(tvsat->dev_node), MINOR(tvsat->dev_node) + i + 1);
+	// the event list has to be ready before the input device can be opened
+	tvsat_init_event_list(&dev->events);
 
-	if (cdev_add(&dev->input_cdev, dev_node, 1) < 0) {
+	// create an input character device
+	if (tvsat_add_input(dev, i) < 0) {
 		printk(KERN_ERR "%s(): Failed to initialize input device\n", __func__);
 		dvb_unregister_device(dev->frontend);
 		dvb_dmxdev_release(dev->dmxdev);
@@ -926,24 +1228,18 @@ static int tvsat_register_device(struct tvsat_dev_id *dev_id)
 		goto cleanup;
 	}
 
-#if KERNEL_VERSION(2, 6, 27) < LINUX_VERSION_CODE
-	device_create(tvsat->nat_class, NULL, dev_node, NULL, "tvs%i", i);
-#else
-#if KERNEL_VERSION(2, 6, 18) < LINUX_VERSION_CODE
-	device_create(tvsat->nat_class, NULL, dev_node, "tvs%i", i);
-#else
-	class_device_create(tvsat->nat_class, NULL, dev_node, NULL, "tvs%i", i);
-#endif
+#ifdef TVSAT_STATS
+	tvsat_stats_create(dev, i);
 #endif
 
-	tvsat_init_event_list(&dev->events);
-
 	dev->in_use = 1;
 
 	// return the device's minor number
 	return i + 1;
 
 cleanup:
+	free_percpu(dev->stats);
+	dev->stats = NULL;
 	kfree(dev->dev_id);
 	kfree(dev->device->name);
 	kfree(dev->device);
@@ -954,24 +1250,16 @@ cleanup:
 	return -EFAULT;
 }
 
-// unregisters a device from the nat bus and the dvb subsystem
-static int tvsat_unregister_device(int dev_num)
+// removes the input device of a device, unregisters it from the dvb
+// subsystem and the nat bus and frees it
+static void tvsat_release_device(struct tvsat_device *dev)
 {
-	struct tvsat_device *dev;
-
-	if (dev_num < 0 || dev_num >= MAX_DEVS)
-		return -ENODEV;
-
-	dev = &tvsat->devices[dev_num];
-
-	if (!dev->in_use)
-		return -ENODEV;
+	tvsat_remove_input(dev, dev - tvsat->devices);
 
-	cdev_del(&dev->input_cdev);
-#if KERNEL_VERSION(2, 6, 18) < LINUX_VERSION_CODE
-	device_destroy(tvsat->nat_class, MKDEV(MAJOR(tvsat->dev_node), MINOR(tvsat->dev_node) + dev_num + 1));
-#else
-	class_device_destroy(tvsat->nat_class, MKDEV(MAJOR(tvsat->dev_node), MINOR(tvsat->dev_node) + dev_num + 1));
+#ifdef TVSAT_STATS
+	// removing the stats file waits for its readers
+	debugfs_remove_recursive(dev->debugfs);
+	dev->debugfs = NULL;
 #endif
 
 	if (dev->frontend)
@@ -996,11 +1284,93 @@ static int tvsat_unregister_device(int dev_num)
 	kfree(dev->device);
 	kfree(dev->dev_id);
 
+	free_percpu(dev->stats);
+	dev->stats = NULL;
+
+	dev->removed = 0;
 	dev->in_use = 0;
+}
+
+// unregisters a device from the nat bus and the dvb subsystem
+//
+// the dvb core frees the frontend on unregistering, so if an application
+// still has it open, which would crash on closing it, the device is only
+// marked as removed. the application sees that the signal is lost and the
+// adapter and the input device are released once it closes the frontend,
+// unless the device comes back before (see tvsat_revive_device())
+static int tvsat_unregister_device(int dev_num)
+{
+	struct tvsat_device *dev;
+	int users;
+
+	if (dev_num < 0 || dev_num >= MAX_DEVS)
+		return -ENODEV;
+
+	dev = &tvsat->devices[dev_num];
+
+	if (!dev->in_use || dev->removed)
+		return -ENODEV;
+
+	spin_lock(&dev->users_lock);
+	dev->removed = 1;
+	users = dev->fe_users;
+	spin_unlock(&dev->users_lock);
+
+	if (users > 0) {
+		// report the lost lock with the next fe_get_event
+		dev->tuned = 1;
+
+		printk(KERN_NOTICE "tvsat: Removed device %s, keeping DVB adapter%i until it is closed\n", dev->device->name, dev->adapter->num);
+		return 0;
+	}
+
+	tvsat_release_device(dev);
 
 	return 0;
 }
 
+// hands a removed device that is still in use to a new daemon, its input
+// device was kept, so there is nothing to register again
+static int tvsat_revive_device(int dev_num)
+{
+	struct tvsat_device *dev = &tvsat->devices[dev_num];
+	int users;
+
+	spin_lock(&dev->users_lock);
+	dev->removed = 0;
+	users = dev->fe_users;
+	spin_unlock(&dev->users_lock);
+
+	// the new daemon has to know that the frontend is open
+	if (users > 0)
+		tvsat_add_connect_event(&dev->events);
+
+	printk(KERN_NOTICE "tvsat: Device %s is back on DVB adapter%i\n", dev->device->name, dev->adapter->num);
+
+	return dev_num + 1;
+}
+
+// releases a removed device after the last application closed its frontend
+static void tvsat_remove_work(struct work_struct *work)
+{
+	struct tvsat_device *dev = container_of(work, struct tvsat_device, remove_work);
+	int users;
+
+	mutex_lock(&tvsat->lock);
+
+	spin_lock(&dev->users_lock);
+	users = dev->fe_users;
+	spin_unlock(&dev->users_lock);
+
+	// the device may have been revived in the meantime
+	if (dev->in_use && dev->removed && !users) {
+		printk(KERN_NOTICE "tvsat: Releasing removed device %s\n", dev->device->name);
+		tvsat_release_device(dev);
+	}
+
+	mutex_unlock(&tvsat->lock);
+}
+
 // compares two device id structures
 static int tvsat_dev_id_cmp(struct tvsat_dev_id *id1, struct tvsat_dev_id *id2)
 {
@@ -1033,18 +1403,29 @@ static long tvsat_control_ioctl(/* struct inode *inode, */ struct file *file, un
 
 		minor = 0;
 
+		mutex_lock(&tvsat->lock);
+
 		for (i = 0; i < MAX_DEVS; ++i) {
 			if (tvsat->devices[i].in_use && tvsat_dev_id_cmp(&dev_id, tvsat->devices[i].dev_id)) {
-				printk(KERN_NOTICE "Device already registered. Re-using dvb adapter\n");
-				minor = i + 1;
+				if (tvsat->devices[i].removed) {
+					minor = tvsat_revive_device(i);
+				} else {
+					printk(KERN_NOTICE "Device already registered. Re-using dvb adapter\n");
+					minor = i + 1;
+				}
+				break;
 			}
 		}
 
-		if (minor == 0) {
+		if (minor == 0)
 			minor = tvsat_register_device(&dev_id);
-			if (minor < 0)
-				return -EFAULT;
-		}
+
+		// the requested adapter may have been taken already, the device
+		// can only be read while nothing can release it
+		if ((minor > 0) && (minor <= MAX_DEVS))
+			dev_id.adapter = tvsat->devices[minor - 1].adapter->num;
+
+		mutex_unlock(&tvsat->lock);
 
 		if ((minor > 255) || (minor < 0))
 			return -EFAULT;
@@ -1065,19 +1446,21 @@ static long tvsat_control_ioctl(/* struct inode *inode, */ struct file *file, un
 
 		found = 0;
 
+		mutex_lock(&tvsat->lock);
+
 		for (i = 0; i < MAX_DEVS; ++i) {
-			if (tvsat->devices[i].in_use && tvsat_dev_id_cmp(&dev_id, tvsat->devices[i].dev_id)) {
+			if (tvsat->devices[i].in_use && !tvsat->devices[i].removed && tvsat_dev_id_cmp(&dev_id, tvsat->devices[i].dev_id)) {
 				found = 1;
 				break;
 			}
 		}
 
-		if (!found)
-			return -ENODEV;
+		if (found)
+			tvsat_unregister_device(i);
 
-		tvsat_unregister_device(i);
+		mutex_unlock(&tvsat->lock);
 
-		return 0;
+		return found ? 0 : -ENODEV;
 	default:
 		return -EINVAL;
 	}
@@ -1113,8 +1496,13 @@ static int __init tvsat_module_init(void)
 	tvsat = kmalloc(sizeof(struct tvsat), GFP_KERNEL);
 	memset(tvsat, 0, sizeof(struct tvsat));
 
-	for (i = 0; i < MAX_DEVS; ++i)
+	mutex_init(&tvsat->lock);
+
+	for (i = 0; i < MAX_DEVS; ++i) {
 		tvsat->devices[i].in_use = 0;
+		spin_lock_init(&tvsat->devices[i].users_lock);
+		INIT_WORK(&tvsat->devices[i].remove_work, tvsat_remove_work);
+	}
 
 	tvsat->driver.driver.name = DRIVER_NAME;
 	tvsat->driver.driver.probe = tvsat_device_probe;
@@ -1154,6 +1542,11 @@ static int __init tvsat_module_init(void)
 #endif
 #endif
 
+#ifdef TVSAT_STATS
+	// the statistics are not essential, so a missing debugfs isn't an error
+	tvsat->debugfs = debugfs_create_dir(DRIVER_NAME, NULL);
+#endif
+
 	return 0;
 }
 
@@ -1166,6 +1559,11 @@ static void __exit tvsat_module_exit(void)
 	printk(KERN_INFO "Unloading " PRODUCT_NAME " driver\n");
 
 	if (tvsat) {
+		// removed devices that were closed in the meantime are released
+		// by their pending work, nothing can have them open anymore
+		for (i = 0; i < MAX_DEVS; ++i)
+			flush_work(&tvsat->devices[i].remove_work);
+
 		for (i = 0; i < MAX_DEVS; ++i)
 			tvsat_unregister_device(i);
 
@@ -1178,6 +1576,9 @@ static void __exit tvsat_module_exit(void)
 #endif
 		class_destroy(tvsat->nat_class);
 		driver_unregister(&tvsat->driver.driver);
+#ifdef TVSAT_STATS
+		debugfs_remove_recursive(tvsat->debugfs);
+#endif
 		kfree(tvsat);
 	}
 }